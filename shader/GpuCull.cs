@@ -0,0 +1,139 @@
+#version 460
+
+// GPU-driven culling (see helper/gpudrivenrenderer.h). Each invocation tests one object against the
+// frustum and the Hi-Z pyramid, and appends the draw data and commands of a visible one to its batch.
+layout (local_size_x = 64) in;
+
+// Read by shader/TextureMixedIndirect.vert as Draws[gl_BaseInstance]
+struct DrawData
+{
+    mat4 MVP;
+    mat4 ModelViewMatrix;
+    mat4 NormalMatrix;
+    uint Material;
+};
+
+struct Object
+{
+    mat4 Model;
+    uint Mesh;
+    uint Material;
+    uint Occluded;   // Frustum visible but hidden in the early pass, for the late pass to test again
+    uint Pad;
+};
+
+struct Mesh
+{
+    vec4 BoundsMin;
+    vec4 BoundsMax;
+    uint Batch;
+    uint BatchOffset;
+    uint FirstCommand;
+    uint CommandCount;
+};
+
+struct CommandTemplate
+{
+    uint Count;
+    uint FirstIndex;
+    int BaseVertex;
+    uint Pad;
+};
+
+struct DrawCommand
+{
+    uint Count;
+    uint InstanceCount;
+    uint FirstIndex;
+    int BaseVertex;
+    uint BaseInstance;
+};
+
+// Header counters, then the command count of every batch: the early pass's, then the late pass's
+layout (std430, binding = 0) buffer CountBuffer
+{
+    uint DrawCount;
+    uint FrustumVisible;
+    uint EarlyVisible;
+    uint LateVisible;
+    uint BatchCounts[];
+};
+
+layout (std430, binding = 1) writeonly buffer DrawDataBuffer { DrawData Draws[]; };
+layout (std430, binding = 4) buffer ObjectBuffer { Object Objects[]; };
+layout (std430, binding = 5) readonly buffer MeshBuffer { Mesh Meshes[]; };
+layout (std430, binding = 6) readonly buffer TemplateBuffer { CommandTemplate Templates[]; };
+layout (std430, binding = 7) writeonly buffer CommandBuffer { DrawCommand Commands[]; };
+
+layout (binding = 4) uniform sampler2D Pyramid;
+
+layout (location = 0) uniform mat4 View;
+layout (location = 1) uniform mat4 Projection;
+layout (location = 2) uniform vec4 Planes[6];   // Normals inwards
+layout (location = 8) uniform mat4 PyramidViewProjection;
+layout (location = 9) uniform int Pass;         // 0 early, 1 late
+layout (location = 10) uniform bool UsePyramid;
+layout (location = 11) uniform int Levels;
+layout (location = 12) uniform uint ObjectCount;
+layout (location = 13) uniform uint BatchCount;
+layout (location = 14) uniform uint CommandCapacity;   // Per pass, the late pass writes after the early one
+
+#include "HiZTest.glsl"
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= ObjectCount)
+        return;
+
+    Object object = Objects[index];
+    if (Pass == 1 && object.Occluded == 0u)
+        return;
+
+    // World box around the transformed mesh box
+    Mesh mesh = Meshes[object.Mesh];
+    vec3 center = 0.5 * (mesh.BoundsMin.xyz + mesh.BoundsMax.xyz);
+    vec3 extent = 0.5 * (mesh.BoundsMax.xyz - mesh.BoundsMin.xyz);
+    vec3 worldCenter = (object.Model * vec4(center, 1.0)).xyz;
+    vec3 worldExtent = abs(object.Model[0].xyz) * extent.x + abs(object.Model[1].xyz) * extent.y + abs(object.Model[2].xyz) * extent.z;
+
+    if (Pass == 0)
+    {
+        Objects[index].Occluded = 0u;
+        for (int i = 0; i < 6; i++)
+        {
+            if (dot(Planes[i].xyz, worldCenter) + Planes[i].w < -dot(abs(Planes[i].xyz), worldExtent))
+                return;
+        }
+        atomicAdd(FrustumVisible, 1u);
+
+        if (UsePyramid && isOccluded(PyramidViewProjection, worldCenter - worldExtent, worldCenter + worldExtent))
+        {
+            Objects[index].Occluded = 1u;
+            return;
+        }
+        atomicAdd(EarlyVisible, 1u);
+    }
+    else
+    {
+        if (!UsePyramid || isOccluded(PyramidViewProjection, worldCenter - worldExtent, worldCenter + worldExtent))
+            return;
+        atomicAdd(LateVisible, 1u);
+    }
+
+    // The normal matrix is the model view, the objects are scaled uniformly
+    uint draw = atomicAdd(DrawCount, 1u);
+    mat4 modelView = View * object.Model;
+    Draws[draw].MVP = Projection * modelView;
+    Draws[draw].ModelViewMatrix = modelView;
+    Draws[draw].NormalMatrix = modelView;
+    Draws[draw].Material = object.Material;
+
+    uint first = uint(Pass) * CommandCapacity + mesh.BatchOffset
+        + atomicAdd(BatchCounts[uint(Pass) * BatchCount + mesh.Batch], mesh.CommandCount);
+    for (uint i = 0u; i < mesh.CommandCount; i++)
+    {
+        CommandTemplate command = Templates[mesh.FirstCommand + i];
+        Commands[first + i] = DrawCommand(command.Count, 1u, command.FirstIndex, command.BaseVertex, draw);
+    }
+}
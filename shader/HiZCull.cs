@@ -0,0 +1,72 @@
+#version 460
+
+// Occlusion test of IndirectRenderer commands against the Hi-Z pyramid (see helper/hizculler.h).
+// Each invocation copies one command to the buffer of its pass, with an instance count of 0 when culled.
+layout (local_size_x = 64) in;
+
+struct DrawCommand
+{
+    uint Count;
+    uint InstanceCount;
+    uint FirstIndex;
+    int BaseVertex;
+    uint BaseInstance;   // Draw index
+};
+
+layout (std430, binding = 4) readonly buffer SourceBuffer { DrawCommand Commands[]; };
+layout (std430, binding = 5) buffer EarlyBuffer { DrawCommand Early[]; };
+layout (std430, binding = 6) writeonly buffer LateBuffer { DrawCommand Late[]; };
+
+// World space min and max of every draw
+layout (std430, binding = 7) readonly buffer BoxBuffer { vec4 Boxes[]; };
+
+layout (binding = 0, offset = 0) uniform atomic_uint Tested;
+layout (binding = 0, offset = 4) uniform atomic_uint EarlyVisible;
+layout (binding = 0, offset = 8) uniform atomic_uint LateVisible;
+
+layout (binding = 4) uniform sampler2D Pyramid;
+
+layout (location = 0) uniform mat4 ViewProjection;   // The pyramid's
+layout (location = 1) uniform int Pass;              // 0 early, 1 late
+layout (location = 2) uniform bool HasPyramid;
+layout (location = 3) uniform int Levels;
+layout (location = 4) uniform uint CommandCount;
+
+#include "HiZTest.glsl"
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= CommandCount)
+        return;
+
+    DrawCommand command = Commands[index];
+    uint draw = command.BaseInstance;
+
+    // A draw's commands are consecutive, its first one counts it
+    bool counts = index == 0 || Commands[index - 1].BaseInstance != draw;
+
+    bool visible;
+    if (Pass == 0)
+    {
+        visible = !HasPyramid || !isOccluded(ViewProjection, Boxes[draw * 2].xyz, Boxes[draw * 2 + 1].xyz);
+        if (counts)
+        {
+            atomicCounterIncrement(Tested);
+            if (visible)
+                atomicCounterIncrement(EarlyVisible);
+        }
+        Early[index] = command;
+        Early[index].InstanceCount = visible ? command.InstanceCount : 0u;
+    }
+    else
+    {
+        // Drawn by the early pass already, or tested again against this frame's depth
+        bool drawn = Early[index].InstanceCount != 0u || command.InstanceCount == 0u;
+        visible = !drawn && HasPyramid && !isOccluded(ViewProjection, Boxes[draw * 2].xyz, Boxes[draw * 2 + 1].xyz);
+        if (counts && visible)
+            atomicCounterIncrement(LateVisible);
+        Late[index] = command;
+        Late[index].InstanceCount = visible ? command.InstanceCount : 0u;
+    }
+}
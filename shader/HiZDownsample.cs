@@ -0,0 +1,39 @@
+#version 460
+
+// One level of the Hi-Z pyramid (see helper/hizculler.h). Level 0 copies the depth texture,
+// every other level keeps the farthest depth of the texels under it on the level above.
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 4) uniform sampler2D Depth;
+
+layout (r32f, binding = 0) readonly uniform image2D Source;
+layout (r32f, binding = 1) writeonly uniform image2D Destination;
+
+layout (location = 0) uniform int Level;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(Destination);
+    if (any(greaterThanEqual(texel, size)))
+        return;
+
+    if (Level == 0)
+    {
+        imageStore(Destination, texel, vec4(texelFetch(Depth, texel, 0).r));
+        return;
+    }
+
+    // Levels halve rounding down, so on an odd edge the last texel also covers the leftover row or column
+    ivec2 sourceSize = imageSize(Source);
+    ivec2 first = texel * 2;
+    ivec2 last = min(first + 1 + ivec2(equal(texel, size - 1)) * (sourceSize & 1), sourceSize - 1);
+
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; y++)
+    {
+        for (int x = first.x; x <= last.x; x++)
+            depth = max(depth, imageLoad(Source, ivec2(x, y)).r);
+    }
+    imageStore(Destination, texel, vec4(depth));
+}
@@ -0,0 +1,52 @@
+// Occlusion test against the Hi-Z pyramid (see helper/hizculler.h), included by shader/HiZCull.cs and
+// shader/GpuCull.cs. The includer declares the pyramid as Pyramid and its mip count as Levels.
+
+// Fetches with the texel rounding the downsampling uses, so each texel covers the pixels mapped to it
+float farthestDepth(ivec2 pixel, int level)
+{
+    ivec2 texel = min(pixel >> level, textureSize(Pyramid, level) - 1);
+    return texelFetch(Pyramid, texel, level).r;
+}
+
+// viewProjection is the pyramid's, the camera may have moved since it was built
+bool isOccluded(mat4 viewProjection, vec3 boxMin, vec3 boxMax)
+{
+    vec2 ndcMin = vec2(1.0);
+    vec2 ndcMax = vec2(-1.0);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? boxMax.x : boxMin.x,
+                           (i & 2) != 0 ? boxMax.y : boxMin.y,
+                           (i & 4) != 0 ? boxMax.z : boxMin.z);
+        vec4 clip = viewProjection * vec4(corner, 1.0);
+
+        // Reaches behind the eye, the projected rectangle would be wrong
+        if (clip.w <= 0.0)
+            return false;
+
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc.xy);
+        ndcMax = max(ndcMax, ndc.xy);
+        nearest = min(nearest, ndc.z);
+    }
+
+    // Outside the pyramid's view, it knows nothing there
+    if (any(lessThan(ndcMin, vec2(-1.0))) || any(greaterThan(ndcMax, vec2(1.0))))
+        return false;
+
+    vec2 size = vec2(textureSize(Pyramid, 0));
+    ivec2 pixelMin = ivec2((ndcMin * 0.5 + 0.5) * size);
+    ivec2 pixelMax = min(ivec2((ndcMax * 0.5 + 0.5) * size), ivec2(size) - 1);
+
+    // The first level where the rectangle spans at most 2x2 texels
+    int level = 0;
+    while (level + 1 < Levels && any(greaterThan((pixelMax >> level) - (pixelMin >> level), ivec2(1))))
+        level++;
+
+    float farthest = max(max(farthestDepth(pixelMin, level), farthestDepth(ivec2(pixelMax.x, pixelMin.y), level)),
+                         max(farthestDepth(ivec2(pixelMin.x, pixelMax.y), level), farthestDepth(pixelMax, level)));
+
+    // Default depth range, [-1, 1] maps to [0, 1]
+    return nearest * 0.5 + 0.5 > farthest;
+}
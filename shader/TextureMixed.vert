@@ -23,28 +23,11 @@ out gl_PerVertex
     vec4 gl_Position;
 };
 
-uniform vec4 LightPosition;
+#include "TextureMixedTangentSpace.glsl"
 
 void main()
 {
-    // Transform normal and tangent to eye space
-    vec3 norm = normalize( NormalMatrix * VertexNormal );
-    vec3 tang = normalize( NormalMatrix * vec3(VertexTangent) );
-
-    // Compute the binormal
-    vec3 binormal = normalize( cross( norm, tang ) ) * VertexTangent.w;
-
-    // Matrix for transformation to tangent space
-    mat3 toObjectLocal = mat3(
-        tang.x, binormal.x, norm.x,
-        tang.y, binormal.y, norm.y,
-        tang.z, binormal.z, norm.z);
-
-    // Transform light direction and view direction to tangent space
-    vec3 pos = vec3( ModelViewMatrix * vec4(VertexPosition,1.0) );
-
-    LightDir = normalize( toObjectLocal * (LightPosition.xyz - pos) );
-    ViewDir = toObjectLocal * normalize(-pos);
+    tangentSpaceLighting(ModelViewMatrix, NormalMatrix, VertexPosition, VertexNormal, VertexTangent);
     TexCoord = VertexTexCoord;
 
     gl_Position = MVP * vec4(VertexPosition,1.0);
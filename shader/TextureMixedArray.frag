@@ -0,0 +1,41 @@
+#version 460
+
+// TextureMixed.frag with the textures of every material in one array (see helper/texturearray.h)
+layout (binding = 3) uniform sampler2DArray MaterialTex;
+
+layout (location = 0) in vec2 TexCoord;
+layout (location = 1) in vec3 LightDir;
+layout (location = 2) in vec3 ViewDir;
+layout (location = 3) flat in uint MaterialIndex;
+
+// Array layers of each material, indexed by MaterialIndex
+struct MaterialLayers
+{
+    uint Diffuse;
+    uint Normal;
+    uint Mix;
+    uint Pad;
+};
+
+layout (std430, binding = 3) readonly buffer MaterialLayerBuffer
+{
+    MaterialLayers Layers[];
+};
+
+layout(location = 0) out vec4 FragColor;
+
+#include "TextureMixedLighting.glsl"
+
+void main()
+{
+    MaterialLayers layers = Layers[MaterialIndex];
+
+    // Lookup the normal from the normal map
+    vec4 normal = 2.0 * texture( MaterialTex, vec3(TexCoord, layers.Normal) ) - 1.0;
+
+    // Extract pixel color in tex0 and tex2
+    vec4 tex0Color = texture( MaterialTex, vec3(TexCoord, layers.Diffuse) );
+    vec4 tex2Color = texture( MaterialTex, vec3(TexCoord, layers.Mix) );
+
+    FragColor = shade(normal.xyz, tex0Color, tex2Color);
+}
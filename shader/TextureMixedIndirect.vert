@@ -0,0 +1,47 @@
+#version 460
+
+layout (location = 0) in vec3 VertexPosition;
+layout (location = 1) in vec3 VertexNormal;
+layout (location = 2) in vec2 VertexTexCoord;
+layout (location = 3) in vec4 VertexTangent;
+
+layout (location = 0) out vec2 TexCoord;
+layout (location = 1) out vec3 LightDir;
+layout (location = 2) out vec3 ViewDir;
+layout (location = 3) flat out uint MaterialIndex;
+
+// Per-draw matrices, filled by IndirectRenderer. Every command's base instance is its draw index.
+struct DrawData
+{
+    mat4 MVP;
+    mat4 ModelViewMatrix;
+    mat4 NormalMatrix;
+    uint Material;
+};
+
+layout (std430, binding = 1) readonly buffer DrawDataBuffer
+{
+    DrawData Draws[];
+};
+
+// Needed for seperate shaders
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+#include "TextureMixedTangentSpace.glsl"
+
+void main()
+{
+    DrawData draw = Draws[gl_BaseInstance];
+    mat4 MVP = draw.MVP;
+    mat4 ModelViewMatrix = draw.ModelViewMatrix;
+    mat3 NormalMatrix = mat3(draw.NormalMatrix);
+
+    tangentSpaceLighting(ModelViewMatrix, NormalMatrix, VertexPosition, VertexNormal, VertexTangent);
+    TexCoord = VertexTexCoord;
+    MaterialIndex = draw.Material;
+
+    gl_Position = MVP * vec4(VertexPosition,1.0);
+}
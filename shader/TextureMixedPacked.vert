@@ -0,0 +1,42 @@
+#version 460
+
+// TextureMixed.vert for meshes in a packed VertexFormat (see helper/vertexformat.h)
+layout (location = 0) in vec3 VertexPosition;  // Float, half, or unorm16 inside the bounding box
+layout (location = 1) in vec2 VertexNormal;    // Octahedral, snorm16
+layout (location = 2) in vec2 VertexTexCoord;
+layout (location = 3) in vec4 VertexTangent;   // Snorm 10:10:10, handedness in w
+
+layout (location = 0) out vec2 TexCoord;
+layout (location = 1) out vec3 LightDir;
+layout (location = 2) out vec3 ViewDir;
+
+// Uniform buffers
+layout (std140, binding = 0) uniform Matrices
+{
+    mat4 MVP;
+    mat4 ModelViewMatrix;
+    mat3 NormalMatrix;
+};
+
+// Needed for seperate shaders
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+#include "TextureMixedTangentSpace.glsl"
+
+// Maps quantized positions back to object space, identity for float and half positions
+uniform vec3 PositionScale = vec3(1.0);
+uniform vec3 PositionOffset = vec3(0.0);
+
+void main()
+{
+    vec3 position = VertexPosition * PositionScale + PositionOffset;
+    vec3 normal = octDecode(VertexNormal);
+
+    tangentSpaceLighting(ModelViewMatrix, NormalMatrix, position, normal, VertexTangent);
+    TexCoord = VertexTexCoord;
+
+    gl_Position = MVP * vec4(position,1.0);
+}
@@ -0,0 +1,59 @@
+#version 460
+
+// TextureMixedPacked.vert for TriangleMesh::renderInstanced (see helper/instancebuffer.h)
+layout (location = 0) in vec3 VertexPosition;  // Float, half, or unorm16 inside the bounding box
+layout (location = 1) in vec2 VertexNormal;    // Octahedral, snorm16
+layout (location = 2) in vec2 VertexTexCoord;
+layout (location = 3) in vec4 VertexTangent;   // Snorm 10:10:10, handedness in w
+
+layout (location = 0) out vec2 TexCoord;
+layout (location = 1) out vec3 LightDir;
+layout (location = 2) out vec3 ViewDir;
+layout (location = 3) flat out uint MaterialIndex;
+
+// Uniform buffers, the transform shared by all instances
+layout (std140, binding = 0) uniform Matrices
+{
+    mat4 MVP;
+    mat4 ModelViewMatrix;
+    mat3 NormalMatrix;
+};
+
+struct Instance
+{
+    mat4 Model;
+    uint Material;
+};
+
+layout (std430, binding = 2) readonly buffer InstanceBuffer
+{
+    Instance Instances[];
+};
+
+// Needed for seperate shaders
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+#include "TextureMixedTangentSpace.glsl"
+
+// Maps quantized positions back to object space, identity for float and half positions
+uniform vec3 PositionScale = vec3(1.0);
+uniform vec3 PositionOffset = vec3(0.0);
+
+void main()
+{
+    Instance instance = Instances[gl_BaseInstance + gl_InstanceID];
+    mat4 modelView = ModelViewMatrix * instance.Model;
+    mat3 normalMatrix = NormalMatrix * mat3(instance.Model);
+
+    vec3 position = VertexPosition * PositionScale + PositionOffset;
+    vec3 normal = octDecode(VertexNormal);
+
+    tangentSpaceLighting(modelView, normalMatrix, position, normal, VertexTangent);
+    TexCoord = VertexTexCoord;
+    MaterialIndex = instance.Material;
+
+    gl_Position = MVP * instance.Model * vec4(position,1.0);
+}
@@ -0,0 +1,38 @@
+// Tangent space lighting setup of TextureMixed.vert, included by it and by its wave, packed, instanced and
+// indirect variants. The includer declares the TexCoord, LightDir and ViewDir outputs.
+
+uniform vec4 LightPosition;
+
+// Unit normal from its octahedral encoding, for the packed vertex formats (see helper/vertexformat.h)
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += (n.x >= 0.0) ? -t : t;
+    n.y += (n.y >= 0.0) ? -t : t;
+    return normalize(n);
+}
+
+// Writes LightDir and ViewDir in tangent space. position, normal and tangent are in object space,
+// tangent.w is the handedness of the binormal.
+void tangentSpaceLighting(mat4 modelView, mat3 normalMatrix, vec3 position, vec3 normal, vec4 tangent)
+{
+    // Transform normal and tangent to eye space
+    vec3 norm = normalize( normalMatrix * normal );
+    vec3 tang = normalize( normalMatrix * vec3(tangent) );
+
+    // Compute the binormal
+    vec3 binormal = normalize( cross( norm, tang ) ) * tangent.w;
+
+    // Matrix for transformation to tangent space
+    mat3 toObjectLocal = mat3(
+        tang.x, binormal.x, norm.x,
+        tang.y, binormal.y, norm.y,
+        tang.z, binormal.z, norm.z);
+
+    // Transform light direction and view direction to tangent space
+    vec3 pos = vec3( modelView * vec4(position,1.0) );
+
+    LightDir = normalize( toObjectLocal * (LightPosition.xyz - pos) );
+    ViewDir = toObjectLocal * normalize(-pos);
+}
@@ -23,7 +23,8 @@ out gl_PerVertex
     vec4 gl_Position;
 };
 
-uniform vec4 LightPosition;
+#include "TextureMixedTangentSpace.glsl"
+
 uniform float Time;
 uniform float WaveFreq = 2.5;
 uniform float WaveVelocity = 2.5;
@@ -40,24 +41,7 @@ void main()
     vec3 n = vec3(0.0);
     n.xy = normalize(vec2(cos( u ), 1.0));
 
-    // Transform normal and tangent to eye space
-    vec3 norm = normalize( NormalMatrix * n );
-    vec3 tang = normalize( NormalMatrix * vec3(VertexTangent) );
-
-    // Compute the binormal
-    vec3 binormal = normalize( cross( norm, tang ) ) * VertexTangent.w;
-
-    // Matrix for transformation to tangent space
-    mat3 toObjectLocal = mat3(
-        tang.x, binormal.x, norm.x,
-        tang.y, binormal.y, norm.y,
-        tang.z, binormal.z, norm.z);
-
-    // Transform light direction and view direction to tangent space
-    vec3 pos2 = vec3( ModelViewMatrix * pos );
-
-    LightDir = normalize( toObjectLocal * (LightPosition.xyz - pos2) );
-    ViewDir = toObjectLocal * normalize(-pos2);
+    tangentSpaceLighting(ModelViewMatrix, NormalMatrix, pos.xyz, n, VertexTangent);
     TexCoord = VertexTexCoord;
 
     gl_Position = MVP * pos;
@@ -49,6 +49,22 @@ public:
         return max - min;
     }
 
+    // Surface area, the cost measure of the BVH (see bvh.h)
+    float area() const {
+        glm::vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    bool contains(const Aabb & other) const {
+        return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z &&
+               max.x >= other.max.x && max.y >= other.max.y && max.z >= other.max.z;
+    }
+
+    bool overlaps(const Aabb & other) const {
+        return min.x <= other.max.x && min.y <= other.max.y && min.z <= other.max.z &&
+               max.x >= other.min.x && max.y >= other.min.y && max.z >= other.min.z;
+    }
+
 	std::string toString() {
 		std::stringstream stream;
 		stream << "AABB: min= (" << min.x << ", " << min.y << ", " << min.z << ") " <<
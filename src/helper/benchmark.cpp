@@ -0,0 +1,44 @@
+#include "../pch.h"
+#include "benchmark.h"
+
+std::vector<Aabb> Benchmark::randomBoxes(std::mt19937& rng, size_t count, float halfSize, float minExtent, float maxExtent)
+{
+    std::uniform_real_distribution<float> position(-halfSize, halfSize);
+    std::uniform_real_distribution<float> size(minExtent, maxExtent);
+
+    std::vector<Aabb> boxes(count);
+    for (Aabb& box : boxes)
+    {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        glm::vec3 extent(size(rng), size(rng), size(rng));
+        box.min = center - extent;
+        box.max = center + extent;
+    }
+    return boxes;
+}
+
+std::vector<Aabb> Benchmark::randomBoxesInView(std::mt19937& rng, size_t count, float minDistance, float maxDistance,
+                                               float spreadX, float spreadY, float minExtent, float maxExtent)
+{
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> distance(minDistance, maxDistance);
+    std::uniform_real_distribution<float> size(minExtent, maxExtent);
+
+    std::vector<Aabb> boxes(count);
+    for (Aabb& box : boxes)
+    {
+        float z = -distance(rng);
+        glm::vec3 center(offset(rng) * -z * spreadX, offset(rng) * -z * spreadY, z);
+        glm::vec3 extent(size(rng));
+        box.min = center - extent;
+        box.max = center + extent;
+    }
+    return boxes;
+}
+
+glm::mat4 Benchmark::viewProjection(float farPlane)
+{
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(70.0f), 16.0f / 9.0f, 0.1f, farPlane);
+    return projection * view;
+}
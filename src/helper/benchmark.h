@@ -0,0 +1,34 @@
+#pragma once
+
+#include "aabb.h"
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <random>
+#include <vector>
+
+// Timing and random scenes shared by the culling benchmarks (FrustumCuller, Bvh, OcclusionRasterizer)
+namespace Benchmark
+{
+    inline double elapsedMs(std::chrono::steady_clock::time_point since)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    // Fixed seed, so every run of a benchmark sees the same scene
+    inline std::mt19937 random()
+    {
+        return std::mt19937(1234);
+    }
+
+    // Centers anywhere in [-halfSize, halfSize] on every axis, half extents in [minExtent, maxExtent] per axis
+    std::vector<Aabb> randomBoxes(std::mt19937& rng, size_t count, float halfSize, float minExtent, float maxExtent);
+
+    // Cubes in front of the viewProjection() camera at a distance in [minDistance, maxDistance], spread sideways by up to spreadX and spreadY
+    // times their distance, with half extents in [minExtent, maxExtent]
+    std::vector<Aabb> randomBoxesInView(std::mt19937& rng, size_t count, float minDistance, float maxDistance,
+                                        float spreadX, float spreadY, float minExtent, float maxExtent);
+
+    // The camera of every benchmark: at the origin looking down -z, 70 degrees vertical field of view, 16:9
+    glm::mat4 viewProjection(float farPlane);
+}
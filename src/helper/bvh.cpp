@@ -0,0 +1,578 @@
+#include "../pch.h"
+#include "bvh.h"
+#include "frustumculler.h"
+#include "benchmark.h"
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+    // Aabb::add goes through std::fmin, which the build and insert loops feel
+    void grow(Aabb& box, const glm::vec3& min, const glm::vec3& max)
+    {
+        box.min = glm::min(box.min, min);
+        box.max = glm::max(box.max, max);
+    }
+
+    Aabb merged(const Aabb& a, const Aabb& b)
+    {
+        Aabb box = a;
+        grow(box, b.min, b.max);
+        return box;
+    }
+
+    glm::vec3 centroid(const Aabb& box)
+    {
+        return (box.min + box.max) * 0.5f;
+    }
+}
+
+Bvh::Bvh(float margin)
+    : _margin(margin)
+{ }
+
+Bvh::Proxy Bvh::allocateNode()
+{
+    if (_freeList == Null)
+    {
+        _nodes.emplace_back();
+        return Proxy(_nodes.size() - 1);
+    }
+
+    Proxy node = _freeList;
+    _freeList = _nodes[node].parent;
+    _nodes[node] = Node();
+    return node;
+}
+
+void Bvh::freeNode(Proxy node)
+{
+    _nodes[node].parent = _freeList;
+    _nodes[node].height = -1;
+    _freeList = node;
+}
+
+void Bvh::clear()
+{
+    _nodes.clear();
+    _root = Null;
+    _freeList = Null;
+    _leafCount = 0;
+}
+
+Bvh::Proxy Bvh::insert(const Aabb& box, uint32_t object)
+{
+    Proxy leaf = allocateNode();
+    _nodes[leaf].box.min = box.min - glm::vec3(_margin);
+    _nodes[leaf].box.max = box.max + glm::vec3(_margin);
+    _nodes[leaf].object = object;
+    _nodes[leaf].height = 0;
+
+    insertLeaf(leaf);
+    _leafCount++;
+    return leaf;
+}
+
+void Bvh::remove(Proxy proxy)
+{
+    assert(_nodes[proxy].isLeaf() && _nodes[proxy].height == 0);
+    removeLeaf(proxy);
+    freeNode(proxy);
+    _leafCount--;
+}
+
+bool Bvh::update(Proxy proxy, const Aabb& box)
+{
+    if (_nodes[proxy].box.contains(box))
+        return false;
+
+    removeLeaf(proxy);
+    _nodes[proxy].box.min = box.min - glm::vec3(_margin);
+    _nodes[proxy].box.max = box.max + glm::vec3(_margin);
+    insertLeaf(proxy);
+    return true;
+}
+
+void Bvh::refit(Proxy proxy, const Aabb& box)
+{
+    _nodes[proxy].box.min = box.min - glm::vec3(_margin);
+    _nodes[proxy].box.max = box.max + glm::vec3(_margin);
+
+    // Parents that still contain the box are left alone, and so are theirs
+    for (Proxy node = _nodes[proxy].parent; node != Null; node = _nodes[node].parent)
+    {
+        if (_nodes[node].box.contains(_nodes[proxy].box))
+            break;
+        grow(_nodes[node].box, _nodes[proxy].box.min, _nodes[proxy].box.max);
+    }
+}
+
+void Bvh::insertLeaf(Proxy leaf)
+{
+    if (_root == Null)
+    {
+        _root = leaf;
+        _nodes[leaf].parent = Null;
+        return;
+    }
+
+    // Walk down towards the sibling that adds the least area. Going further down always costs the
+    // growth of the current node, so stop once both children cost more than pairing with it here.
+    const Aabb leafBox = _nodes[leaf].box;
+    Proxy sibling = _root;
+    while (!_nodes[sibling].isLeaf())
+    {
+        const Node& node = _nodes[sibling];
+        float area = node.box.area();
+        float combinedArea = merged(node.box, leafBox).area();
+
+        float cost = 2.0f * combinedArea;
+        float inheritance = 2.0f * (combinedArea - area);
+
+        float childCost[2];
+        for (int i = 0; i < 2; i++)
+        {
+            const Node& child = _nodes[node.child[i]];
+            float childArea = merged(child.box, leafBox).area();
+            childCost[i] = (child.isLeaf() ? childArea : childArea - child.box.area()) + inheritance;
+        }
+
+        if (cost < childCost[0] && cost < childCost[1])
+            break;
+
+        sibling = childCost[0] < childCost[1] ? node.child[0] : node.child[1];
+    }
+
+    Proxy oldParent = _nodes[sibling].parent;
+    Proxy newParent = allocateNode();
+    _nodes[newParent].parent = oldParent;
+    _nodes[newParent].box = merged(leafBox, _nodes[sibling].box);
+    _nodes[newParent].height = _nodes[sibling].height + 1;
+    _nodes[newParent].child[0] = sibling;
+    _nodes[newParent].child[1] = leaf;
+    _nodes[sibling].parent = newParent;
+    _nodes[leaf].parent = newParent;
+
+    if (oldParent == Null)
+        _root = newParent;
+    else if (_nodes[oldParent].child[0] == sibling)
+        _nodes[oldParent].child[0] = newParent;
+    else
+        _nodes[oldParent].child[1] = newParent;
+
+    fixUpwards(_nodes[leaf].parent);
+}
+
+void Bvh::removeLeaf(Proxy leaf)
+{
+    if (leaf == _root)
+    {
+        _root = Null;
+        return;
+    }
+
+    Proxy parent = _nodes[leaf].parent;
+    Proxy grandParent = _nodes[parent].parent;
+    Proxy sibling = _nodes[parent].child[0] == leaf ? _nodes[parent].child[1] : _nodes[parent].child[0];
+
+    // The sibling takes the parent's place
+    _nodes[sibling].parent = grandParent;
+    freeNode(parent);
+
+    if (grandParent == Null)
+    {
+        _root = sibling;
+        return;
+    }
+
+    if (_nodes[grandParent].child[0] == parent)
+        _nodes[grandParent].child[0] = sibling;
+    else
+        _nodes[grandParent].child[1] = sibling;
+
+    fixUpwards(grandParent);
+}
+
+void Bvh::fixUpwards(Proxy node)
+{
+    while (node != Null)
+    {
+        node = balance(node);
+
+        Node& current = _nodes[node];
+        const Node& child0 = _nodes[current.child[0]];
+        const Node& child1 = _nodes[current.child[1]];
+        current.height = 1 + std::max(child0.height, child1.height);
+        current.box = merged(child0.box, child1.box);
+
+        node = current.parent;
+    }
+}
+
+Bvh::Proxy Bvh::balance(Proxy a)
+{
+    if (_nodes[a].isLeaf() || _nodes[a].height < 2)
+        return a;
+
+    int heightDiff = _nodes[_nodes[a].child[1]].height - _nodes[_nodes[a].child[0]].height;
+    if (heightDiff >= -1 && heightDiff <= 1)
+        return a;
+
+    // The taller child x moves up into a's place. a keeps its other child y and takes the shorter
+    // of x's children, x keeps its taller one.
+    int side = heightDiff > 1 ? 1 : 0;
+    Proxy x = _nodes[a].child[side];
+    Proxy y = _nodes[a].child[1 - side];
+    Proxy xChild0 = _nodes[x].child[0];
+    Proxy xChild1 = _nodes[x].child[1];
+    bool keepFirst = _nodes[xChild0].height > _nodes[xChild1].height;
+    Proxy kept = keepFirst ? xChild0 : xChild1;
+    Proxy moved = keepFirst ? xChild1 : xChild0;
+
+    Proxy parent = _nodes[a].parent;
+    _nodes[x].parent = parent;
+    if (parent == Null)
+        _root = x;
+    else if (_nodes[parent].child[0] == a)
+        _nodes[parent].child[0] = x;
+    else
+        _nodes[parent].child[1] = x;
+
+    _nodes[x].child[0] = a;
+    _nodes[x].child[1] = kept;
+    _nodes[a].parent = x;
+    _nodes[a].child[side] = moved;
+    _nodes[moved].parent = a;
+
+    _nodes[a].box = merged(_nodes[y].box, _nodes[moved].box);
+    _nodes[a].height = 1 + std::max(_nodes[y].height, _nodes[moved].height);
+    _nodes[x].box = merged(_nodes[a].box, _nodes[kept].box);
+    _nodes[x].height = 1 + std::max(_nodes[a].height, _nodes[kept].height);
+    return x;
+}
+
+void Bvh::rebuild()
+{
+    std::vector<BuildLeaf> leaves;
+    leaves.reserve(_leafCount);
+
+    // Leaves keep their nodes, every inner node goes back to the free list
+    for (Proxy node = 0; node < (Proxy)_nodes.size(); node++)
+    {
+        if (_nodes[node].height == 0)
+            leaves.push_back({ _nodes[node].box, centroid(_nodes[node].box), node });
+        else if (_nodes[node].height > 0)
+            freeNode(node);
+    }
+
+    _root = leaves.empty() ? Null : build(leaves, 0, leaves.size());
+    if (_root != Null)
+        _nodes[_root].parent = Null;
+}
+
+Bvh::Proxy Bvh::build(std::vector<BuildLeaf>& leaves, size_t begin, size_t end)
+{
+    if (end - begin == 1)
+        return leaves[begin].leaf;
+
+    const int Bins = 16;
+
+    Aabb centroids;
+    for (size_t i = begin; i < end; i++)
+        grow(centroids, leaves[i].centroid, leaves[i].centroid);
+
+    glm::vec3 extent = centroids.max - centroids.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+    size_t middle = begin + (end - begin) / 2;
+    if (extent[axis] > 0.0f)
+    {
+        // Bin the centroids along the axis and split where count * area of both sides is lowest
+        float scale = Bins / extent[axis];
+        auto binOf = [&](const BuildLeaf& leaf) {
+            return std::min(Bins - 1, int((leaf.centroid[axis] - centroids.min[axis]) * scale));
+        };
+
+        std::array<Aabb, Bins> binBoxes;
+        std::array<size_t, Bins> binCounts = {};
+        for (size_t i = begin; i < end; i++)
+        {
+            int bin = binOf(leaves[i]);
+            grow(binBoxes[bin], leaves[i].box.min, leaves[i].box.max);
+            binCounts[bin]++;
+        }
+
+        std::array<float, Bins> rightCost = {};
+        Aabb right;
+        size_t rightCount = 0;
+        for (int bin = Bins - 1; bin > 0; bin--)
+        {
+            grow(right, binBoxes[bin].min, binBoxes[bin].max);
+            rightCount += binCounts[bin];
+            rightCost[bin] = rightCount ? rightCount * right.area() : 0.0f;
+        }
+
+        float bestCost = std::numeric_limits<float>::max();
+        int bestSplit = 0;
+        Aabb left;
+        size_t leftCount = 0;
+        for (int split = 1; split < Bins; split++)
+        {
+            grow(left, binBoxes[split - 1].min, binBoxes[split - 1].max);
+            leftCount += binCounts[split - 1];
+            float cost = (leftCount ? leftCount * left.area() : 0.0f) + rightCost[split];
+            if (leftCount > 0 && leftCount < end - begin && cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = split;
+            }
+        }
+
+        if (bestSplit > 0)
+        {
+            auto it = std::partition(leaves.begin() + begin, leaves.begin() + end,
+                [&](const BuildLeaf& leaf) { return binOf(leaf) < bestSplit; });
+            middle = size_t(it - leaves.begin());
+        }
+    }
+
+    // All centroids in one bin, split the range in half along the axis
+    if (middle == begin || middle == end)
+    {
+        middle = begin + (end - begin) / 2;
+        std::nth_element(leaves.begin() + begin, leaves.begin() + middle, leaves.begin() + end,
+            [axis](const BuildLeaf& a, const BuildLeaf& b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    Proxy node = allocateNode();
+    Proxy child0 = build(leaves, begin, middle);
+    Proxy child1 = build(leaves, middle, end);
+
+    _nodes[node].child[0] = child0;
+    _nodes[node].child[1] = child1;
+    _nodes[node].box = merged(_nodes[child0].box, _nodes[child1].box);
+    _nodes[node].height = 1 + std::max(_nodes[child0].height, _nodes[child1].height);
+    _nodes[child0].parent = node;
+    _nodes[child1].parent = node;
+    return node;
+}
+
+void Bvh::appendLeaves(Proxy node, std::vector<uint32_t>& objects) const
+{
+    if (_nodes[node].isLeaf())
+    {
+        objects.push_back(_nodes[node].object);
+        return;
+    }
+    appendLeaves(_nodes[node].child[0], objects);
+    appendLeaves(_nodes[node].child[1], objects);
+}
+
+size_t Bvh::query(const Frustum& frustum, std::vector<uint32_t>& objects) const
+{
+    if (_root == Null)
+        return 0;
+
+    size_t visited = 0;
+    std::vector<Proxy> stack;
+    stack.reserve(64);
+    stack.push_back(_root);
+
+    while (!stack.empty())
+    {
+        const Node& node = _nodes[stack.back()];
+        Proxy index = stack.back();
+        stack.pop_back();
+        visited++;
+
+        if (!frustum.intersects(node.box))
+            continue;
+
+        if (node.isLeaf())
+            objects.push_back(node.object);
+        else if (frustum.contains(node.box))
+            appendLeaves(index, objects);
+        else
+        {
+            stack.push_back(node.child[0]);
+            stack.push_back(node.child[1]);
+        }
+    }
+    return visited;
+}
+
+size_t Bvh::query(const Aabb& box, std::vector<uint32_t>& objects) const
+{
+    if (_root == Null)
+        return 0;
+
+    size_t visited = 0;
+    std::vector<Proxy> stack;
+    stack.reserve(64);
+    stack.push_back(_root);
+
+    while (!stack.empty())
+    {
+        const Node& node = _nodes[stack.back()];
+        stack.pop_back();
+        visited++;
+
+        if (!node.box.overlaps(box))
+            continue;
+
+        if (node.isLeaf())
+            objects.push_back(node.object);
+        else
+        {
+            stack.push_back(node.child[0]);
+            stack.push_back(node.child[1]);
+        }
+    }
+    return visited;
+}
+
+Bvh::RayHit Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+{
+    RayHit hit;
+    if (_root == Null)
+        return hit;
+
+    glm::vec3 inverse = 1.0f / direction;
+    float closest = maxDistance;
+
+    // Distance at which the ray enters the box, or a negative value when it misses or enters too late
+    auto enter = [&](const Aabb& box) {
+        glm::vec3 t0 = (box.min - origin) * inverse;
+        glm::vec3 t1 = (box.max - origin) * inverse;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float tExit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+        return (tEnter <= tExit && tEnter <= closest) ? tEnter : -1.0f;
+    };
+
+    std::vector<std::pair<Proxy, float>> stack;
+    stack.reserve(64);
+    float rootDistance = enter(_nodes[_root].box);
+    if (rootDistance >= 0.0f)
+        stack.emplace_back(_root, rootDistance);
+
+    while (!stack.empty())
+    {
+        auto [index, distance] = stack.back();
+        stack.pop_back();
+
+        // Something closer was found since this node was pushed
+        if (distance > closest)
+            continue;
+
+        const Node& node = _nodes[index];
+        if (node.isLeaf())
+        {
+            closest = distance;
+            hit.proxy = index;
+            hit.object = node.object;
+            hit.distance = distance;
+            continue;
+        }
+
+        // Nearer child on top, so it is visited first
+        float d0 = enter(_nodes[node.child[0]].box);
+        float d1 = enter(_nodes[node.child[1]].box);
+        if (d0 >= 0.0f && d1 >= 0.0f)
+        {
+            bool firstNearer = d0 <= d1;
+            stack.emplace_back(firstNearer ? node.child[1] : node.child[0], firstNearer ? d1 : d0);
+            stack.emplace_back(firstNearer ? node.child[0] : node.child[1], firstNearer ? d0 : d1);
+        }
+        else if (d0 >= 0.0f)
+            stack.emplace_back(node.child[0], d0);
+        else if (d1 >= 0.0f)
+            stack.emplace_back(node.child[1], d1);
+    }
+    return hit;
+}
+
+float Bvh::cost() const
+{
+    if (_root == Null)
+        return 0.0f;
+
+    float innerArea = 0.0f;
+    for (const Node& node : _nodes)
+    {
+        if (node.height > 0)
+            innerArea += node.box.area();
+    }
+    return innerArea / std::max(_nodes[_root].box.area(), 1e-6f);
+}
+
+Bvh::BenchmarkResult Bvh::benchmark(size_t objects)
+{
+    // Same density at every count: the boxes fill a cube that grows with the cube root of the count
+    float halfSize = 2.0f * std::cbrt(float(objects));
+    std::mt19937 rng = Benchmark::random();
+    std::uniform_real_distribution<float> jitter(-0.1f, 0.1f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<Aabb> boxes = Benchmark::randomBoxes(rng, objects, halfSize, 0.1f, 0.5f);
+
+    BenchmarkResult result;
+    result.objects = objects;
+
+    Bvh bvh;
+    std::vector<Proxy> proxies(objects);
+    auto startTime = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < objects; i++)
+        proxies[i] = bvh.insert(boxes[i], uint32_t(i));
+    result.insertMs = Benchmark::elapsedMs(startTime);
+    float insertedCost = bvh.cost();
+
+    startTime = std::chrono::steady_clock::now();
+    bvh.rebuild();
+    result.buildMs = Benchmark::elapsedMs(startTime);
+
+    for (Aabb& box : boxes)
+    {
+        glm::vec3 offset(jitter(rng), jitter(rng), jitter(rng));
+        box.min += offset;
+        box.max += offset;
+    }
+    startTime = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < objects; i++)
+        bvh.refit(proxies[i], boxes[i]);
+    result.refitMs = Benchmark::elapsedMs(startTime);
+
+    // Camera in the middle of the boxes, seeing about a tenth of the cube
+    Frustum frustum = Frustum::fromMatrix(Benchmark::viewProjection(halfSize));
+
+    std::vector<uint32_t> visible;
+    visible.reserve(objects);
+    startTime = std::chrono::steady_clock::now();
+    bvh.query(frustum, visible);
+    result.frustumMs = Benchmark::elapsedMs(startTime);
+    result.visible = visible.size();
+
+    FrustumCuller culler;
+    culler.reserve(objects);
+    for (const Aabb& box : boxes)
+        culler.add(box);
+    culler.cull(frustum);
+    result.linearMs = culler.stats().ms;
+
+    startTime = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    for (int ray = 0; ray < 1000; ray++)
+    {
+        glm::vec3 direction = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+        if (bvh.raycast(glm::vec3(0.0f), direction, 2.0f * halfSize).valid())
+            hits++;
+    }
+    result.rayMs = Benchmark::elapsedMs(startTime);
+
+    LOG_INFO("BVH {} objects: insert {:.1f} ms (cost {:.1f}), SAH rebuild {:.1f} ms (cost {:.1f}, height {}), refit {:.1f} ms",
+        objects, result.insertMs, insertedCost, result.buildMs, bvh.cost(), bvh.height(), result.refitMs);
+    LOG_INFO("BVH {} objects: frustum {:.3f} ms ({} visible, linear {:.3f} ms), 1000 rays {:.3f} ms ({} hits)",
+        objects, result.frustumMs, result.visible, result.linearMs, result.rayMs, hits);
+    return result;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "aabb.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+struct Frustum;
+
+// Dynamic bounding volume hierarchy over object boxes.
+//
+// Each object is a leaf, and its proxy (the leaf's node index) stays valid until it is removed,
+// whatever happens to the tree around it. Inserting picks the sibling that adds the least surface
+// area, and ancestors are rotated like an AVL tree so the height stays logarithmic.
+// Moving objects either go through update(), which only reinserts objects that leave their margin,
+// or refit(), which grows the ancestors in place without changing the tree. A tree degraded by
+// many refits can be rebuilt top down with the surface area heuristic.
+class Bvh
+{
+public:
+    using Proxy = int32_t;
+    static const Proxy Null = -1;
+
+    struct RayHit
+    {
+        Proxy proxy = Null;
+        uint32_t object = 0;
+        float distance = 0.0f;
+
+        bool valid() const { return proxy != Null; }
+    };
+
+    struct BenchmarkResult
+    {
+        size_t objects = 0;
+        double insertMs = 0.0;    // Incremental inserts of every object
+        double buildMs = 0.0;     // SAH rebuild
+        double refitMs = 0.0;     // Every object moved a little
+        double frustumMs = 0.0;
+        double linearMs = 0.0;    // The same frustum with FrustumCuller over every box
+        double rayMs = 0.0;       // Per 1000 rays
+        size_t visible = 0;
+    };
+
+    // margin enlarges the stored boxes on every side, so update() skips small moves
+    explicit Bvh(float margin = 0.0f);
+
+    Proxy insert(const Aabb& box, uint32_t object);
+    void remove(Proxy proxy);
+
+    // Reinserts the object when box leaves its stored box. Returns whether it did.
+    bool update(Proxy proxy, const Aabb& box);
+
+    // Sets the object's box and grows the ancestors that no longer contain it. The tree keeps its
+    // shape and its inner boxes only ever grow, until rebuild().
+    void refit(Proxy proxy, const Aabb& box);
+
+    // Rebuilds the inner nodes top down with the binned surface area heuristic, proxies stay valid
+    void rebuild();
+
+    void clear();
+
+    // Appends the objects whose box intersects the frustum / box. Returns the number of nodes visited.
+    // Subtrees entirely inside the frustum are appended without testing their nodes.
+    size_t query(const Frustum& frustum, std::vector<uint32_t>& objects) const;
+    size_t query(const Aabb& box, std::vector<uint32_t>& objects) const;
+
+    // Closest object whose box the ray hits within maxDistance
+    RayHit raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const;
+
+    uint32_t object(Proxy proxy) const { return _nodes[proxy].object; }
+    const Aabb& box(Proxy proxy) const { return _nodes[proxy].box; }
+
+    size_t size() const { return _leafCount; }
+    int height() const { return _root == Null ? 0 : _nodes[_root].height; }
+
+    // Sum of the inner node areas over the root area, lower is a better tree
+    float cost() const;
+
+    // Builds, refits and queries a tree of that many random boxes and logs the timings
+    static BenchmarkResult benchmark(size_t objects);
+
+private:
+    struct Node
+    {
+        Aabb box;
+        Proxy parent = Null;     // Next free node while on the free list
+        Proxy child[2] = { Null, Null };
+        uint32_t object = 0;
+        int height = 0;          // 0 for leaves, -1 while free
+
+        bool isLeaf() const { return child[0] == Null; }
+    };
+
+    Proxy allocateNode();
+    void freeNode(Proxy node);
+
+    void insertLeaf(Proxy leaf);
+    void removeLeaf(Proxy leaf);
+
+    // Rotates node's subtree if its children's heights differ by more than one, returns the subtree root
+    Proxy balance(Proxy node);
+
+    // Recomputes boxes and heights from node up to the root, balancing on the way
+    void fixUpwards(Proxy node);
+
+    // Leaf copied out of the node array, so the build partitions contiguous memory
+    struct BuildLeaf
+    {
+        Aabb box;
+        glm::vec3 centroid;
+        Proxy leaf;
+    };
+
+    // Builds a subtree over leaves[begin, end) and returns its root
+    Proxy build(std::vector<BuildLeaf>& leaves, size_t begin, size_t end);
+
+    void appendLeaves(Proxy node, std::vector<uint32_t>& objects) const;
+
+    float _margin;
+    std::vector<Node> _nodes;
+    Proxy _root = Null;
+    Proxy _freeList = Null;
+    size_t _leafCount = 0;
+};
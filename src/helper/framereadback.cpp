@@ -0,0 +1,78 @@
+#include "../pch.h"
+#include "framereadback.h"
+#include "glstate.h"
+
+#include <cstdint>
+#include <vector>
+
+FrameReadback::FrameReadback(size_t counterBytes)
+    : _counterBytes(counterBytes)
+{
+    std::vector<uint8_t> zeros(counterBytes);
+    for (Slot& slot : _slots)
+    {
+        glGenBuffers(1, &slot.counters);
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, slot.counters);
+        glBufferData(GL_COPY_WRITE_BUFFER, counterBytes, zeros.data(), GL_DYNAMIC_READ);
+        glGenQueries(1, &slot.timer);
+    }
+}
+
+FrameReadback::~FrameReadback()
+{
+    for (Slot& slot : _slots)
+    {
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        glDeleteQueries(1, &slot.timer);
+        GLState::deleteBuffers(1, &slot.counters);
+    }
+}
+
+bool FrameReadback::begin(void* counters, double* timeMs)
+{
+    _current = (_current + 1) % Frames;
+    Slot& slot = _slots[_current];
+    bool timed = slot.timed;
+    slot.timed = false;
+    if (!slot.fence)
+        return false;
+
+    // Still in flight, this frame's numbers are lost rather than waited for
+    GLenum result = glClientWaitSync(slot.fence, 0, 0);
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+        return false;
+
+    GLState::bindBuffer(GL_COPY_READ_BUFFER, slot.counters);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, _counterBytes, counters);
+
+    GLint available = GL_FALSE;
+    if (timed && timeMs)
+        glGetQueryObjectiv(slot.timer, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available)
+    {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(slot.timer, GL_QUERY_RESULT, &ns);
+        *timeMs = ns / 1e6;
+    }
+    return true;
+}
+
+void FrameReadback::end()
+{
+    // The counters and timer are read back once this fence has passed
+    _slots[_current].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void FrameReadback::beginTimer()
+{
+    glBeginQuery(GL_TIME_ELAPSED, _slots[_current].timer);
+}
+
+void FrameReadback::endTimer()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    _slots[_current].timed = true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <array>
+#include <cstddef>
+
+// Counters the GPU writes each frame, read back on the CPU a frame or two later without ever waiting.
+//
+// Each of the Frames slots has a counter buffer, a GL_TIME_ELAPSED query and a fence. begin() moves to the
+// next slot and picks up what the frame that last used it wrote, if its fence has passed; end() fences the
+// current frame. In between, the GPU writes the frame's counters to counterBuffer().
+class FrameReadback
+{
+public:
+    static const int Frames = 2;
+
+    // Every slot's buffer holds counterBytes, zeroed
+    explicit FrameReadback(size_t counterBytes);
+    ~FrameReadback();
+
+    FrameReadback(const FrameReadback&) = delete;
+    FrameReadback& operator=(const FrameReadback&) = delete;
+
+    // Moves to the next slot. True, with the counters copied out, when the slot's last frame has finished.
+    // timeMs is only written when that frame was timed and the result is available.
+    bool begin(void* counters, double* timeMs = nullptr);
+    void end();
+
+    GLuint counterBuffer() const { return _slots[_current].counters; }
+
+    // Times the GPU work between the two calls, one span per frame
+    void beginTimer();
+    void endTimer();
+
+private:
+    struct Slot
+    {
+        GLuint counters = 0;
+        GLuint timer = 0;
+        GLsync fence = nullptr;
+        bool timed = false;
+    };
+
+    size_t _counterBytes;
+    std::array<Slot, Frames> _slots;
+    int _current = 0;
+};
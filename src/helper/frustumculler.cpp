@@ -0,0 +1,357 @@
+#include "../pch.h"
+#include "frustumculler.h"
+#include "benchmark.h"
+
+#include <bit>
+#include <chrono>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CULL_X64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles AVX intrinsics anywhere, GCC and Clang only in functions built for it.
+// The AVX path only runs when the CPU and OS support it.
+#if defined(_MSC_VER)
+#define CULL_TARGET_AVX
+#else
+#define CULL_TARGET_AVX __attribute__((target("avx")))
+#endif
+
+namespace
+{
+    bool cpuHasAvx()
+    {
+#if defined(CULL_X64) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#elif defined(CULL_X64)
+        return __builtin_cpu_supports("avx");
+#else
+        return false;
+#endif
+    }
+
+    // Appends base + the index of every set bit
+    inline size_t appendMask(unsigned mask, size_t base, uint32_t* out)
+    {
+        size_t count = 0;
+        while (mask)
+        {
+            out[count++] = uint32_t(base + std::countr_zero(mask));
+            mask &= mask - 1;
+        }
+        return count;
+    }
+
+    // Signed distance of the box's farthest point in front of the plane.
+    // Summed one term at a time in the order of cullSse and cullAvx, so boxes touching a plane get the
+    // same answer on every path. A negative extentSign gives the nearest point instead.
+    inline float planeDistance(const glm::vec4& plane, const glm::vec3& center, const glm::vec3& extent, float extentSign = 1.0f)
+    {
+        float d = plane.x * center.x + plane.w;
+        d += plane.y * center.y;
+        d += plane.z * center.z;
+        d += extentSign * std::abs(plane.x) * extent.x;
+        d += extentSign * std::abs(plane.y) * extent.y;
+        d += extentSign * std::abs(plane.z) * extent.z;
+        return d;
+    }
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4& viewProjection)
+{
+    // Rows of the matrix, glm stores columns
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0];
+    frustum.planes[1] = row[3] - row[0];
+    frustum.planes[2] = row[3] + row[1];
+    frustum.planes[3] = row[3] - row[1];
+    frustum.planes[4] = row[3] + row[2];
+    frustum.planes[5] = row[3] - row[2];
+
+    for (glm::vec4& plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+
+    return frustum;
+}
+
+bool Frustum::intersects(const Aabb& box) const
+{
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+    for (const glm::vec4& plane : planes)
+    {
+        if (planeDistance(plane, center, extent) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+bool Frustum::contains(const Aabb& box) const
+{
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+    for (const glm::vec4& plane : planes)
+    {
+        if (planeDistance(plane, center, extent, -1.0f) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+////////////////////////////////
+
+int FrustumCuller::batchWidth()
+{
+#if defined(CULL_X64)
+    static const bool avx = cpuHasAvx();
+    return avx ? 8 : 4;
+#else
+    return 1;
+#endif
+}
+
+void FrustumCuller::clear()
+{
+    _centerX.clear(); _centerY.clear(); _centerZ.clear();
+    _extentX.clear(); _extentY.clear(); _extentZ.clear();
+}
+
+void FrustumCuller::reserve(size_t count)
+{
+    _centerX.reserve(count); _centerY.reserve(count); _centerZ.reserve(count);
+    _extentX.reserve(count); _extentY.reserve(count); _extentZ.reserve(count);
+}
+
+uint32_t FrustumCuller::add(const Aabb& worldBox)
+{
+    glm::vec3 center = (worldBox.min + worldBox.max) * 0.5f;
+    glm::vec3 extent = (worldBox.max - worldBox.min) * 0.5f;
+
+    _centerX.push_back(center.x); _centerY.push_back(center.y); _centerZ.push_back(center.z);
+    _extentX.push_back(extent.x); _extentY.push_back(extent.y); _extentZ.push_back(extent.z);
+    return uint32_t(_centerX.size() - 1);
+}
+
+Aabb FrustumCuller::worldBox(const Aabb& localBox, const glm::mat4& model)
+{
+    glm::vec3 center = glm::vec3(model * glm::vec4((localBox.min + localBox.max) * 0.5f, 1.0f));
+    glm::vec3 extent = (localBox.max - localBox.min) * 0.5f;
+
+    // The world extent along each axis sums the absolute contributions of the local axes
+    glm::mat3 absolute(glm::abs(glm::vec3(model[0])), glm::abs(glm::vec3(model[1])), glm::abs(glm::vec3(model[2])));
+    extent = absolute * extent;
+
+    Aabb box;
+    box.min = center - extent;
+    box.max = center + extent;
+    return box;
+}
+
+void FrustumCuller::cull(const Frustum& frustum)
+{
+    cullWith(frustum, batchWidth());
+}
+
+void FrustumCuller::cullWith(const Frustum& frustum, int width)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    size_t count = size();
+    _visible.resize(count);
+
+    // Whole batches first, the remainder one by one
+    size_t batched = 0, visible = 0;
+#if defined(CULL_X64)
+    if (width == 8)
+    {
+        batched = count / 8 * 8;
+        visible = cullAvx(frustum, batched, _visible.data());
+    }
+    else if (width == 4)
+    {
+        batched = count / 4 * 4;
+        visible = cullSse(frustum, batched, _visible.data());
+    }
+#endif
+    visible += cullScalar(frustum, batched, count, _visible.data() + visible);
+    _visible.resize(visible);
+
+    _stats.tested = count;
+    _stats.visible = visible;
+    _stats.ms = Benchmark::elapsedMs(startTime);
+}
+
+size_t FrustumCuller::cullScalar(const Frustum& frustum, size_t begin, size_t end, uint32_t* out) const
+{
+    size_t count = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::vec3 center(_centerX[i], _centerY[i], _centerZ[i]);
+        glm::vec3 extent(_extentX[i], _extentY[i], _extentZ[i]);
+
+        bool inside = true;
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            if (planeDistance(plane, center, extent) < 0.0f)
+            {
+                inside = false;
+                break;
+            }
+        }
+        if (inside)
+            out[count++] = uint32_t(i);
+    }
+    return count;
+}
+
+#if defined(CULL_X64)
+
+size_t FrustumCuller::cullSse(const Frustum& frustum, size_t end, uint32_t* out) const
+{
+    // Plane components broadcast once: normal, distance, absolute normal
+    __m128 n[6][7];
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        n[p][0] = _mm_set1_ps(plane.x);
+        n[p][1] = _mm_set1_ps(plane.y);
+        n[p][2] = _mm_set1_ps(plane.z);
+        n[p][3] = _mm_set1_ps(plane.w);
+        n[p][4] = _mm_set1_ps(std::abs(plane.x));
+        n[p][5] = _mm_set1_ps(std::abs(plane.y));
+        n[p][6] = _mm_set1_ps(std::abs(plane.z));
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    size_t count = 0;
+
+    for (size_t i = 0; i < end; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&_centerX[i]);
+        __m128 cy = _mm_loadu_ps(&_centerY[i]);
+        __m128 cz = _mm_loadu_ps(&_centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&_extentX[i]);
+        __m128 ey = _mm_loadu_ps(&_extentY[i]);
+        __m128 ez = _mm_loadu_ps(&_extentZ[i]);
+
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 d = _mm_add_ps(_mm_mul_ps(n[p][0], cx), n[p][3]);
+            d = _mm_add_ps(d, _mm_mul_ps(n[p][1], cy));
+            d = _mm_add_ps(d, _mm_mul_ps(n[p][2], cz));
+            d = _mm_add_ps(d, _mm_mul_ps(n[p][4], ex));
+            d = _mm_add_ps(d, _mm_mul_ps(n[p][5], ey));
+            d = _mm_add_ps(d, _mm_mul_ps(n[p][6], ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, zero));
+        }
+
+        count += appendMask(unsigned(_mm_movemask_ps(inside)), i, out + count);
+    }
+    return count;
+}
+
+CULL_TARGET_AVX
+size_t FrustumCuller::cullAvx(const Frustum& frustum, size_t end, uint32_t* out) const
+{
+    __m256 n[6][7];
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        n[p][0] = _mm256_set1_ps(plane.x);
+        n[p][1] = _mm256_set1_ps(plane.y);
+        n[p][2] = _mm256_set1_ps(plane.z);
+        n[p][3] = _mm256_set1_ps(plane.w);
+        n[p][4] = _mm256_set1_ps(std::abs(plane.x));
+        n[p][5] = _mm256_set1_ps(std::abs(plane.y));
+        n[p][6] = _mm256_set1_ps(std::abs(plane.z));
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    size_t count = 0;
+
+    for (size_t i = 0; i < end; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(&_centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&_centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&_centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&_extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&_extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&_extentZ[i]);
+
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (int p = 0; p < 6; p++)
+        {
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(n[p][0], cx), n[p][3]);
+            d = _mm256_add_ps(d, _mm256_mul_ps(n[p][1], cy));
+            d = _mm256_add_ps(d, _mm256_mul_ps(n[p][2], cz));
+            d = _mm256_add_ps(d, _mm256_mul_ps(n[p][4], ex));
+            d = _mm256_add_ps(d, _mm256_mul_ps(n[p][5], ey));
+            d = _mm256_add_ps(d, _mm256_mul_ps(n[p][6], ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, zero, _CMP_GE_OQ));
+        }
+
+        count += appendMask(unsigned(_mm256_movemask_ps(inside)), i, out + count);
+    }
+    return count;
+}
+
+#else
+
+size_t FrustumCuller::cullSse(const Frustum& frustum, size_t end, uint32_t* out) const
+{
+    return cullScalar(frustum, 0, end, out);
+}
+
+size_t FrustumCuller::cullAvx(const Frustum& frustum, size_t end, uint32_t* out) const
+{
+    return cullScalar(frustum, 0, end, out);
+}
+
+#endif
+
+FrustumCuller::BenchmarkResult FrustumCuller::benchmark(size_t boxes, int runs)
+{
+    // Small boxes scattered around a camera at the origin, a small share of them in view
+    std::mt19937 rng = Benchmark::random();
+
+    FrustumCuller culler;
+    culler.reserve(boxes);
+    for (const Aabb& box : Benchmark::randomBoxes(rng, boxes, 100.0f, 0.1f, 1.0f))
+        culler.add(box);
+
+    Frustum frustum = Frustum::fromMatrix(Benchmark::viewProjection(100.0f));
+
+    BenchmarkResult result;
+    result.boxes = boxes;
+    result.simdMs = result.scalarMs = std::numeric_limits<double>::max();
+
+    for (int run = 0; run < runs; run++)
+    {
+        culler.cullWith(frustum, batchWidth());
+        result.simdMs = std::min(result.simdMs, culler.stats().ms);
+        result.visible = culler.stats().visible;
+
+        culler.cullWith(frustum, 1);
+        result.scalarMs = std::min(result.scalarMs, culler.stats().ms);
+        assert(culler.stats().visible == result.visible);
+    }
+
+    LOG_INFO("Frustum culling {} boxes, {} visible: {:.3f} ms in batches of {}, {:.3f} ms scalar ({:.1f}x)",
+        result.boxes, result.visible, result.simdMs, batchWidth(), result.scalarMs, result.scalarMs / std::max(result.simdMs, 1e-6));
+    return result;
+}
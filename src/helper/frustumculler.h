@@ -0,0 +1,86 @@
+#pragma once
+
+#include "aabb.h"
+
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// The six planes of a view frustum, normals pointing inwards and normalized
+struct Frustum
+{
+    std::array<glm::vec4, 6> planes;   // Left, right, bottom, top, near, far
+
+    // Extracts the planes of a GL clip space (-w <= x, y, z <= w) from projection * view
+    static Frustum fromMatrix(const glm::mat4& viewProjection);
+
+    // False only when the box is entirely behind one of the planes
+    bool intersects(const Aabb& box) const;
+
+    // True when the box is entirely in front of every plane
+    bool contains(const Aabb& box) const;
+};
+
+// Culls world space boxes against a frustum in batches.
+//
+// Boxes are stored as centers and half extents, one array per component, so one plane is tested
+// against 8 boxes at a time with AVX (4 with SSE, which x64 always has). A box is visible unless its
+// projected radius puts it entirely behind one plane. cull() leaves the indices of the visible boxes,
+// in the order they were added, in visible().
+class FrustumCuller
+{
+public:
+    struct Stats
+    {
+        size_t tested = 0;
+        size_t visible = 0;
+        double ms = 0.0;
+
+        size_t culled() const { return tested - visible; }
+    };
+
+    struct BenchmarkResult
+    {
+        size_t boxes = 0;
+        size_t visible = 0;
+        double simdMs = 0.0;     // Best of the runs, with the widest path the CPU supports
+        double scalarMs = 0.0;
+    };
+
+    // Widest batch the CPU supports: 8 (AVX), 4 (SSE) or 1
+    static int batchWidth();
+
+    void clear();
+    void reserve(size_t count);
+
+    // Returns the index of the box, as reported by visible()
+    uint32_t add(const Aabb& worldBox);
+
+    // Transforms an object space box into the world space box around it
+    uint32_t add(const Aabb& localBox, const glm::mat4& model) { return add(worldBox(localBox, model)); }
+    static Aabb worldBox(const Aabb& localBox, const glm::mat4& model);
+
+    void cull(const Frustum& frustum);
+    void cull(const glm::mat4& viewProjection) { cull(Frustum::fromMatrix(viewProjection)); }
+
+    size_t size() const { return _centerX.size(); }
+    const std::vector<uint32_t>& visible() const { return _visible; }
+    const Stats& stats() const { return _stats; }
+
+    // Culls that many random boxes scattered around a camera, batched against scalar, and logs the result
+    static BenchmarkResult benchmark(size_t boxes = 1000000, int runs = 5);
+
+private:
+    // Each returns the number of visible indices written
+    size_t cullScalar(const Frustum& frustum, size_t begin, size_t end, uint32_t* out) const;
+    size_t cullSse(const Frustum& frustum, size_t end, uint32_t* out) const;
+    size_t cullAvx(const Frustum& frustum, size_t end, uint32_t* out) const;
+
+    void cullWith(const Frustum& frustum, int width);
+
+    std::vector<float> _centerX, _centerY, _centerZ;
+    std::vector<float> _extentX, _extentY, _extentZ;
+    std::vector<uint32_t> _visible;
+    Stats _stats;
+};
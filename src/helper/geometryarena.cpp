@@ -0,0 +1,331 @@
+#include "../pch.h"
+#include "geometryarena.h"
+#include "glstate.h"
+
+namespace
+{
+    // Smallest pools, in vertices and in 4 byte index units (256 KB / 1 MB for a 4 byte stride)
+    const size_t MinPoolVertices = 64 * 1024;
+    const size_t MinPoolIndexUnits = 256 * 1024;
+
+    size_t grownCapacity(size_t capacity, size_t needed, size_t minimum)
+    {
+        size_t result = std::max(capacity, minimum);
+        while (result < needed)
+            result *= 2;
+        return result;
+    }
+
+    float fragmentation(size_t capacity, size_t used, size_t largestFree)
+    {
+        size_t freeSpace = capacity - used;
+        return freeSpace ? 1.0f - float(largestFree) / float(freeSpace) : 0.0f;
+    }
+}
+
+RangeAllocator::RangeAllocator(size_t capacity)
+    : _capacity(0), _used(0)
+{
+    grow(capacity);
+}
+
+size_t RangeAllocator::allocate(size_t size)
+{
+    if (size == 0)
+        return Invalid;
+
+    auto fit = _bySize.lower_bound(size);
+    if (fit == _bySize.end())
+        return Invalid;
+
+    size_t offset = fit->second;
+    size_t blockSize = fit->first;
+    eraseFree(_byOffset.find(offset));
+
+    if (blockSize > size)
+        insertFree(offset + size, blockSize - size);
+
+    _used += size;
+    return offset;
+}
+
+void RangeAllocator::free(size_t offset, size_t size)
+{
+    if (size == 0)
+        return;
+
+    _used -= size;
+
+    // Merge with the following and the preceding free block
+    auto next = _byOffset.lower_bound(offset);
+    if (next != _byOffset.end() && next->first == offset + size)
+    {
+        size += next->second;
+        next = std::next(next);
+        eraseFree(std::prev(next));
+    }
+
+    if (next != _byOffset.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset)
+        {
+            offset = prev->first;
+            size += prev->second;
+            eraseFree(prev);
+        }
+    }
+
+    insertFree(offset, size);
+}
+
+void RangeAllocator::grow(size_t newCapacity)
+{
+    if (newCapacity <= _capacity)
+        return;
+
+    size_t oldCapacity = _capacity;
+    _capacity = newCapacity;
+
+    // Freeing the new tail merges it with a free block at the old end
+    _used += newCapacity - oldCapacity;
+    free(oldCapacity, newCapacity - oldCapacity);
+}
+
+void RangeAllocator::insertFree(size_t offset, size_t size)
+{
+    _byOffset.emplace(offset, size);
+    _bySize.emplace(size, offset);
+}
+
+void RangeAllocator::eraseFree(std::map<size_t, size_t>::iterator block)
+{
+    auto range = _bySize.equal_range(block->second);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == block->first)
+        {
+            _bySize.erase(it);
+            break;
+        }
+    }
+    _byOffset.erase(block);
+}
+
+std::string GeometryArena::Layout::name() const
+{
+    std::string result = format.name();
+    if (hasTexCoords)
+        result += " +uv";
+    if (hasTangents)
+        result += " +tangent";
+    return result;
+}
+
+float GeometryArena::PoolStats::vertexFragmentation() const
+{
+    return fragmentation(vertexCapacity, vertexUsed, vertexLargestFree);
+}
+
+float GeometryArena::PoolStats::indexFragmentation() const
+{
+    return fragmentation(indexCapacity, indexUsed, indexLargestFree);
+}
+
+GeometryArena& GeometryArena::instance()
+{
+    static GeometryArena arena;
+    return arena;
+}
+
+void GeometryArena::shutdown()
+{
+    for (auto& pool : _pools)
+    {
+        GLState::deleteVertexArrays(1, &pool->vao);
+        GLState::deleteBuffers(1, &pool->vertexBuffer);
+        GLState::deleteBuffers(1, &pool->indexBuffer);
+        pool->vao = pool->vertexBuffer = pool->indexBuffer = 0;
+    }
+}
+
+GeometryArena::Allocation GeometryArena::allocate(const Layout& layout, size_t vertexCount, size_t indexBytes)
+{
+    Allocation allocation;
+    if (vertexCount == 0 || indexBytes == 0)
+        return allocation;
+
+    unsigned poolIndex = 0;
+    while (poolIndex < _pools.size() && !(_pools[poolIndex]->layout == layout))
+        poolIndex++;
+
+    if (poolIndex == _pools.size())
+    {
+        auto pool = std::make_unique<Pool>();
+        pool->layout = layout;
+        pool->stride = layout.format.stride(layout.hasTexCoords, layout.hasTangents);
+        _pools.push_back(std::move(pool));
+    }
+
+    Pool& pool = *_pools[poolIndex];
+    size_t indexUnits = (indexBytes + 3) / 4;
+
+    size_t firstVertex = pool.vertices.allocate(vertexCount);
+    size_t firstUnit = pool.indices.allocate(indexUnits);
+
+    // Grow whichever side is full, enough for this mesh even if all free space is fragmented
+    if (firstVertex == RangeAllocator::Invalid || firstUnit == RangeAllocator::Invalid)
+    {
+        size_t vertexCapacity = pool.vertices.capacity();
+        size_t indexCapacity = pool.indices.capacity();
+        if (firstVertex == RangeAllocator::Invalid)
+            vertexCapacity = grownCapacity(vertexCapacity, vertexCapacity + vertexCount, MinPoolVertices);
+        if (firstUnit == RangeAllocator::Invalid)
+            indexCapacity = grownCapacity(indexCapacity, indexCapacity + indexUnits, MinPoolIndexUnits);
+
+        growPool(pool, vertexCapacity, indexCapacity);
+
+        if (firstVertex == RangeAllocator::Invalid)
+            firstVertex = pool.vertices.allocate(vertexCount);
+        if (firstUnit == RangeAllocator::Invalid)
+            firstUnit = pool.indices.allocate(indexUnits);
+    }
+
+    pool.allocations++;
+
+    allocation.pool = poolIndex;
+    allocation.firstVertex = GLuint(firstVertex);
+    allocation.vertexCount = GLuint(vertexCount);
+    allocation.indexOffset = firstUnit * 4;
+    allocation.indexBytes = indexBytes;
+    return allocation;
+}
+
+void GeometryArena::upload(const Allocation& allocation, std::span<const uint8_t> vertices, std::span<const uint8_t> indices)
+{
+    if (!allocation.valid())
+        return;
+
+    const Pool& pool = *_pools[allocation.pool];
+
+    // Through the copy target, so the element buffer binding of whatever VAO is bound stays untouched
+    GLState::bindBuffer(GL_COPY_WRITE_BUFFER, pool.vertexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(allocation.firstVertex * pool.stride),
+        GLsizeiptr(std::min(vertices.size(), allocation.vertexCount * pool.stride)), vertices.data());
+
+    GLState::bindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(allocation.indexOffset),
+        GLsizeiptr(std::min(indices.size(), allocation.indexBytes)), indices.data());
+}
+
+void GeometryArena::free(Allocation& allocation)
+{
+    if (!allocation.valid())
+        return;
+
+    Pool& pool = *_pools[allocation.pool];
+    pool.vertices.free(allocation.firstVertex, allocation.vertexCount);
+    pool.indices.free(allocation.indexOffset / 4, (allocation.indexBytes + 3) / 4);
+    pool.allocations--;
+
+    allocation = Allocation();
+}
+
+void GeometryArena::bind(const Allocation& allocation)
+{
+    GLState::bindVertexArray(vertexArray(allocation));
+}
+
+GLuint GeometryArena::vertexArray(const Allocation& allocation) const
+{
+    return allocation.valid() ? _pools[allocation.pool]->vao : 0;
+}
+
+GLuint GeometryArena::vertexBuffer(const Allocation& allocation) const
+{
+    return allocation.valid() ? _pools[allocation.pool]->vertexBuffer : 0;
+}
+
+GLuint GeometryArena::indexBuffer(const Allocation& allocation) const
+{
+    return allocation.valid() ? _pools[allocation.pool]->indexBuffer : 0;
+}
+
+void GeometryArena::growPool(Pool& pool, size_t vertexCapacity, size_t indexUnits)
+{
+    auto growBuffer = [](GLuint& buffer, size_t oldBytes, size_t newBytes) {
+        GLuint grown = 0;
+        glGenBuffers(1, &grown);
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(newBytes), nullptr, GL_STATIC_DRAW);
+
+        if (buffer != 0)
+        {
+            GLState::bindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(oldBytes));
+            GLState::deleteBuffers(1, &buffer);
+        }
+
+        buffer = grown;
+    };
+
+    if (vertexCapacity > pool.vertices.capacity())
+    {
+        growBuffer(pool.vertexBuffer, pool.vertices.capacity() * pool.stride, vertexCapacity * pool.stride);
+        pool.vertices.grow(vertexCapacity);
+    }
+
+    if (indexUnits > pool.indices.capacity())
+    {
+        growBuffer(pool.indexBuffer, pool.indices.capacity() * 4, indexUnits * 4);
+        pool.indices.grow(indexUnits);
+    }
+
+    // Point the VAO at the new buffers
+    if (pool.vao == 0)
+        glGenVertexArrays(1, &pool.vao);
+
+    GLState::bindVertexArray(pool.vao);
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+    pool.layout.format.setAttribPointers(pool.layout.hasTexCoords, pool.layout.hasTangents);
+    GLState::bindVertexArray(0);
+
+    LOG_INFO("Geometry arena pool '{}' grown to {} vertices ({} KB) and {} KB of indices",
+        pool.layout.name(), pool.vertices.capacity(), pool.vertices.capacity() * pool.stride / 1024, pool.indices.capacity() * 4 / 1024);
+}
+
+std::vector<GeometryArena::PoolStats> GeometryArena::stats() const
+{
+    std::vector<PoolStats> result;
+    for (const auto& pool : _pools)
+    {
+        PoolStats s;
+        s.layout = pool->layout.name();
+        s.vertexStride = pool->stride;
+        s.allocations = pool->allocations;
+        s.vertexCapacity = pool->vertices.capacity();
+        s.vertexUsed = pool->vertices.used();
+        s.vertexFreeBlocks = pool->vertices.freeBlocks();
+        s.vertexLargestFree = pool->vertices.largestFree();
+        s.indexCapacity = pool->indices.capacity() * 4;
+        s.indexUsed = pool->indices.used() * 4;
+        s.indexFreeBlocks = pool->indices.freeBlocks();
+        s.indexLargestFree = pool->indices.largestFree() * 4;
+        result.push_back(s);
+    }
+    return result;
+}
+
+void GeometryArena::logStats() const
+{
+    LOG_INFO("Geometry arena: {} pool(s)", _pools.size());
+    for (const PoolStats& s : stats())
+    {
+        LOG_INFO("  {} ({} B/vertex): {} meshes", s.layout, s.vertexStride, s.allocations);
+        LOG_INFO("    vertices {} / {} ({:.1f}% used), {} free blocks, {:.1f}% fragmented",
+            s.vertexUsed, s.vertexCapacity, s.vertexOccupancy() * 100.0f, s.vertexFreeBlocks, s.vertexFragmentation() * 100.0f);
+        LOG_INFO("    indices {} KB / {} KB ({:.1f}% used), {} free blocks, {:.1f}% fragmented",
+            s.indexUsed / 1024, s.indexCapacity / 1024, s.indexOccupancy() * 100.0f, s.indexFreeBlocks, s.indexFragmentation() * 100.0f);
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "vertexformat.h"
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// Command layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;      // In indices, not bytes
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Best-fit free list over [0, capacity) in abstract units. Freed blocks merge with their neighbours.
+class RangeAllocator
+{
+public:
+    static const size_t Invalid = ~size_t(0);
+
+    explicit RangeAllocator(size_t capacity = 0);
+
+    // Returns the offset of a free block of the given size, or Invalid
+    size_t allocate(size_t size);
+    void free(size_t offset, size_t size);
+
+    // Adds free space at the end
+    void grow(size_t newCapacity);
+
+    size_t capacity() const { return _capacity; }
+    size_t used() const { return _used; }
+    size_t freeBlocks() const { return _byOffset.size(); }
+    size_t largestFree() const { return _bySize.empty() ? 0 : _bySize.rbegin()->first; }
+
+private:
+    void insertFree(size_t offset, size_t size);
+    void eraseFree(std::map<size_t, size_t>::iterator block);
+
+    std::map<size_t, size_t> _byOffset;      // Free blocks, offset -> size
+    std::multimap<size_t, size_t> _bySize;   // The same blocks, size -> offset
+    size_t _capacity;
+    size_t _used;
+};
+
+// Shared GPU storage for TriangleMesh.
+//
+// Meshes with the same vertex layout (format plus which optional attributes they have) live in one pool:
+// one interleaved vertex buffer, one index buffer and one VAO. A mesh is a vertex range and an index range
+// in its pool, drawn with glDrawElementsBaseVertex, so drawing many meshes of a layout needs a single VAO bind.
+// Pools start small and double when full, moving their contents with glCopyBufferSubData.
+//
+// The arena outlives the GL context, so its buffers are deleted by shutdown() rather than the destructor.
+class GeometryArena
+{
+public:
+    struct Layout
+    {
+        VertexFormat format;   // Always interleaved
+        bool hasTexCoords = false;
+        bool hasTangents = false;
+
+        bool operator==(const Layout&) const = default;
+        std::string name() const;
+    };
+
+    struct Allocation
+    {
+        unsigned pool = ~0u;
+        GLuint firstVertex = 0;   // Base vertex of the mesh
+        GLuint vertexCount = 0;
+        size_t indexOffset = 0;   // In bytes, 4 byte aligned
+        size_t indexBytes = 0;
+
+        bool valid() const { return pool != ~0u; }
+    };
+
+    struct PoolStats
+    {
+        std::string layout;
+        size_t vertexStride = 0;
+        size_t allocations = 0;
+        size_t vertexCapacity = 0, vertexUsed = 0, vertexFreeBlocks = 0, vertexLargestFree = 0;  // In vertices
+        size_t indexCapacity = 0, indexUsed = 0, indexFreeBlocks = 0, indexLargestFree = 0;      // In bytes
+
+        // Used share of the capacity
+        float vertexOccupancy() const { return vertexCapacity ? float(vertexUsed) / float(vertexCapacity) : 0.0f; }
+        float indexOccupancy() const { return indexCapacity ? float(indexUsed) / float(indexCapacity) : 0.0f; }
+
+        // Share of the free space outside the largest free block (0 = one contiguous hole)
+        float vertexFragmentation() const;
+        float indexFragmentation() const;
+    };
+
+    static GeometryArena& instance();
+
+    // Deletes the GL objects of every pool. Call it while the context is still current, before it is
+    // destroyed. Allocations can still be freed afterwards, they no longer draw.
+    void shutdown();
+
+    // Reserves space for a mesh, growing the layout's pool as needed. Data is written with upload().
+    Allocation allocate(const Layout& layout, size_t vertexCount, size_t indexBytes);
+    void upload(const Allocation& allocation, std::span<const uint8_t> vertices, std::span<const uint8_t> indices);
+    void free(Allocation& allocation);
+
+    // Binds the pool's VAO, which holds its index buffer and attribute layout.
+    // Goes through GLState, so runs of draws from one pool bind once.
+    void bind(const Allocation& allocation);
+
+    GLuint vertexArray(const Allocation& allocation) const;
+    GLuint vertexBuffer(const Allocation& allocation) const;
+    GLuint indexBuffer(const Allocation& allocation) const;
+
+    std::vector<PoolStats> stats() const;
+    void logStats() const;
+
+private:
+    GeometryArena() = default;
+
+    struct Pool
+    {
+        Layout layout;
+        size_t stride = 0;
+        GLuint vao = 0;
+        GLuint vertexBuffer = 0;
+        GLuint indexBuffer = 0;
+        RangeAllocator vertices;   // In vertices
+        RangeAllocator indices;    // In 4 byte units
+        size_t allocations = 0;
+    };
+
+    void growPool(Pool& pool, size_t vertexCapacity, size_t indexUnits);
+
+    std::vector<std::unique_ptr<Pool>> _pools;
+};
@@ -0,0 +1,309 @@
+#include "../pch.h"
+#include "glstate.h"
+
+#include <unordered_map>
+
+#ifdef _DEBUG
+bool GLState::validate = true;
+#else
+bool GLState::validate = false;
+#endif
+
+namespace
+{
+    const GLuint Unknown = ~0u;
+    const GLuint MaxTextureUnits = 16;
+
+    // A bind target and the glGet* enum of its binding
+    struct Target
+    {
+        GLenum target;
+        GLenum binding;
+    };
+
+    const std::array<Target, 3> TextureTargets =
+    { {
+        { GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D },
+        { GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BINDING_2D_ARRAY },
+        { GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BINDING_CUBE_MAP },
+    } };
+
+    const std::array<Target, 11> BufferTargets =
+    { {
+        { GL_ARRAY_BUFFER, GL_ARRAY_BUFFER_BINDING },
+        { GL_UNIFORM_BUFFER, GL_UNIFORM_BUFFER_BINDING },
+        { GL_SHADER_STORAGE_BUFFER, GL_SHADER_STORAGE_BUFFER_BINDING },
+        { GL_DRAW_INDIRECT_BUFFER, GL_DRAW_INDIRECT_BUFFER_BINDING },
+        { GL_DISPATCH_INDIRECT_BUFFER, GL_DISPATCH_INDIRECT_BUFFER_BINDING },
+        { GL_COPY_READ_BUFFER, GL_COPY_READ_BUFFER_BINDING },
+        { GL_COPY_WRITE_BUFFER, GL_COPY_WRITE_BUFFER_BINDING },
+        { GL_PIXEL_PACK_BUFFER, GL_PIXEL_PACK_BUFFER_BINDING },
+        { GL_PIXEL_UNPACK_BUFFER, GL_PIXEL_UNPACK_BUFFER_BINDING },
+        { GL_ATOMIC_COUNTER_BUFFER, GL_ATOMIC_COUNTER_BUFFER_BINDING },
+        { GL_TRANSFORM_FEEDBACK_BUFFER, GL_TRANSFORM_FEEDBACK_BUFFER_BINDING },
+    } };
+
+    template<size_t N>
+    int findTarget(const std::array<Target, N>& targets, GLenum target)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            if (targets[i].target == target)
+                return int(i);
+        }
+        return -1;
+    }
+
+    struct IndexedBinding
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;  // -1 for the whole buffer
+
+        bool operator==(const IndexedBinding&) const = default;
+    };
+
+    struct Shadow
+    {
+        GLuint vao = Unknown;
+        GLuint pipeline = Unknown;
+        GLuint program = Unknown;
+        GLuint activeUnit = Unknown;
+        std::array<std::array<GLuint, TextureTargets.size()>, MaxTextureUnits> textures;
+        std::array<GLuint, BufferTargets.size()> buffers;
+        std::unordered_map<uint64_t, IndexedBinding> indexed;        // (target << 32 | index)
+        std::unordered_map<GLuint, std::array<GLuint, 2>> stages;     // Pipeline -> vertex, fragment program
+
+        Shadow()
+        {
+            for (auto& unit : textures)
+                unit.fill(Unknown);
+            buffers.fill(Unknown);
+        }
+    };
+
+    Shadow shadow;
+    GLState::Stats counters;
+
+    // Decides whether a bind can be skipped, and records value as bound if not.
+    // With validation on, a skip is only allowed when query() (the real binding) agrees.
+    template<typename T, typename Query>
+    bool skip(T& slot, const T& value, Query query, const char* what)
+    {
+        if (slot == value)
+        {
+            if (!GLState::validate || query() == value)
+            {
+                counters.skipped++;
+                return true;
+            }
+
+            counters.mismatches++;
+            LOG_ERROR("GLState: shadowed {} binding is stale", what);
+        }
+
+        slot = value;
+        counters.issued++;
+        return false;
+    }
+
+    GLuint getInteger(GLenum binding)
+    {
+        GLint value = 0;
+        glGetIntegerv(binding, &value);
+        return GLuint(value);
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if (!skip(shadow.activeUnit, unit, [&] { return getInteger(GL_ACTIVE_TEXTURE) - GL_TEXTURE0; }, "active texture"))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+void GLState::bindVertexArray(GLuint vao)
+{
+    if (!skip(shadow.vao, vao, [] { return getInteger(GL_VERTEX_ARRAY_BINDING); }, "vertex array"))
+        glBindVertexArray(vao);
+}
+
+void GLState::bindProgramPipeline(GLuint pipeline)
+{
+    if (!skip(shadow.pipeline, pipeline, [] { return getInteger(GL_PROGRAM_PIPELINE_BINDING); }, "program pipeline"))
+        glBindProgramPipeline(pipeline);
+}
+
+void GLState::useProgram(GLuint program)
+{
+    if (!skip(shadow.program, program, [] { return getInteger(GL_CURRENT_PROGRAM); }, "program"))
+        glUseProgram(program);
+}
+
+void GLState::useProgramStages(GLuint pipeline, GLbitfield stages, GLuint program)
+{
+    int stage = (stages == GL_VERTEX_SHADER_BIT) ? 0 : (stages == GL_FRAGMENT_SHADER_BIT) ? 1 : -1;
+    if (stage < 0)
+    {
+        shadow.stages.erase(pipeline);
+        counters.issued++;
+        glUseProgramStages(pipeline, stages, program);
+        return;
+    }
+
+    auto it = shadow.stages.try_emplace(pipeline, std::array<GLuint, 2>{ Unknown, Unknown }).first;
+    auto query = [&] {
+        GLint value = 0;
+        glGetProgramPipelineiv(pipeline, stage == 0 ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER, &value);
+        return GLuint(value);
+    };
+
+    if (!skip(it->second[stage], program, query, "program stage"))
+        glUseProgramStages(pipeline, stages, program);
+}
+
+void GLState::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    int t = findTarget(TextureTargets, target);
+    if (t < 0 || unit >= MaxTextureUnits)
+    {
+        activeTexture(unit);
+        counters.issued++;
+        glBindTexture(target, texture);
+        return;
+    }
+
+    GLuint& slot = shadow.textures[unit][t];
+    auto query = [&] {
+        activeTexture(unit);
+        return getInteger(TextureTargets[t].binding);
+    };
+
+    if (!skip(slot, texture, query, "texture"))
+    {
+        activeTexture(unit);
+        glBindTexture(target, texture);
+    }
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer)
+{
+    int t = findTarget(BufferTargets, target);
+    if (t < 0)
+    {
+        counters.issued++;
+        glBindBuffer(target, buffer);
+        return;
+    }
+
+    if (!skip(shadow.buffers[t], buffer, [&] { return getInteger(BufferTargets[t].binding); }, "buffer"))
+        glBindBuffer(target, buffer);
+}
+
+void GLState::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    bindBufferRange(target, index, buffer, 0, -1);
+}
+
+void GLState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    // Targets missing from the table have no binding query to validate against, so they are never skipped
+    int t = findTarget(BufferTargets, target);
+    if (t >= 0)
+    {
+        IndexedBinding binding = { buffer, offset, size };
+        auto it = shadow.indexed.try_emplace((uint64_t(target) << 32) | index, IndexedBinding{ Unknown, 0, 0 }).first;
+
+        // Only the buffer name is checked, GL reports no range for glBindBufferBase
+        auto query = [&] {
+            GLint value = 0;
+            glGetIntegeri_v(BufferTargets[t].binding, index, &value);
+            return IndexedBinding{ GLuint(value), offset, size };
+        };
+
+        if (skip(it->second, binding, query, "indexed buffer"))
+            return;
+    }
+    else
+    {
+        counters.issued++;
+    }
+
+    if (size < 0)
+        glBindBufferBase(target, index, buffer);
+    else
+        glBindBufferRange(target, index, buffer, offset, size);
+
+    // Both also bind the generic target
+    if (t >= 0)
+        shadow.buffers[t] = buffer;
+}
+
+void GLState::deleteVertexArrays(GLsizei n, const GLuint* vaos)
+{
+    for (GLsizei i = 0; i < n; i++)
+    {
+        if (shadow.vao == vaos[i])
+            shadow.vao = 0;
+    }
+    glDeleteVertexArrays(n, vaos);
+}
+
+void GLState::deleteBuffers(GLsizei n, const GLuint* buffers)
+{
+    for (GLsizei i = 0; i < n; i++)
+    {
+        for (GLuint& bound : shadow.buffers)
+        {
+            if (bound == buffers[i])
+                bound = 0;
+        }
+        std::erase_if(shadow.indexed, [&](const auto& entry) { return entry.second.buffer == buffers[i]; });
+    }
+    glDeleteBuffers(n, buffers);
+}
+
+void GLState::deleteTextures(GLsizei n, const GLuint* textures)
+{
+    for (GLsizei i = 0; i < n; i++)
+    {
+        for (auto& unit : shadow.textures)
+        {
+            for (GLuint& bound : unit)
+            {
+                if (bound == textures[i])
+                    bound = 0;
+            }
+        }
+    }
+    glDeleteTextures(n, textures);
+}
+
+void GLState::deleteProgram(GLuint program)
+{
+    if (shadow.program == program)
+        shadow.program = Unknown;
+    for (auto& [pipeline, stages] : shadow.stages)
+    {
+        for (GLuint& bound : stages)
+        {
+            if (bound == program)
+                bound = Unknown;
+        }
+    }
+    glDeleteProgram(program);
+}
+
+void GLState::invalidate()
+{
+    shadow = Shadow();
+}
+
+const GLState::Stats& GLState::stats()
+{
+    return counters;
+}
+
+void GLState::resetStats()
+{
+    counters = Stats();
+}
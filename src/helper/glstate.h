@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+
+// Shadows the GL bindings the renderer touches and skips binds that would change nothing.
+//
+// All binds of these objects must go through here, or the shadow goes stale; code that binds behind
+// its back (ImGui, for one) is followed by invalidate(). Deleting through the functions below
+// forgets the deleted names, since GL hands them out again.
+//
+// The element array buffer is VAO state and is never cached: bindBuffer passes it straight through.
+// Texture binds are cached for GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY and GL_TEXTURE_CUBE_MAP on units 0-15.
+namespace GLState
+{
+    // Compare the shadow with glGet* before every skipped call and log mismatches. On in debug builds.
+    extern bool validate;
+
+    struct Stats
+    {
+        size_t issued = 0;
+        size_t skipped = 0;
+        size_t mismatches = 0;  // Found by validate
+    };
+
+    void bindVertexArray(GLuint vao);
+    void bindProgramPipeline(GLuint pipeline);
+    void useProgram(GLuint program);
+
+    // Cached for GL_VERTEX_SHADER_BIT and GL_FRAGMENT_SHADER_BIT alone, other stage sets pass through
+    void useProgramStages(GLuint pipeline, GLbitfield stages, GLuint program);
+
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    void deleteVertexArrays(GLsizei n, const GLuint* vaos);
+    void deleteBuffers(GLsizei n, const GLuint* buffers);
+    void deleteTextures(GLsizei n, const GLuint* textures);
+
+    // A deleted program stays current and in its pipeline stages until replaced, so those entries become unknown
+    void deleteProgram(GLuint program);
+
+    // Forgets everything, the next bind of each object is issued
+    void invalidate();
+
+    // Counters since the last resetStats()
+    const Stats& stats();
+    void resetStats();
+}
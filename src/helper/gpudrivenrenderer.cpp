@@ -0,0 +1,283 @@
+#include "../pch.h"
+#include "gpudrivenrenderer.h"
+#include "indirectrenderer.h"
+#include "frustumculler.h"
+#include "hizculler.h"
+#include "geometryarena.h"
+#include "glstate.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Shader storage bindings of shader/GpuCull.cs, the draw data one is the renderer's
+    const GLuint CountBinding = 0;
+    const GLuint ObjectBinding = 4;
+    const GLuint MeshBinding = 5;
+    const GLuint TemplateBinding = 6;
+    const GLuint CommandBinding = 7;
+
+    // Draw count, frustum visible, early visible, late visible. The batch counts follow.
+    const GLuint HeaderCounters = 4;
+
+    const GLuint GroupSize = 64;   // local_size_x of shader/GpuCull.cs
+
+    // Explicit uniform locations of shader/GpuCull.cs
+    namespace cullLocation
+    {
+        const GLint View = 0;
+        const GLint Projection = 1;
+        const GLint Planes = 2;      // vec4[6], up to 7
+        const GLint PyramidViewProjection = 8;
+        const GLint Pass = 9;
+        const GLint UsePyramid = 10;
+        const GLint Levels = 11;
+        const GLint ObjectCount = 12;
+        const GLint BatchCount = 13;
+        const GLint CommandCapacity = 14;
+    }
+}
+
+GpuDrivenRenderer::GpuDrivenRenderer(GLuint drawDataBinding)
+    : _binding(drawDataBinding), _readback(HeaderCounters * sizeof(GLuint))
+{
+    glGenBuffers(1, &_meshBuffer);
+    glGenBuffers(1, &_templateBuffer);
+    glGenBuffers(1, &_objectBuffer);
+    glGenBuffers(1, &_drawDataBuffer);
+    glGenBuffers(1, &_commandBuffer);
+    glGenBuffers(1, &_countBuffer);
+}
+
+GpuDrivenRenderer::~GpuDrivenRenderer()
+{
+    GLState::deleteBuffers(1, &_meshBuffer);
+    GLState::deleteBuffers(1, &_templateBuffer);
+    GLState::deleteBuffers(1, &_objectBuffer);
+    GLState::deleteBuffers(1, &_drawDataBuffer);
+    GLState::deleteBuffers(1, &_commandBuffer);
+    GLState::deleteBuffers(1, &_countBuffer);
+}
+
+void GpuDrivenRenderer::clear()
+{
+    _meshes.clear();
+    _templates.clear();
+    _objects.clear();
+    _batches.clear();
+    _layoutDirty = true;
+}
+
+GLuint GpuDrivenRenderer::addMesh(const TriangleMesh& mesh)
+{
+    std::vector<DrawElementsIndirectCommand> commands;
+    if (!mesh.appendDrawCommands(commands, 0))
+    {
+        LOG_WARN("GpuDrivenRenderer only draws meshes in the geometry arena, skipping");
+        return ~0u;
+    }
+
+    GLuint vertexArray = GeometryArena::instance().vertexArray(mesh.getArenaRange());
+    auto batch = std::find_if(_batches.begin(), _batches.end(), [&](const Batch& b) {
+        return b.vertexArray == vertexArray && b.indexType == mesh.getIndexType();
+    });
+    if (batch == _batches.end())
+    {
+        _batches.push_back({ vertexArray, mesh.getIndexType(), &mesh });
+        batch = _batches.end() - 1;
+    }
+
+    MeshInfo info;
+    info.boundsMin = glm::vec4(mesh.getBounds().min, 1.0f);
+    info.boundsMax = glm::vec4(mesh.getBounds().max, 1.0f);
+    info.batch = GLuint(batch - _batches.begin());
+    info.batchOffset = 0;
+    info.firstCommand = GLuint(_templates.size());
+    info.commandCount = GLuint(commands.size());
+
+    for (const DrawElementsIndirectCommand& command : commands)
+        _templates.push_back({ command.count, command.firstIndex, command.baseVertex });
+
+    _meshes.push_back(info);
+    _layoutDirty = true;
+    return GLuint(_meshes.size() - 1);
+}
+
+uint32_t GpuDrivenRenderer::addObject(GLuint mesh, const glm::mat4& model, GLuint material)
+{
+    // Including the ~0u of a mesh addMesh() refused
+    if (mesh >= _meshes.size())
+        return ~0u;
+
+    Object object;
+    object.model = model;
+    object.mesh = mesh;
+    object.material = material;
+    _objects.push_back(object);
+    _layoutDirty = true;
+    return uint32_t(_objects.size() - 1);
+}
+
+void GpuDrivenRenderer::setTransform(uint32_t object, const glm::mat4& model)
+{
+    _objects[object].model = model;
+    if (_dirtyBegin == _dirtyEnd)
+    {
+        _dirtyBegin = object;
+        _dirtyEnd = object + 1;
+    }
+    else
+    {
+        _dirtyBegin = std::min(_dirtyBegin, size_t(object));
+        _dirtyEnd = std::max(_dirtyEnd, size_t(object) + 1);
+    }
+}
+
+void GpuDrivenRenderer::layout()
+{
+    for (Batch& batch : _batches)
+        batch.capacity = 0;
+    for (const Object& object : _objects)
+        _batches[_meshes[object.mesh].batch].capacity += _meshes[object.mesh].commandCount;
+
+    _commandCapacity = 0;
+    for (Batch& batch : _batches)
+    {
+        batch.offset = _commandCapacity;
+        _commandCapacity += batch.capacity;
+    }
+    for (MeshInfo& mesh : _meshes)
+        mesh.batchOffset = _batches[mesh.batch].offset;
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _meshBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _meshes.size() * sizeof(MeshInfo), _meshes.data(), GL_STATIC_DRAW);
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _templateBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _templates.size() * sizeof(CommandTemplate), _templates.data(), GL_STATIC_DRAW);
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _objectBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _objects.size() * sizeof(Object), _objects.data(), GL_DYNAMIC_DRAW);
+
+    // Written by the compute pass only: a draw per visible object, each batch's commands once per pass
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _drawDataBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _objects.size() * sizeof(IndirectRenderer::DrawData), nullptr, GL_DYNAMIC_COPY);
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * _commandCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_COPY);
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _countBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (HeaderCounters + 2 * _batches.size()) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    _stats.objects = _objects.size();
+    _stats.meshes = _meshes.size();
+    _stats.batches = _batches.size();
+    _layoutDirty = false;
+    _dirtyBegin = _dirtyEnd = 0;
+
+    LOG_INFO("GpuDrivenRenderer: {} objects, {} meshes, {} batches, {} commands per pass",
+        _objects.size(), _meshes.size(), _batches.size(), _commandCapacity);
+}
+
+void GpuDrivenRenderer::uploadTransforms()
+{
+    if (_dirtyBegin == _dirtyEnd)
+        return;
+
+    // The whole entry goes up, the occluded flag is written again by the early pass
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _objectBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, _dirtyBegin * sizeof(Object), (_dirtyEnd - _dirtyBegin) * sizeof(Object), &_objects[_dirtyBegin]);
+    _dirtyBegin = _dirtyEnd = 0;
+}
+
+void GpuDrivenRenderer::beginFrame()
+{
+    GLuint counters[HeaderCounters] = {};
+    if (_readback.begin(counters))
+    {
+        _stats.frustumVisible = counters[1];
+        _stats.earlyVisible = counters[2];
+        _stats.lateVisible = counters[3];
+    }
+
+    if (_layoutDirty)
+        layout();
+    uploadTransforms();
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _countBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+}
+
+void GpuDrivenRenderer::endFrame()
+{
+    if (_objects.empty())
+        return;
+
+    GLState::bindBuffer(GL_COPY_READ_BUFFER, _countBuffer);
+    GLState::bindBuffer(GL_COPY_WRITE_BUFFER, _readback.counterBuffer());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, HeaderCounters * sizeof(GLuint));
+    _readback.end();
+}
+
+void GpuDrivenRenderer::cull(Pass pass, const glm::mat4& view, const glm::mat4& projection, const HiZCuller* hiz)
+{
+    if (_objects.empty() || !_cull)
+        return;
+
+    bool usePyramid = hiz && hiz->built();
+    Frustum frustum = Frustum::fromMatrix(projection * view);
+
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, _binding, _drawDataBuffer);
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CountBinding, _countBuffer);
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, ObjectBinding, _objectBuffer);
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, MeshBinding, _meshBuffer);
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, TemplateBinding, _templateBuffer);
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CommandBinding, _commandBuffer);
+    if (usePyramid)
+        GLState::bindTexture(HiZCuller::TextureUnit, GL_TEXTURE_2D, hiz->pyramid());
+
+    glProgramUniformMatrix4fv(_cull, cullLocation::View, 1, GL_FALSE, &view[0][0]);
+    glProgramUniformMatrix4fv(_cull, cullLocation::Projection, 1, GL_FALSE, &projection[0][0]);
+    glProgramUniform4fv(_cull, cullLocation::Planes, 6, &frustum.planes[0][0]);
+    if (usePyramid)
+    {
+        glProgramUniformMatrix4fv(_cull, cullLocation::PyramidViewProjection, 1, GL_FALSE, &hiz->viewProjection()[0][0]);
+        glProgramUniform1i(_cull, cullLocation::Levels, hiz->levels());
+    }
+    glProgramUniform1i(_cull, cullLocation::Pass, pass);
+    glProgramUniform1i(_cull, cullLocation::UsePyramid, usePyramid);
+    glProgramUniform1ui(_cull, cullLocation::ObjectCount, GLuint(_objects.size()));
+    glProgramUniform1ui(_cull, cullLocation::BatchCount, GLuint(_batches.size()));
+    glProgramUniform1ui(_cull, cullLocation::CommandCapacity, _commandCapacity);
+
+    GLState::useProgram(_cull);
+    glDispatchCompute((GLuint(_objects.size()) + GroupSize - 1) / GroupSize, 1, 1);
+    GLState::useProgram(0);
+
+    // The draws read the commands, their counts and the draw data, endFrame() copies the counters
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+void GpuDrivenRenderer::draw(GLenum mode, Pass pass)
+{
+    if (_objects.empty())
+        return;
+
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, _binding, _drawDataBuffer);
+    GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, _commandBuffer);
+    GLState::bindBuffer(GL_PARAMETER_BUFFER, _countBuffer);
+
+    for (size_t b = 0; b < _batches.size(); b++)
+    {
+        const Batch& batch = _batches[b];
+        if (batch.capacity == 0)
+            continue;
+
+        GLuint firstCommand = pass * _commandCapacity + batch.offset;
+        GLuint countIndex = HeaderCounters + pass * GLuint(_batches.size()) + GLuint(b);
+
+        GeometryArena::instance().bind(batch.mesh->getArenaRange());
+        glMultiDrawElementsIndirectCount(mode, batch.indexType,
+            (const void*)(firstCommand * sizeof(DrawElementsIndirectCommand)),
+            GLintptr(countIndex * sizeof(GLuint)), GLsizei(batch.capacity), 0);
+    }
+}
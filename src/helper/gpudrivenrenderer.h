@@ -0,0 +1,140 @@
+#pragma once
+
+#include "trianglemesh.h"
+#include "framereadback.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+class HiZCuller;
+
+// Draws a persistent set of objects whose culling and draw commands are produced on the GPU.
+//
+// Meshes, objects and their transforms live in shader storage buffers, uploaded only when they change.
+// Each frame shader/GpuCull.cs tests every object against the frustum, and optionally a HiZCuller's
+// pyramid, and appends the survivors' DrawData (see IndirectRenderer) and commands to one compacted
+// range per batch. A batch is an arena pool and index type; draw() issues one
+// glMultiDrawElementsIndirectCount per batch, reading the command count the compute pass wrote.
+// The CPU work of a frame is the same whatever the number of objects.
+//
+// With Hi-Z, a frame has two passes like HiZCuller: EARLY against the previous frame's pyramid, then
+// LATE for the objects it hid, against the pyramid built after the early draws.
+class GpuDrivenRenderer
+{
+public:
+    enum Pass
+    {
+        EARLY,
+        LATE,
+    };
+
+    struct Stats
+    {
+        size_t objects = 0;
+        size_t meshes = 0;
+        size_t batches = 0;
+
+        // From the GPU, a frame or two old
+        size_t frustumVisible = 0;
+        size_t earlyVisible = 0;
+        size_t lateVisible = 0;
+
+        size_t drawn() const { return earlyVisible + lateVisible; }
+    };
+
+    explicit GpuDrivenRenderer(GLuint drawDataBinding = 1);
+    ~GpuDrivenRenderer();
+
+    GpuDrivenRenderer(const GpuDrivenRenderer&) = delete;
+    GpuDrivenRenderer& operator=(const GpuDrivenRenderer&) = delete;
+
+    // Compute program linked from shader/GpuCull.cs
+    void setProgram(GLuint cull) { _cull = cull; }
+
+    // Drops every object and mesh
+    void clear();
+
+    // Returns the mesh id for addObject(), or ~0u for meshes outside the GeometryArena
+    GLuint addMesh(const TriangleMesh& mesh);
+
+    // Returns the object's index for setTransform(), or ~0u for a mesh id addMesh() didn't return
+    uint32_t addObject(GLuint mesh, const glm::mat4& model, GLuint material);
+    void setTransform(uint32_t object, const glm::mat4& model);
+
+    void beginFrame();
+    void endFrame();
+
+    // hiz may be null, then objects are only frustum culled and the late pass draws nothing
+    void cull(Pass pass, const glm::mat4& view, const glm::mat4& projection, const HiZCuller* hiz);
+    void draw(GLenum mode, Pass pass);
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    // std430 entries of shader/GpuCull.cs
+    struct MeshInfo
+    {
+        glm::vec4 boundsMin;
+        glm::vec4 boundsMax;
+        GLuint batch;
+        GLuint batchOffset;      // First command of the batch, filled in by layout()
+        GLuint firstCommand;     // In the template buffer
+        GLuint commandCount;
+    };
+
+    struct CommandTemplate
+    {
+        GLuint count;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint padding = 0;
+    };
+
+    struct Object
+    {
+        glm::mat4 model;
+        GLuint mesh;
+        GLuint material;
+        GLuint occluded = 0;     // Written by the early pass
+        GLuint padding = 0;
+    };
+
+    struct Batch
+    {
+        GLuint vertexArray;
+        GLenum indexType;
+        const TriangleMesh* mesh;  // Any of its meshes, to bind the pool
+        GLuint offset = 0;         // Command ranges, capacity commands each
+        GLuint capacity = 0;
+    };
+
+    // Sizes the batches' command ranges for the objects and uploads everything
+    void layout();
+
+    // Uploads the objects whose transform changed since the last frame
+    void uploadTransforms();
+
+    GLuint _binding;
+    GLuint _cull = 0;
+
+    std::vector<MeshInfo> _meshes;
+    std::vector<CommandTemplate> _templates;
+    std::vector<Object> _objects;
+    std::vector<Batch> _batches;
+    GLuint _commandCapacity = 0;   // Commands per pass, over all batches
+
+    bool _layoutDirty = true;
+    size_t _dirtyBegin = 0, _dirtyEnd = 0;   // Objects whose transform changed
+
+    GLuint _meshBuffer = 0;
+    GLuint _templateBuffer = 0;
+    GLuint _objectBuffer = 0;
+    GLuint _drawDataBuffer = 0;
+    GLuint _commandBuffer = 0;
+    GLuint _countBuffer = 0;       // Header counters, then the command count of every batch and pass
+
+    FrameReadback _readback;       // Copy of the header counters
+    Stats _stats;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Open addressing hash table with linear probing, meant for small trivially copyable keys.
+// Reserve the expected number of entries up front; it still doubles when the load factor passes 1/2.
+// Entries can't be erased, which keeps probing branch-free of tombstones.
+// Hash and Equal may carry state (e.g. to compare keys that index into another array).
+template<typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key>>
+class OpenHashTable
+{
+public:
+    explicit OpenHashTable(size_t expectedSize = 16, const Hash& hash = Hash(), const Equal& equal = Equal())
+        : _hash(hash), _equal(equal)
+    {
+        reserve(expectedSize);
+    }
+
+    void reserve(size_t expectedSize)
+    {
+        size_t capacity = 16;
+        while (capacity < expectedSize * 2)
+            capacity <<= 1;
+
+        if (capacity > _slots.size())
+            rehash(capacity);
+    }
+
+    void clear()
+    {
+        for (auto& slot : _slots)
+            slot.used = false;
+        _size = 0;
+    }
+
+    // Inserts the value if the key is missing.
+    // Returns the stored value and true when it was inserted.
+    std::pair<Value&, bool> insert(const Key& key, const Value& value)
+    {
+        if ((_size + 1) * 2 > _slots.size())
+            rehash(_slots.size() * 2);
+
+        size_t idx = _hash(key) & _mask;
+        while (_slots[idx].used)
+        {
+            if (_equal(_slots[idx].key, key))
+                return { _slots[idx].value, false };
+            idx = (idx + 1) & _mask;
+        }
+
+        Slot& slot = _slots[idx];
+        slot.key = key;
+        slot.value = value;
+        slot.used = true;
+        _size++;
+        return { slot.value, true };
+    }
+
+    Value* find(const Key& key)
+    {
+        size_t idx = _hash(key) & _mask;
+        while (_slots[idx].used)
+        {
+            if (_equal(_slots[idx].key, key))
+                return &_slots[idx].value;
+            idx = (idx + 1) & _mask;
+        }
+        return nullptr;
+    }
+
+    const Value* find(const Key& key) const
+    {
+        return const_cast<OpenHashTable*>(this)->find(key);
+    }
+
+    size_t size() const { return _size; }
+    size_t capacity() const { return _slots.size(); }
+
+    // Visits every stored entry as fn(key, value), in slot order
+    template<typename F>
+    void forEach(F&& fn) const
+    {
+        for (const auto& slot : _slots)
+        {
+            if (slot.used)
+                fn(slot.key, slot.value);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        Key key;
+        Value value;
+        bool used = false;
+    };
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Slot> old(capacity);
+        old.swap(_slots);
+        _mask = capacity - 1;
+        _size = 0;
+
+        for (const auto& slot : old)
+        {
+            if (slot.used)
+                insert(slot.key, slot.value);
+        }
+    }
+
+    Hash _hash;
+    Equal _equal;
+    std::vector<Slot> _slots;
+    size_t _mask = 0;
+    size_t _size = 0;
+};
+
+// 64-bit finalizer (from MurmurHash3), good enough to spread packed integer keys
+inline uint64_t hashMix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Hash of a byte range, four independent lanes of 64-bit words so large files hash at memory speed
+inline uint64_t hashBytes64(const void* data, size_t size, uint64_t seed = 0)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t lanes[4] = { seed, seed ^ 0x9e3779b97f4a7c15ULL, seed ^ 0xc2b2ae3d27d4eb4fULL, seed ^ 0x165667b19e3779f9ULL };
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            uint64_t word;
+            memcpy(&word, bytes + i + lane * 8, 8);
+            lanes[lane] = (lanes[lane] ^ hashMix64(word)) * 0x9e3779b97f4a7c15ULL;
+        }
+    }
+
+    uint64_t h = hashMix64(lanes[0]) ^ hashMix64(lanes[1] + 1) ^ hashMix64(lanes[2] + 2) ^ hashMix64(lanes[3] + 3);
+
+    // Whole words of the tail first, short keys such as a 48 byte vertex would otherwise go byte by byte
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h = hashMix64(h ^ word);
+    }
+    for (; i < size; i++)
+        h = (h ^ bytes[i]) * 0x100000001b3ULL;
+
+    return hashMix64(h ^ size);
+}
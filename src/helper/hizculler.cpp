@@ -0,0 +1,216 @@
+#include "../pch.h"
+#include "hizculler.h"
+#include "indirectrenderer.h"
+#include "glstate.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Shader storage bindings of shader/HiZCull.cs, clear of the draw data (1), instances (2) and materials (3)
+    const GLuint SourceBinding = 4;
+    const GLuint EarlyBinding = 5;
+    const GLuint LateBinding = 6;
+    const GLuint BoxBinding = 7;
+    const GLuint CounterBinding = 0;   // Atomic counter buffer
+
+    const GLuint GroupSize = 64;       // local_size_x of shader/HiZCull.cs
+    const GLuint TileSize = 8;         // local_size_x and y of shader/HiZDownsample.cs
+
+    // Explicit uniform locations, the programs are driven without ShaderManager
+    namespace downsampleLocation
+    {
+        const GLint Level = 0;
+    }
+
+    namespace cullLocation
+    {
+        const GLint ViewProjection = 0;
+        const GLint Pass = 1;
+        const GLint HasPyramid = 2;
+        const GLint Levels = 3;
+        const GLint CommandCount = 4;
+    }
+
+    GLuint groups(GLuint count, GLuint size)
+    {
+        return (count + size - 1) / size;
+    }
+}
+
+HiZCuller::HiZCuller()
+    : _readback(3 * sizeof(GLuint))
+{
+    glGenBuffers(1, &_boxBuffer);
+    glGenBuffers(1, &_earlyCommands);
+    glGenBuffers(1, &_lateCommands);
+}
+
+HiZCuller::~HiZCuller()
+{
+    GLState::deleteBuffers(1, &_boxBuffer);
+    GLState::deleteBuffers(1, &_earlyCommands);
+    GLState::deleteBuffers(1, &_lateCommands);
+    GLState::deleteTextures(1, &_depth);
+    GLState::deleteTextures(1, &_pyramid);
+}
+
+void HiZCuller::setPrograms(GLuint downsample, GLuint cull)
+{
+    _downsample = downsample;
+    _cull = cull;
+}
+
+void HiZCuller::resize(int width, int height)
+{
+    if (width == _width && height == _height)
+        return;
+
+    GLState::deleteTextures(1, &_depth);
+    GLState::deleteTextures(1, &_pyramid);
+    _depth = _pyramid = 0;
+    _width = width;
+    _height = height;
+    _levels = 0;
+    _built = false;
+    if (width <= 0 || height <= 0)
+        return;
+
+    // Down to 1x1, every level halves its size rounding down
+    _levels = 1 + (int)std::floor(std::log2((float)std::max(width, height)));
+
+    glGenTextures(1, &_depth);
+    GLState::bindTexture(TextureUnit, GL_TEXTURE_2D, _depth);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+    glGenTextures(1, &_pyramid);
+    GLState::bindTexture(TextureUnit, GL_TEXTURE_2D, _pyramid);
+    glTexStorage2D(GL_TEXTURE_2D, _levels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    LOG_INFO("HiZCuller: {}x{} depth pyramid, {} levels", width, height, _levels);
+}
+
+void HiZCuller::clear()
+{
+    _boxes.clear();
+}
+
+void HiZCuller::add(const Aabb& worldBox)
+{
+    _boxes.push_back(glm::vec4(worldBox.min, 1.0f));
+    _boxes.push_back(glm::vec4(worldBox.max, 1.0f));
+}
+
+void HiZCuller::beginFrame()
+{
+    // Tested, early visible, late visible
+    GLuint counters[3] = {};
+    if (_readback.begin(counters, &_stats.pyramidMs))
+    {
+        _stats.tested = counters[0];
+        _stats.earlyVisible = counters[1];
+        _stats.lateVisible = counters[2];
+    }
+
+    const GLuint zeros[3] = {};
+    GLState::bindBuffer(GL_ATOMIC_COUNTER_BUFFER, _readback.counterBuffer());
+    glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(zeros), zeros);
+}
+
+void HiZCuller::endFrame()
+{
+    _readback.end();
+}
+
+void HiZCuller::cullEarly(const IndirectRenderer& renderer)
+{
+    // Both command buffers follow the renderer's, the late pass reads what the early one wrote
+    size_t commands = renderer.commandCount();
+    if (commands > _capacity)
+    {
+        _capacity = std::max(commands, _capacity * 2);
+        for (GLuint buffer : { _earlyCommands, _lateCommands })
+        {
+            GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, _capacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+        }
+    }
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _boxBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _boxes.size() * sizeof(glm::vec4), _boxes.data(), GL_STREAM_DRAW);
+
+    cull(renderer, EARLY);
+}
+
+void HiZCuller::cullLate(const IndirectRenderer& renderer)
+{
+    cull(renderer, LATE);
+}
+
+void HiZCuller::cull(const IndirectRenderer& renderer, Pass pass)
+{
+    GLuint commands = (GLuint)renderer.commandCount();
+    if (commands == 0 || !_cull)
+        return;
+
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, SourceBinding, renderer.commandBuffer());
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, EarlyBinding, _earlyCommands);
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, LateBinding, _lateCommands);
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, BoxBinding, _boxBuffer);
+    GLState::bindBufferBase(GL_ATOMIC_COUNTER_BUFFER, CounterBinding, _readback.counterBuffer());
+    GLState::bindTexture(TextureUnit, GL_TEXTURE_2D, _pyramid);
+
+    // Before the late pass, _viewProjection is still the previous frame's
+    glProgramUniformMatrix4fv(_cull, cullLocation::ViewProjection, 1, GL_FALSE, &_viewProjection[0][0]);
+    glProgramUniform1i(_cull, cullLocation::Pass, pass);
+    glProgramUniform1i(_cull, cullLocation::HasPyramid, _built);
+    glProgramUniform1i(_cull, cullLocation::Levels, _levels);
+    glProgramUniform1ui(_cull, cullLocation::CommandCount, commands);
+
+    GLState::useProgram(_cull);
+    glDispatchCompute(groups(commands, GroupSize), 1, 1);
+    GLState::useProgram(0);
+
+    // The next pass reads the early commands as storage, the draws read them as commands
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+void HiZCuller::build(const glm::mat4& viewProjection)
+{
+    _viewProjection = viewProjection;
+    if (!_pyramid || !_downsample)
+        return;
+
+    _readback.beginTimer();
+
+    GLState::bindTexture(TextureUnit, GL_TEXTURE_2D, _depth);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, _width, _height);
+
+    // Level 0 is the depth itself, every other level the farthest of the 2x2 (3x3 on odd edges) texels under it
+    GLState::useProgram(_downsample);
+    for (int level = 0; level < _levels; level++)
+    {
+        int levelWidth = std::max(1, _width >> level);
+        int levelHeight = std::max(1, _height >> level);
+
+        glProgramUniform1i(_downsample, downsampleLocation::Level, level);
+        if (level > 0)
+            glBindImageTexture(0, _pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, _pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        glDispatchCompute(groups(levelWidth, TileSize), groups(levelHeight, TileSize), 1);
+        glMemoryBarrier(level + 1 < _levels ? GL_SHADER_IMAGE_ACCESS_BARRIER_BIT : GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    GLState::useProgram(0);
+
+    _readback.endTimer();
+    _built = true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "aabb.h"
+#include "framereadback.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+class IndirectRenderer;
+
+// Occlusion culling of IndirectRenderer draws against a hierarchical depth (Hi-Z) pyramid, on the GPU.
+//
+// The pyramid is an R32F mip chain of the depth buffer where every texel holds the farthest depth
+// under it, built by shader/HiZDownsample.cs. shader/HiZCull.cs projects each draw's world box to
+// the screen, picks the level where the box covers at most 2x2 texels and drops the draw when its
+// nearest depth is behind all four. Dropped draws keep their commands with an instance count of 0.
+//
+// A frame culls in two passes around build():
+//   cullEarly() tests against the pyramid of the previous frame, with the matrix it was built with.
+//   Its survivors are drawn, then build() makes a new pyramid from the depth so far, and cullLate()
+//   tests the draws the early pass dropped against it. Those that turn out visible are drawn by the
+//   late pass, so objects that come out from behind an occluder show up in the same frame.
+//
+// Draw i must be added as box i, in IndirectRenderer::add() order. A frame goes between beginFrame()
+// and endFrame(), whose fence the stats come back through: they are a frame or two old.
+class HiZCuller
+{
+public:
+    static const GLuint TextureUnit = 4;
+
+    struct Stats
+    {
+        size_t tested = 0;
+        size_t earlyVisible = 0;   // Drawn by the early pass
+        size_t lateVisible = 0;    // Dropped by the early pass, drawn by the late pass
+        double pyramidMs = 0.0;    // GPU time of the depth copy and downsampling
+
+        size_t culled() const { return tested - earlyVisible - lateVisible; }
+    };
+
+    HiZCuller();
+    ~HiZCuller();
+
+    HiZCuller(const HiZCuller&) = delete;
+    HiZCuller& operator=(const HiZCuller&) = delete;
+
+    // Compute programs linked from shader/HiZDownsample.cs and shader/HiZCull.cs
+    void setPrograms(GLuint downsample, GLuint cull);
+
+    // Reallocates the pyramid for the framebuffer size, the next early pass keeps everything
+    void resize(int width, int height);
+
+    void beginFrame();
+    void endFrame();
+
+    void clear();
+    void add(const Aabb& worldBox);
+
+    // Each writes the commands of its pass to earlyCommands() / lateCommands()
+    void cullEarly(const IndirectRenderer& renderer);
+    void cullLate(const IndirectRenderer& renderer);
+
+    // Copies the depth of the bound read framebuffer and downsamples it. viewProjection is the matrix
+    // the depth was drawn with, the late pass and the next frame's early pass project with it.
+    void build(const glm::mat4& viewProjection);
+
+    GLuint earlyCommands() const { return _earlyCommands; }
+    GLuint lateCommands() const { return _lateCommands; }
+
+    // The pyramid texture, for other culling passes. Sampled on TextureUnit with texelFetch().
+    GLuint pyramid() const { return _pyramid; }
+    bool built() const { return _built; }
+    const glm::mat4& viewProjection() const { return _viewProjection; }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int levels() const { return _levels; }
+    const Stats& stats() const { return _stats; }
+
+private:
+    enum Pass
+    {
+        EARLY,
+        LATE,
+    };
+
+    void cull(const IndirectRenderer& renderer, Pass pass);
+
+    GLuint _downsample = 0;
+    GLuint _cull = 0;
+
+    GLuint _depth = 0;         // GL_DEPTH_COMPONENT32F copy of the framebuffer
+    GLuint _pyramid = 0;
+    int _width = 0;
+    int _height = 0;
+    int _levels = 0;
+
+    bool _built = false;       // Whether the pyramid holds a frame's depth
+    glm::mat4 _viewProjection = glm::mat4(1.0f);
+
+    std::vector<glm::vec4> _boxes;   // Min and max of every draw
+    GLuint _boxBuffer = 0;
+    GLuint _earlyCommands = 0;       // The late pass reads which commands these dropped
+    GLuint _lateCommands = 0;
+    size_t _capacity = 0;            // Commands the two buffers above hold
+
+    FrameReadback _readback;   // Atomic counters: tested, early visible, late visible; pyramid build time
+    Stats _stats;
+};
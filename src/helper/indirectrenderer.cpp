@@ -0,0 +1,118 @@
+#include "../pch.h"
+#include "indirectrenderer.h"
+#include "glstate.h"
+
+static_assert(sizeof(IndirectRenderer::DrawData) == 208, "DrawData must match the std430 layout of shader/TextureMixedIndirect.vert");
+
+namespace
+{
+    uint64_t drawKey(unsigned bucket, const TriangleMesh& mesh)
+    {
+        uint64_t pool = mesh.getArenaRange().pool & 0x7fff;
+        uint64_t shortIndices = mesh.getIndexType() == GL_UNSIGNED_SHORT ? 1 : 0;
+        return (uint64_t(bucket) << 32) | (pool << 1) | shortIndices;
+    }
+}
+
+IndirectRenderer::IndirectRenderer(GLuint drawDataBinding)
+    : _binding(drawDataBinding)
+{
+    glGenBuffers(1, &_drawDataBuffer);
+    glGenBuffers(1, &_commandBuffer);
+}
+
+IndirectRenderer::~IndirectRenderer()
+{
+    GLState::deleteBuffers(1, &_drawDataBuffer);
+    GLState::deleteBuffers(1, &_commandBuffer);
+}
+
+void IndirectRenderer::clear()
+{
+    _draws.clear();
+    _drawData.clear();
+    _commands.clear();
+    _groupStart.clear();
+    _groupDraw.clear();
+    _stats = Stats();
+}
+
+bool IndirectRenderer::add(const TriangleMesh& mesh, unsigned bucket, const DrawData& data)
+{
+    if (!mesh.getArenaRange().valid())
+    {
+        if (_stats.skipped++ == 0)
+            LOG_WARN("IndirectRenderer only draws meshes in the geometry arena, skipping");
+        return false;
+    }
+
+    _draws.push_back({ drawKey(bucket, mesh), &mesh, GLuint(_drawData.size()) });
+    _drawData.push_back(data);
+    return true;
+}
+
+void IndirectRenderer::submit(GLenum mode, const std::function<void(unsigned)>& setupBucket)
+{
+    upload();
+    draw(mode, setupBucket);
+}
+
+void IndirectRenderer::upload()
+{
+    _stats.draws = _draws.size();
+    _stats.commands = 0;
+    _stats.multiDraws = 0;
+    _commands.clear();
+    _groupStart.clear();
+    _groupDraw.clear();
+    if (_draws.empty())
+        return;
+
+    // Stable, so draws keep their order within a multi-draw
+    std::stable_sort(_draws.begin(), _draws.end(), [](const Draw& a, const Draw& b) { return a.key < b.key; });
+
+    for (size_t i = 0; i < _draws.size(); i++)
+    {
+        if (i == 0 || _draws[i].key != _draws[i - 1].key)
+        {
+            _groupStart.push_back(_commands.size());
+            _groupDraw.push_back(&_draws[i]);
+        }
+        _draws[i].mesh->appendDrawCommands(_commands, _draws[i].drawIndex);
+    }
+    _groupStart.push_back(_commands.size());
+
+    // Orphan and refill both buffers, the previous frame's draws may still read them
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _drawDataBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _drawData.size() * sizeof(DrawData), _drawData.data(), GL_STREAM_DRAW);
+
+    GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, _commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, _commands.size() * sizeof(DrawElementsIndirectCommand), _commands.data(), GL_STREAM_DRAW);
+
+    _stats.commands = _commands.size();
+}
+
+void IndirectRenderer::draw(GLenum mode, const std::function<void(unsigned)>& setupBucket, GLuint commandBuffer)
+{
+    if (_commands.empty())
+        return;
+
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, _binding, _drawDataBuffer);
+    GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer ? commandBuffer : _commandBuffer);
+
+    unsigned currentBucket = 0;
+    for (size_t g = 0; g + 1 < _groupStart.size(); g++)
+    {
+        const Draw& first = *_groupDraw[g];
+        unsigned bucket = unsigned(first.key >> 32);
+        if (setupBucket && (g == 0 || bucket != currentBucket))
+            setupBucket(bucket);
+        currentBucket = bucket;
+
+        GeometryArena::instance().bind(first.mesh->getArenaRange());
+        glMultiDrawElementsIndirect(mode, first.mesh->getIndexType(),
+            (const void*)(_groupStart[g] * sizeof(DrawElementsIndirectCommand)),
+            GLsizei(_groupStart[g + 1] - _groupStart[g]), 0);
+        _stats.multiDraws++;
+    }
+}
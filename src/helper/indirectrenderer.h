@@ -0,0 +1,82 @@
+#pragma once
+
+#include "trianglemesh.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Collects draws of meshes that live in the GeometryArena and submits them with one
+// glMultiDrawElementsIndirect per bucket, arena pool and index type.
+//
+// Per-draw data goes to a shader storage buffer. Every command of a draw has its index as base
+// instance, so the vertex shader finds its entry as Draws[gl_BaseInstance] (see shader/TextureMixedIndirect.vert).
+class IndirectRenderer
+{
+public:
+    // One std430 entry of the draw data buffer
+    struct DrawData
+    {
+        glm::mat4 mvp;
+        glm::mat4 modelView;
+        glm::mat4 normalMatrix;  // Only the upper 3x3 is used
+        GLuint material = 0;     // MaterialArray id, for shader/TextureMixedArray.frag
+        GLuint padding[3] = {};
+    };
+
+    struct Stats
+    {
+        size_t draws = 0;
+        size_t commands = 0;
+        size_t multiDraws = 0;
+        size_t skipped = 0;  // Meshes outside the arena
+    };
+
+    explicit IndirectRenderer(GLuint drawDataBinding = 1);
+    ~IndirectRenderer();
+
+    // Starts a new list of draws
+    void clear();
+
+    // Queues a draw. The bucket is the caller's pipeline / material id; draws are submitted bucket by bucket.
+    // Returns false, without taking a draw index, when the mesh isn't in the geometry arena.
+    bool add(const TriangleMesh& mesh, unsigned bucket, const DrawData& data);
+
+    // Uploads the draw data and commands, then for each bucket calls setupBucket(bucket)
+    // and issues its multi-draws. The list stays valid, so it can be submitted again.
+    void submit(GLenum mode, const std::function<void(unsigned)>& setupBucket = nullptr);
+
+    // submit() in two steps, so the commands can be rewritten on the GPU in between.
+    // draw() reads them from commandBuffer when given, which must have the layout of commandBuffer().
+    void upload();
+    void draw(GLenum mode, const std::function<void(unsigned)>& setupBucket = nullptr, GLuint commandBuffer = 0);
+
+    // The commands of the last upload(), each with its draw index as base instance
+    GLuint commandBuffer() const { return _commandBuffer; }
+    size_t commandCount() const { return _commands.size(); }
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    struct Draw
+    {
+        uint64_t key;  // Bucket, pool and index type, in submission order
+        const TriangleMesh* mesh;
+        GLuint drawIndex;
+    };
+
+    GLuint _binding;
+    GLuint _drawDataBuffer = 0;
+    GLuint _commandBuffer = 0;
+
+    std::vector<Draw> _draws;
+    std::vector<DrawData> _drawData;
+    std::vector<DrawElementsIndirectCommand> _commands;
+
+    // Commands grouped by key: group g covers commands [_groupStart[g], _groupStart[g + 1])
+    std::vector<size_t> _groupStart;
+    std::vector<const Draw*> _groupDraw;
+    Stats _stats;
+};
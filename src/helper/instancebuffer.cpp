@@ -0,0 +1,44 @@
+#include "../pch.h"
+#include "instancebuffer.h"
+#include "glstate.h"
+
+static_assert(sizeof(InstanceBuffer::Instance) == 80, "Instance must match the std430 layout of the shaders");
+
+InstanceBuffer::InstanceBuffer()
+{
+    glGenBuffers(1, &_buffer);
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    GLState::deleteBuffers(1, &_buffer);
+}
+
+void InstanceBuffer::assign(std::span<const Instance> instances)
+{
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _buffer);
+    if (instances.size() > _capacity)
+    {
+        _capacity = std::max(instances.size(), _capacity * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, _capacity * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+    }
+    if (!instances.empty())
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instances.size_bytes(), instances.data());
+
+    _size = instances.size();
+}
+
+void InstanceBuffer::update(size_t first, std::span<const Instance> instances)
+{
+    assert(first + instances.size() <= _size);
+    if (instances.empty())
+        return;
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(Instance), instances.size_bytes(), instances.data());
+}
+
+void InstanceBuffer::bind() const
+{
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding, _buffer);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <span>
+
+// Per-instance data for TriangleMesh::renderInstanced, in a shader storage buffer.
+//
+// The instanced vertex shaders (shader/TextureMixedInstanced.vert and its packed variant) read
+// Instances[gl_BaseInstance + gl_InstanceID] and apply the model matrix before the Matrices UBO,
+// so the UBO model acts as a transform shared by all instances.
+class InstanceBuffer
+{
+public:
+    // One std430 entry
+    struct Instance
+    {
+        glm::mat4 model = glm::mat4(1.0f);
+        GLuint material = 0;  // Passed to the fragment stage
+        GLuint padding[3] = {};
+    };
+
+    static const GLuint Binding = 2;
+
+    InstanceBuffer();
+    ~InstanceBuffer();
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // Replaces all instances. Storage is only reallocated when it grows.
+    void assign(std::span<const Instance> instances);
+
+    // Overwrites instances [first, first + instances.size()), for the ones that moved
+    void update(size_t first, std::span<const Instance> instances);
+
+    void bind() const;
+
+    size_t size() const { return _size; }
+    GLuint buffer() const { return _buffer; }
+
+private:
+    GLuint _buffer = 0;
+    size_t _size = 0;
+    size_t _capacity = 0;
+};
@@ -0,0 +1,107 @@
+#include "../pch.h"
+#include "mappedfile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char* fileName)
+{
+    close();
+
+#ifdef _WIN32
+    _file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(_file, &fileSize))
+    {
+        close();
+        return false;
+    }
+
+    _size = static_cast<size_t>(fileSize.QuadPart);
+    _open = true;
+
+    // Empty files can't be mapped, treat them as an empty view
+    if (_size == 0)
+        return true;
+
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mapping == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    _fd = ::open(fileName, O_RDONLY);
+    if (_fd < 0)
+        return false;
+
+    struct stat st {};
+    if (fstat(_fd, &st) != 0)
+    {
+        close();
+        return false;
+    }
+
+    _size = static_cast<size_t>(st.st_size);
+    _open = true;
+
+    if (_size == 0)
+        return true;
+
+    void* view = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (view != MAP_FAILED)
+    {
+        _data = static_cast<const char*>(view);
+        madvise(view, _size, MADV_SEQUENTIAL);
+    }
+#endif
+
+    if (_data == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (_data != nullptr)
+        UnmapViewOfFile(_data);
+    if (_mapping != nullptr)
+        CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_file);
+
+    _mapping = nullptr;
+    _file = INVALID_HANDLE_VALUE;
+#else
+    if (_data != nullptr)
+        munmap(const_cast<char*>(_data), _size);
+    if (_fd >= 0)
+        ::close(_fd);
+
+    _fd = -1;
+#endif
+
+    _data = nullptr;
+    _size = 0;
+    _open = false;
+}
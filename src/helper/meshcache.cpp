@@ -0,0 +1,211 @@
+#include "../pch.h"
+#include "meshcache.h"
+#include "hashtable.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+namespace
+{
+    const char CacheMagic[8] = { 'M', 'E', 'S', 'H', 'B', 'I', 'N', '\0' };
+    const uint32_t CacheVersion = 3;
+
+    uint64_t alignUp(uint64_t value)
+    {
+        return (value + 15) & ~uint64_t(15);
+    }
+}
+
+std::string MeshCache::cacheFileName(const char* sourceFile)
+{
+    return std::string(sourceFile) + ".meshbin";
+}
+
+bool MeshCache::sourceInfo(const char* sourceFile, SourceInfo& info)
+{
+    std::error_code ec;
+    info.size = std::filesystem::file_size(sourceFile, ec);
+    if (ec)
+        return false;
+
+    auto mtime = std::filesystem::last_write_time(sourceFile, ec);
+    if (ec)
+        return false;
+
+    info.mtime = (int64_t)mtime.time_since_epoch().count();
+    return true;
+}
+
+bool MeshCache::hashSource(const char* sourceFile, uint64_t& hash)
+{
+    MappedFile source;
+    if (!source.open(sourceFile))
+        return false;
+
+    hash = hashBytes64(source.data(), source.size());
+    return true;
+}
+
+bool MeshCache::open(const char* sourceFile, uint32_t flags)
+{
+    close();
+
+    SourceInfo info;
+    if (!sourceInfo(sourceFile, info))
+        return false;
+
+    std::string cacheFile = cacheFileName(sourceFile);
+    if (!_file.open(cacheFile.c_str()))
+        return false;
+
+    const Header* header = reinterpret_cast<const Header*>(_file.data());
+    if (_file.size() < sizeof(Header) ||
+        memcmp(header->magic, CacheMagic, sizeof(CacheMagic)) != 0 ||
+        header->version != CacheVersion ||
+        header->flags != flags ||
+        header->sourceSize != info.size)
+    {
+        close();
+        return false;
+    }
+
+    // Every array has to lie inside the file
+    const uint64_t elementSize[NumArrays] = { sizeof(GLuint), sizeof(GLfloat), sizeof(GLfloat), sizeof(GLfloat), sizeof(GLfloat) };
+    for (int i = 0; i < NumArrays; i++)
+    {
+        if (header->offsets[i] > _file.size() ||
+            header->counts[i] > (_file.size() - header->offsets[i]) / elementSize[i])
+        {
+            LOG_WARN("Ignoring corrupt mesh cache: {}", cacheFile);
+            close();
+            return false;
+        }
+    }
+
+    if (header->sourceMtime != info.mtime)
+    {
+        uint64_t hash = 0;
+        if (!hashSource(sourceFile, hash) || hash != header->contentHash)
+        {
+            close();
+            return false;
+        }
+
+        // Same content, remember the new mtime so the next load doesn't hash again.
+        // The view is closed first, Windows doesn't allow writing to a mapped file.
+        close();
+        {
+            std::fstream out(cacheFile, std::ios::in | std::ios::out | std::ios::binary);
+            if (out)
+            {
+                out.seekp(offsetof(Header, sourceMtime));
+                out.write(reinterpret_cast<const char*>(&info.mtime), sizeof(info.mtime));
+            }
+        }
+
+        if (!_file.open(cacheFile.c_str()) || _file.size() < sizeof(Header))
+        {
+            close();
+            return false;
+        }
+        header = reinterpret_cast<const Header*>(_file.data());
+    }
+
+    _header = header;
+    _bbox.min = glm::vec3(header->bboxMin[0], header->bboxMin[1], header->bboxMin[2]);
+    _bbox.max = glm::vec3(header->bboxMax[0], header->bboxMax[1], header->bboxMax[2]);
+    return true;
+}
+
+void MeshCache::close()
+{
+    _header = nullptr;
+    _file.close();
+}
+
+bool MeshCache::write(const char* sourceFile, uint32_t flags,
+    std::span<const GLuint> indices,
+    std::span<const GLfloat> points,
+    std::span<const GLfloat> normals,
+    std::span<const GLfloat> texCoords,
+    std::span<const GLfloat> tangents,
+    const Aabb& bbox)
+{
+    std::string cacheFile = cacheFileName(sourceFile);
+
+    SourceInfo info;
+    Header header{};
+    if (!sourceInfo(sourceFile, info) || !hashSource(sourceFile, header.contentHash))
+    {
+        LOG_WARN("Unable to write mesh cache {}: can't read the source file", cacheFile);
+        return false;
+    }
+
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version = CacheVersion;
+    header.flags = flags;
+    header.sourceSize = info.size;
+    header.sourceMtime = info.mtime;
+    for (int i = 0; i < 3; i++)
+    {
+        header.bboxMin[i] = bbox.min[i];
+        header.bboxMax[i] = bbox.max[i];
+    }
+
+    const void* arrays[NumArrays] = { indices.data(), points.data(), normals.data(), texCoords.data(), tangents.data() };
+    const size_t bytes[NumArrays] = { indices.size_bytes(), points.size_bytes(), normals.size_bytes(), texCoords.size_bytes(), tangents.size_bytes() };
+    header.counts[Indices] = indices.size();
+    header.counts[Points] = points.size();
+    header.counts[Normals] = normals.size();
+    header.counts[TexCoords] = texCoords.size();
+    header.counts[Tangents] = tangents.size();
+
+    uint64_t offset = alignUp(sizeof(Header));
+    for (int i = 0; i < NumArrays; i++)
+    {
+        header.offsets[i] = offset;
+        offset = alignUp(offset + bytes[i]);
+    }
+
+    // Write to a temporary file and rename it, so a crash never leaves a truncated cache behind
+    std::string tempFile = cacheFile + ".tmp";
+    {
+        std::ofstream out(tempFile, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            LOG_WARN("Unable to write mesh cache: {}", cacheFile);
+            return false;
+        }
+
+        const char padding[16] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(padding, alignUp(sizeof(Header)) - sizeof(Header));
+        for (int i = 0; i < NumArrays; i++)
+        {
+            out.write(static_cast<const char*>(arrays[i]), bytes[i]);
+            out.write(padding, alignUp(bytes[i]) - bytes[i]);
+        }
+
+        if (!out)
+        {
+            LOG_WARN("Unable to write mesh cache: {}", cacheFile);
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(tempFile, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempFile, cacheFile, ec);
+    if (ec)
+    {
+        LOG_WARN("Unable to write mesh cache {}: {}", cacheFile, ec.message());
+        std::filesystem::remove(tempFile, ec);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "mappedfile.h"
+#include "aabb.h"
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Cooked binary copy of a loaded mesh, stored next to the source as <source>.meshbin.
+// It holds the final GL arrays and bounding box, so a valid cache is uploaded
+// straight from the mapped file without any parsing.
+//
+// The cache is keyed on the source file's size, mtime and content hash plus the load flags.
+// When only the mtime changed (e.g. after a checkout) the content hash decides, and a match
+// refreshes the stored mtime so the next load skips hashing again.
+class MeshCache
+{
+public:
+    enum Flags : uint32_t
+    {
+        FLAG_CENTER = 1,
+        FLAG_TANGENTS = 2,
+        FLAG_ADJACENCY = 4,
+        FLAG_ANGLE_WEIGHTED = 8,
+        FLAG_CORNER_TANGENTS = 16,
+        FLAG_OPTIMIZED = 32
+    };
+
+    static std::string cacheFileName(const char* sourceFile);
+
+    // Maps the cache of sourceFile, returns false if it is missing or stale
+    bool open(const char* sourceFile, uint32_t flags);
+    void close();
+
+    std::span<const GLuint> indices() const { return view<GLuint>(Indices); }
+    std::span<const GLfloat> points() const { return view<GLfloat>(Points); }
+    std::span<const GLfloat> normals() const { return view<GLfloat>(Normals); }
+    std::span<const GLfloat> texCoords() const { return view<GLfloat>(TexCoords); }
+    std::span<const GLfloat> tangents() const { return view<GLfloat>(Tangents); }
+    const Aabb& bbox() const { return _bbox; }
+
+    // Writes a cache for sourceFile. Failures only log a warning; the mesh is still usable.
+    static bool write(const char* sourceFile, uint32_t flags,
+        std::span<const GLuint> indices,
+        std::span<const GLfloat> points,
+        std::span<const GLfloat> normals,
+        std::span<const GLfloat> texCoords,
+        std::span<const GLfloat> tangents,
+        const Aabb& bbox);
+
+private:
+    enum Array { Indices, Points, Normals, TexCoords, Tangents, NumArrays };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        uint64_t contentHash;
+        float bboxMin[3];
+        float bboxMax[3];
+        uint64_t offsets[NumArrays];  // Byte offsets from the start of the file, 16 byte aligned
+        uint64_t counts[NumArrays];   // Element counts
+    };
+
+    struct SourceInfo
+    {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+    };
+
+    static bool sourceInfo(const char* sourceFile, SourceInfo& info);
+    static bool hashSource(const char* sourceFile, uint64_t& hash);
+
+    template<typename T>
+    std::span<const T> view(Array array) const
+    {
+        if (_header == nullptr || _header->counts[array] == 0)
+            return {};
+        return { reinterpret_cast<const T*>(_file.data() + _header->offsets[array]), (size_t)_header->counts[array] };
+    }
+
+    MappedFile _file;
+    const Header* _header = nullptr;
+    Aabb _bbox;
+};
@@ -0,0 +1,235 @@
+#include "../pch.h"
+#include "meshoptimizer.h"
+
+#include <chrono>
+
+namespace
+{
+    const GLuint Unused = ~0u;
+
+    const size_t FetchLineSize = 64;
+    const size_t FetchCacheLines = 16 * 1024 / FetchLineSize;
+
+    // FIFO cache over integer ids. An id is cached while fewer than `size` misses happened since it was inserted.
+    class FifoCache
+    {
+    public:
+        FifoCache(size_t idCount, size_t size)
+            : _insertedAt(idCount, 0), _size(size), _misses(0)
+        { }
+
+        // Returns true on a hit, inserts the id on a miss
+        bool access(size_t id)
+        {
+            if (_insertedAt[id] != 0 && _misses - _insertedAt[id] < _size)
+                return true;
+
+            _misses++;
+            _insertedAt[id] = _misses;
+            return false;
+        }
+
+        size_t misses() const { return _misses; }
+
+    private:
+        std::vector<size_t> _insertedAt;  // Miss count when the id was inserted, offset by one (0 = never)
+        size_t _size;
+        size_t _misses;
+    };
+}
+
+MeshOptimizer::Stats MeshOptimizer::analyze(std::span<const GLuint> indices, size_t vertexCount, unsigned cacheSize, size_t vertexStride)
+{
+    Stats stats;
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    FifoCache transformCache(vertexCount, cacheSize);
+    FifoCache fetchCache((vertexCount * vertexStride + FetchLineSize - 1) / FetchLineSize + 1, FetchCacheLines);
+    std::vector<bool> used(vertexCount, false);
+    size_t usedCount = 0;
+
+    for (GLuint index : indices)
+    {
+        if (!used[index])
+        {
+            used[index] = true;
+            usedCount++;
+        }
+
+        if (transformCache.access(index))
+            continue;
+
+        // A transformed vertex reads every cache line its bytes touch
+        size_t first = index * vertexStride / FetchLineSize;
+        size_t last = (index * vertexStride + vertexStride - 1) / FetchLineSize;
+        for (size_t line = first; line <= last; line++)
+            fetchCache.access(line);
+    }
+
+    stats.acmr = float(transformCache.misses()) / float(indices.size() / 3);
+    stats.atvr = float(transformCache.misses()) / float(usedCount);
+    stats.overfetch = float(fetchCache.misses() * FetchLineSize) / float(usedCount * vertexStride);
+    return stats;
+}
+
+void MeshOptimizer::optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize)
+{
+    // Tipsify (Sander, Nehab, Barczak 2007): fan around a vertex, then continue with the vertex
+    // that is most likely still in the cache, falling back to recently used ones at dead ends
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Vertex to triangle adjacency (CSR)
+    std::vector<GLuint> liveTriangles(vertexCount, 0);
+    for (GLuint index : indices)
+        liveTriangles[index]++;
+
+    std::vector<GLuint> adjacencyStart(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        adjacencyStart[v + 1] = adjacencyStart[v] + liveTriangles[v];
+
+    std::vector<GLuint> adjacency(indices.size());
+    std::vector<GLuint> next(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[next[indices[i]]++] = GLuint(i / 3);
+
+    std::vector<size_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<GLuint> deadEnds;
+    std::vector<GLuint> candidates;
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+
+    size_t time = cacheSize + 1;
+    size_t cursor = 0;
+
+    // Next vertex with live triangles: the most recently used dead end, then the lowest numbered one
+    auto skipDeadEnd = [&]() -> GLuint {
+        while (!deadEnds.empty())
+        {
+            GLuint v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0)
+                return v;
+        }
+        while (cursor < vertexCount)
+        {
+            if (liveTriangles[cursor] > 0)
+                return GLuint(cursor++);
+            cursor++;
+        }
+        return Unused;
+    };
+
+    GLuint fan = skipDeadEnd();
+    while (fan != Unused)
+    {
+        candidates.clear();
+
+        for (GLuint i = adjacencyStart[fan]; i < adjacencyStart[fan + 1]; i++)
+        {
+            GLuint t = adjacency[i];
+            if (emitted[t])
+                continue;
+
+            for (int k = 0; k < 3; k++)
+            {
+                GLuint v = indices[t * 3 + k];
+                result.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+            emitted[t] = true;
+        }
+
+        // Prefer the candidate that entered the cache earliest but will still be in it after its remaining fan
+        GLuint best = Unused;
+        size_t bestPriority = 0;
+        for (GLuint v : candidates)
+        {
+            if (liveTriangles[v] == 0)
+                continue;
+
+            size_t priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                priority = time - cacheTime[v];
+
+            if (best == Unused || priority > bestPriority)
+            {
+                best = v;
+                bestPriority = priority;
+            }
+        }
+
+        fan = (best != Unused) ? best : skipDeadEnd();
+    }
+
+    indices.swap(result);
+}
+
+std::vector<GLuint> MeshOptimizer::optimizeVertexFetch(std::vector<GLuint>& indices, size_t vertexCount)
+{
+    std::vector<GLuint> remap(vertexCount, Unused);
+    GLuint nextVertex = 0;
+
+    for (GLuint& index : indices)
+    {
+        if (remap[index] == Unused)
+            remap[index] = nextVertex++;
+        index = remap[index];
+    }
+
+    return remap;
+}
+
+void MeshOptimizer::remapStream(std::vector<GLfloat>& stream, size_t components, const std::vector<GLuint>& remap, size_t newVertexCount)
+{
+    std::vector<GLfloat> result(newVertexCount * components);
+
+    for (size_t v = 0; v < remap.size(); v++)
+    {
+        if (remap[v] == Unused)
+            continue;
+
+        std::copy(&stream[v * components], &stream[v * components] + components, &result[remap[v] * components]);
+    }
+
+    stream.swap(result);
+}
+
+void MeshOptimizer::optimize(std::vector<GLuint>& indices, std::vector<GLfloat>& points, std::vector<GLfloat>& normals,
+    std::vector<GLfloat>* texCoords, std::vector<GLfloat>* tangents)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    size_t vertexCount = points.size() / 3;
+    Stats before = analyze(indices, vertexCount);
+
+    optimizeVertexCache(indices, vertexCount);
+    std::vector<GLuint> remap = optimizeVertexFetch(indices, vertexCount);
+
+    size_t newVertexCount = 0;
+    for (GLuint v : remap)
+    {
+        if (v != Unused)
+            newVertexCount++;
+    }
+
+    remapStream(points, 3, remap, newVertexCount);
+    remapStream(normals, 3, remap, newVertexCount);
+    if (texCoords != nullptr && !texCoords->empty())
+        remapStream(*texCoords, 2, remap, newVertexCount);
+    if (tangents != nullptr && !tangents->empty())
+        remapStream(*tangents, 4, remap, newVertexCount);
+
+    Stats after = analyze(indices, newVertexCount);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+    LOG_INFO("Optimized {} triangles in {:.1f} ms: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}, overfetch {:.3f} -> {:.3f}",
+        indices.size() / 3, ms, before.acmr, after.acmr, before.atvr, after.atvr, before.overfetch, after.overfetch);
+}
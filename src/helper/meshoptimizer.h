@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <span>
+#include <vector>
+
+// Reorders indexed triangle lists for the GPU:
+// triangles for post-transform vertex cache hits (Tipsify), then vertices in first-use order
+// so attribute fetches walk memory linearly.
+// The statistics come from a software cache model, so they can be compared without a GPU.
+class MeshOptimizer
+{
+public:
+    struct Stats
+    {
+        float acmr = 0.0f;       // Average cache miss ratio: transformed vertices per triangle (0.5 .. 3)
+        float atvr = 0.0f;       // Average transform to vertex ratio: transformed vertices per used vertex (1 is optimal)
+        float overfetch = 0.0f;  // Bytes fetched from memory per byte of used vertex data (1 is optimal)
+    };
+
+    static const unsigned DefaultCacheSize = 16;
+
+    // Models a FIFO post-transform cache of cacheSize vertices and a 16 KB FIFO fetch cache
+    // of 64 byte lines over a vertex stream with the given stride
+    static Stats analyze(std::span<const GLuint> indices, size_t vertexCount,
+        unsigned cacheSize = DefaultCacheSize, size_t vertexStride = 3 * sizeof(GLfloat));
+
+    // Reorders triangles in place, linear in the number of triangles
+    static void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize = DefaultCacheSize);
+
+    // Renumbers vertices in order of first use and rewrites the indices.
+    // Returns the new index of every old vertex, ~0 for vertices no triangle uses.
+    static std::vector<GLuint> optimizeVertexFetch(std::vector<GLuint>& indices, size_t vertexCount);
+
+    // Applies a remap from optimizeVertexFetch to a vertex stream of the given component count
+    static void remapStream(std::vector<GLfloat>& stream, size_t components, const std::vector<GLuint>& remap, size_t newVertexCount);
+
+    // Runs both passes on a mesh in TriangleMesh layout and logs the statistics before and after.
+    // texCoords and tangents may be null or empty.
+    static void optimize(std::vector<GLuint>& indices, std::vector<GLfloat>& points, std::vector<GLfloat>& normals,
+        std::vector<GLfloat>* texCoords = nullptr, std::vector<GLfloat>* tangents = nullptr);
+};
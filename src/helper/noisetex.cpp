@@ -1,5 +1,6 @@
 #include "../pch.h"
 #include "noisetex.h"
+#include "glstate.h"
 
 #include <glm/gtc/noise.hpp>
 
@@ -7,7 +8,7 @@ int NoiseTex::storeTex(GLubyte* data, int w, int h) {
     GLuint texID;
     glGenTextures(1, &texID);
 
-    glBindTexture(GL_TEXTURE_2D, texID);
+    GLState::bindTexture(0, GL_TEXTURE_2D, texID);
     glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, data);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
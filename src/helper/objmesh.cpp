@@ -1,148 +1,429 @@
 #include "../pch.h"
 #include "objmesh.h"
-#include "utils.h"
+#include "mappedfile.h"
+#include "parallel.h"
+#include "hashtable.h"
+#include "meshcache.h"
+#include "meshoptimizer.h"
+
+#include <charconv>
+#include <immintrin.h>
+#include <chrono>
+#include <string>
 
 ObjMesh::ObjMesh() : drawAdj(false)
 { }
 
 void ObjMesh::render() const {
     if( drawAdj ) {
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES_ADJACENCY, nVerts, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        drawElements(GL_TRIANGLES_ADJACENCY);
     } else {
         TriangleMesh::render();
     }
 }
 
+void ObjMesh::renderInstanced(const InstanceBuffer & instances, size_t first, size_t count) const {
+    drawInstances(drawAdj ? GL_TRIANGLES_ADJACENCY : GL_TRIANGLES, instances, first, count);
+}
+
 
 std::unique_ptr<ObjMesh> ObjMesh::load( const char * fileName, bool center, bool genTangents ) {
+    LoadOptions options;
+    options.center = center;
+    options.genTangents = genTangents;
+    return load(fileName, options);
+}
+
+// CPU side of a load, everything up to the GL upload
+struct ObjMesh::Staged {
+    std::unique_ptr<ObjMesh> mesh;
+    std::string fileName;
+    LoadOptions options;
+    std::chrono::steady_clock::time_point startTime;
+
+    MeshCache cache;     // Open when the mesh comes from the cache
+    GlMeshData glMesh;   // Otherwise the processed mesh
+    bool fromCache = false;
+};
+
+std::unique_ptr<ObjMesh> ObjMesh::load( const char * fileName, const LoadOptions & options ) {
+    std::unique_ptr<Staged> staged = stage(fileName, withGlobals(options));
+    if( !staged ) exit(1);   // As the synchronous load always has, the file is logged by ObjMeshData::load
+    return upload(*staged);
+}
+
+ObjMesh::LoadOptions ObjMesh::withGlobals( const LoadOptions & options ) {
+    LoadOptions result = options;
+    result.optimize = options.optimize || optimizeBuffers;
+    return result;
+}
+
+std::unique_ptr<ObjMesh::Staged> ObjMesh::stage( const char * fileName, const LoadOptions & options,
+                                                 const std::function<void(const Aabb &)> & onBounds ) {
+    std::unique_ptr<Staged> staged(new Staged());
+    staged->startTime = std::chrono::steady_clock::now();
+    staged->fileName = fileName;
+    staged->options = options;
+    staged->mesh.reset(new ObjMesh());
 
-    std::unique_ptr<ObjMesh> mesh(new ObjMesh());
+    ObjMesh & mesh = *staged->mesh;
+    mesh.drawAdj = options.adjacency;
+
+    uint32_t cacheFlags =
+        (options.center ? MeshCache::FLAG_CENTER : 0) |
+        (options.genTangents ? MeshCache::FLAG_TANGENTS : 0) |
+        (options.adjacency ? MeshCache::FLAG_ADJACENCY : 0) |
+        (options.angleWeightedNormals ? MeshCache::FLAG_ANGLE_WEIGHTED : 0) |
+        (options.perCornerTangents ? MeshCache::FLAG_CORNER_TANGENTS : 0) |
+        (options.optimize ? MeshCache::FLAG_OPTIMIZED : 0);
+
+    // Warm start: upload straight from the mapped cache
+    if( options.useCache && staged->cache.open(fileName, cacheFlags) ) {
+        mesh.bbox = staged->cache.bbox();
+        staged->fromCache = true;
+        if( onBounds ) onBounds(mesh.bbox);
+        return staged;
+    }
 
     ObjMeshData meshData;
-    meshData.load(fileName, mesh->bbox);
+    if( !meshData.load(fileName, mesh.bbox, Parallel::workerCount(options.numThreads)) ) return nullptr;
+
+    // Centering only moves the box, so it is known from here on
+    if( onBounds ) {
+        Aabb bounds = mesh.bbox;
+        if( options.center ) {
+            glm::vec3 offset = (bounds.max + bounds.min) * 0.5f;
+            bounds.min -= offset;
+            bounds.max -= offset;
+        }
+        onBounds(bounds);
+    }
 
     // Generate normals
-    meshData.generateNormalsIfNeeded();
+    meshData.generateNormalsIfNeeded(options.angleWeightedNormals);
 
-    // Generate tangents?
-    if( genTangents ) meshData.generateTangents();
+    // Generate tangents per position? Per-corner tangents are computed on the GL vertices below
+    if( options.genTangents && !options.perCornerTangents ) meshData.generateTangents();
 
     // Convert to GL format
-    GlMeshData glMesh;
+    GlMeshData & glMesh = staged->glMesh;
     meshData.toGlMesh(glMesh);
 
-    if( center ) glMesh.center(mesh->bbox);
+    if( options.genTangents && options.perCornerTangents ) glMesh.generateCornerTangents();
+
+    if( options.center ) glMesh.center(mesh.bbox);
+
+    // Optimized here rather than in initBuffers, so the cache stores the reordered mesh
+    // and the adjacency indices are built from the final triangle order
+    if( options.optimize ) {
+        MeshOptimizer::optimize(glMesh.faces, glMesh.points, glMesh.normals, &glMesh.texCoords, &glMesh.tangents);
+    }
+
+    if( options.adjacency ) glMesh.convertFacesToAdjancencyFormat();
+
+    if( options.useCache ) {
+        MeshCache::write(fileName, cacheFlags,
+            glMesh.faces, glMesh.points, glMesh.normals, glMesh.texCoords, glMesh.tangents, mesh.bbox);
+    }
+
+    return staged;
+}
+
+std::unique_ptr<ObjMesh> ObjMesh::upload( Staged & staged ) {
+    auto uploadStart = std::chrono::steady_clock::now();
+    auto elapsedMs = [](std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    };
+
+    std::unique_ptr<ObjMesh> mesh = std::move(staged.mesh);
+    const LoadOptions & options = staged.options;
+
+    if( staged.fromCache ) {
+        MeshCache & cache = staged.cache;
+        mesh->initBuffers(cache.indices(), cache.points(), cache.normals(), cache.texCoords(), cache.tangents(),
+            options.vertexFormat);
+        if( options.keepOccluder && !options.adjacency ) mesh->keepOccluder(cache.indices(), cache.points());
+
+        LOG_INFO("Loaded mesh from cache: {} vertices = {} triangles = {} in {:.1f} ms ({:.1f} ms upload)",
+            MeshCache::cacheFileName(staged.fileName.c_str()), (cache.points().size() / 3), (cache.indices().size() / 3),
+            elapsedMs(staged.startTime), elapsedMs(uploadStart));
+        LOG_INFO(mesh->bbox.toString());
+        cache.close();
+        return mesh;
+    }
 
     // Load into VAO
+    GlMeshData & glMesh = staged.glMesh;
     mesh->initBuffers(
-            & (glMesh.faces), & glMesh.points, & glMesh.normals,
-            glMesh.texCoords.empty() ? nullptr : (& glMesh.texCoords),
-            glMesh.tangents.empty() ? nullptr : (& glMesh.tangents)
+            std::span<const GLuint>(glMesh.faces), std::span<const GLfloat>(glMesh.points),
+            std::span<const GLfloat>(glMesh.normals), std::span<const GLfloat>(glMesh.texCoords),
+            std::span<const GLfloat>(glMesh.tangents),
+            options.vertexFormat
     );
+    if( options.keepOccluder && !options.adjacency ) mesh->keepOccluder(glMesh.faces, glMesh.points);
 
-    LOG_INFO("Loaded mesh from: {} vertices = {} triangles = {}",
-        fileName, (glMesh.points.size() / 3), (glMesh.faces.size() / 3));
+    LOG_INFO("Loaded mesh from: {} vertices = {} triangles = {} in {:.1f} ms ({:.1f} ms upload)",
+        staged.fileName, (glMesh.points.size() / 3), (glMesh.faces.size() / 3),
+        elapsedMs(staged.startTime), elapsedMs(uploadStart));
     LOG_INFO(mesh->bbox.toString());
+    VertexFormat::logMemoryReport(glMesh.points.size() / 3, glMesh.faces.size(), ! glMesh.texCoords.empty(), ! glMesh.tangents.empty());
+    glMesh.clear();
     return mesh;
 }
 
+void ObjMesh::keepOccluder( std::span<const GLuint> indices, std::span<const GLfloat> points ) {
+    occluder.positions.resize(points.size() / 3);
+    for( size_t i = 0; i < occluder.positions.size(); i++ )
+        occluder.positions[i] = glm::vec3(points[3 * i], points[3 * i + 1], points[3 * i + 2]);
+    occluder.indices.assign(indices.begin(), indices.end());
+}
+
+std::unique_ptr<ObjMesh::AsyncLoad> ObjMesh::loadAsync( const char * fileName, const LoadOptions & options ) {
+    return std::unique_ptr<AsyncLoad>(new AsyncLoad(fileName, options));
+}
+
+ObjMesh::AsyncLoad::AsyncLoad( const char * fileName, const LoadOptions & options )
+{
+    staged = std::async(std::launch::async, [this, name = std::string(fileName), options = withGlobals(options)]() {
+        return stage(name.c_str(), options, [this](const Aabb & box) {
+            bbox = box;
+            boundsReady.store(true, std::memory_order_release);
+        });
+    });
+}
+
+ObjMesh::AsyncLoad::~AsyncLoad()
+{
+    // The worker still writes to this object, so a pending load has to finish first
+    if( staged.valid() ) staged.wait();
+}
+
+bool ObjMesh::AsyncLoad::isReady() const
+{
+    return staged.valid() && staged.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+std::unique_ptr<ObjMesh> ObjMesh::AsyncLoad::poll()
+{
+    if( !isReady() ) return nullptr;
+
+    std::unique_ptr<Staged> result = staged.get();
+    if( !result ) {
+        loadFailed = true;
+        return nullptr;
+    }
+    return upload(*result);
+}
+
 std::unique_ptr<ObjMesh> ObjMesh::loadWithAdjacency( const char * fileName, bool center ) {
+    LoadOptions options;
+    options.center = center;
+    options.adjacency = true;
+    return load(fileName, options);
+}
 
-    std::unique_ptr<ObjMesh> mesh(new ObjMesh());
+bool ObjMesh::ObjMeshData::load(const char * fileName, Aabb & bbox, unsigned numThreads) {
+    MappedFile file;
 
-    ObjMeshData meshData;
-    meshData.load(fileName, mesh->bbox);
+    if (!file.open(fileName)) {
+        LOG_ERROR("Unable to open .obj file: {}", fileName);
+        return false;
+    }
 
-    // Generate normals
-    meshData.generateNormalsIfNeeded();
+    auto startTime = std::chrono::steady_clock::now();
 
-    // Convert to GL format
-    GlMeshData glMesh;
-    meshData.toGlMesh(glMesh);
+    bbox.reset();
 
-    if( center ) glMesh.center(mesh->bbox);
+    // Small files aren't worth the thread start up and merge cost
+    constexpr size_t minChunkSize = 1 << 20;
+    numThreads = (unsigned)std::clamp<size_t>(file.size() / minChunkSize, 1, std::max(numThreads, 1u));
 
-    mesh->drawAdj = true;
-    glMesh.convertFacesToAdjancencyFormat();
+    if (numThreads > 1)
+        parseParallel(file.data(), file.end(), bbox, numThreads);
+    else
+        parse(file.data(), file.end(), bbox);
 
-    // Load into VAO
-    mesh->initBuffers(
-            & (glMesh.faces), & glMesh.points, & glMesh.normals,
-            glMesh.texCoords.empty() ? nullptr : (& glMesh.texCoords),
-            glMesh.tangents.empty() ? nullptr : (& glMesh.tangents)
-    );
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    double megaBytes = file.size() / (1024.0 * 1024.0);
+    LOG_INFO("Parsed {:.1f} MB of .obj data on {} thread(s) in {:.1f} ms ({:.0f} MB/s)",
+        megaBytes, numThreads, elapsed.count() * 1000.0, megaBytes / std::max(elapsed.count(), 1e-9));
+    return true;
+}
 
-    LOG_INFO("Loaded mesh from: {} vertices = {} triangles = {}",
-        fileName, (glMesh.points.size() / 3), (glMesh.faces.size() / 3));
-    return mesh;
+void ObjMesh::ObjMeshData::parseParallel(const char * begin, const char * end, Aabb & bbox, unsigned numThreads) {
+    // Split the text into chunks at line boundaries
+    std::vector<const char *> bounds(numThreads + 1, end);
+    bounds[0] = begin;
+    for (unsigned i = 1; i < numThreads; i++) {
+        const char * p = std::max(begin + (end - begin) * i / numThreads, bounds[i - 1]);
+        const char * lineEnd = static_cast<const char *>(memchr(p, '\n', end - p));
+        bounds[i] = lineEnd ? lineEnd + 1 : end;
+    }
+
+    // Each chunk resolves indices against its own lists
+    std::vector<ObjMeshData> chunks(numThreads);
+    std::vector<Aabb> chunkBoxes(numThreads);
+    Parallel::forEachTask(numThreads, [&](unsigned i) {
+        chunks[i].parse(bounds[i], bounds[i + 1], chunkBoxes[i]);
+    });
+
+    // Offsets of every chunk in the merged lists
+    struct ChunkOffsets { size_t points, normals, texCoords, faces, relativeCorners; };
+    std::vector<ChunkOffsets> offsets(numThreads + 1, ChunkOffsets{
+        points.size(), normals.size(), texCoords.size(), faces.size(), relativeCorners.size() });
+    for (unsigned i = 0; i < numThreads; i++) {
+        offsets[i + 1].points = offsets[i].points + chunks[i].points.size();
+        offsets[i + 1].normals = offsets[i].normals + chunks[i].normals.size();
+        offsets[i + 1].texCoords = offsets[i].texCoords + chunks[i].texCoords.size();
+        offsets[i + 1].faces = offsets[i].faces + chunks[i].faces.size();
+        offsets[i + 1].relativeCorners = offsets[i].relativeCorners + chunks[i].relativeCorners.size();
+        bbox.add(chunkBoxes[i]);
+    }
+
+    points.resize(offsets[numThreads].points);
+    normals.resize(offsets[numThreads].normals);
+    texCoords.resize(offsets[numThreads].texCoords);
+    faces.resize(offsets[numThreads].faces);
+    relativeCorners.resize(offsets[numThreads].relativeCorners);
+
+    // Copy chunks in file order and rebase the relative indices, positive ones are already global
+    Parallel::forEachTask(numThreads, [&](unsigned i) {
+        ObjMeshData & chunk = chunks[i];
+        const ChunkOffsets & base = offsets[i];
+
+        std::copy(chunk.points.begin(), chunk.points.end(), points.begin() + base.points);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + base.normals);
+        std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + base.texCoords);
+
+        size_t relIdx = base.relativeCorners;
+        for (auto & [corner, mask] : chunk.relativeCorners) {
+            ObjVertex & vert = chunk.faces[corner];
+            if (mask & ObjVertex::REL_POSITION) vert.pIdx += (int)base.points;
+            if (mask & ObjVertex::REL_TEXCOORD) vert.tcIdx += (int)base.texCoords;
+            if (mask & ObjVertex::REL_NORMAL) vert.nIdx += (int)base.normals;
+            relativeCorners[relIdx++] = { corner + base.faces, mask };
+        }
+        std::copy(chunk.faces.begin(), chunk.faces.end(), faces.begin() + base.faces);
+
+        // Release the chunk while the others are still copying
+        chunk = ObjMeshData();
+    });
 }
 
-void ObjMesh::ObjMeshData::load(const char * fileName, Aabb & bbox) {
-	std::ifstream objStream(fileName, std::ios::in);
+namespace {
+    // In-place tokenizer helpers, the parser never copies the mapped text
+    inline bool isBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+    }
 
-	if (!objStream) {
-        LOG_ERROR("Unable to open .obj file: {}", fileName);
-		exit(1);
-	}
-
-	bbox.reset();
-    std::string line, token;
-	getline(objStream, line);
-	while (!objStream.eof()) {
-		// Remove comment if it exists
-		size_t pos = line.find_first_of("#");
-		if (pos != std::string::npos) {
-			line = line.substr(0, pos);
-		}
-		Utils::trimString(line);
-
-		if (line.length() > 0) {
-            std::istringstream lineStream(line);
-
-			lineStream >> token;
-
-			if (token == "v") {
-				float x, y, z;
-				lineStream >> x >> y >> z;
-				glm::vec3 p(x, y, z);
-				points.push_back(p);
-				bbox.add(p);
-			}
-			else if (token == "vt") {
-				// Process texture coordinate
-				float s, t;
-				lineStream >> s >> t;
-				texCoords.push_back(glm::vec2(s, t));
-			}
-			else if (token == "vn") {
-				float x, y, z;
-				lineStream >> x >> y >> z;
-				normals.push_back(glm::vec3(x, y, z));
-			}
-			else if (token == "f") {
-				std::vector<std::string> parts;
-				while (lineStream.good()) {
-					std::string s;
-					lineStream >> s;
-					parts.push_back(s);
-				}
-
-				// Triangulate as a triangle fan
-				if (parts.size() > 2) {
-					ObjVertex firstVert(parts[0], this);
-					for (int i = 2; i < parts.size(); i++) {
-						faces.push_back(firstVert);
-						faces.push_back(ObjVertex(parts[i - 1], this));
-						faces.push_back(ObjVertex(parts[i], this));
-					}
-				}
-			}
-		}
-		getline(objStream, line);
-	}
-	objStream.close();
+    inline const char * skipBlanks(const char * p, const char * end) {
+        while (p < end && isBlank(*p)) ++p;
+        return p;
+    }
+
+    inline const char * skipToken(const char * p, const char * end) {
+        while (p < end && !isBlank(*p)) ++p;
+        return p;
+    }
+
+    inline const char * parseFloat(const char * p, const char * end, float & value) {
+        p = skipBlanks(p, end);
+        if (p < end && *p == '+') ++p;
+
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) {
+            value = 0.0f;
+            return skipToken(p, end);
+        }
+        return result.ptr;
+    }
+
+    inline const char * parseIndex(const char * p, const char * end, int & value) {
+        if (p < end && *p == '+') ++p;
+
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) {
+            value = 0;
+            return p;
+        }
+        return result.ptr;
+    }
+
+    // OBJ indices are 1-based, negative values are relative to the end of the current list
+    inline int resolveIndex(int idx, size_t count) {
+        return idx < 0 ? idx + (int)count : idx - 1;
+    }
+}
+
+void ObjMesh::ObjMeshData::parse(const char * begin, const char * end, Aabb & bbox) {
+    const char * lineStart = begin;
+    while (lineStart < end) {
+        const char * lineEnd = static_cast<const char *>(memchr(lineStart, '\n', end - lineStart));
+        if (lineEnd == nullptr) lineEnd = end;
+
+        // Remove comment if it exists
+        const char * comment = static_cast<const char *>(memchr(lineStart, '#', lineEnd - lineStart));
+        const char * last = comment ? comment : lineEnd;
+
+        const char * p = skipBlanks(lineStart, last);
+        const char * tokenEnd = skipToken(p, last);
+        size_t tokenLen = tokenEnd - p;
+
+        if (tokenLen == 1 && p[0] == 'v') {
+            glm::vec3 pt;
+            tokenEnd = parseFloat(tokenEnd, last, pt.x);
+            tokenEnd = parseFloat(tokenEnd, last, pt.y);
+            parseFloat(tokenEnd, last, pt.z);
+            points.push_back(pt);
+            bbox.add(pt);
+        }
+        else if (tokenLen == 2 && p[0] == 'v' && p[1] == 't') {
+            // Process texture coordinate
+            glm::vec2 tc;
+            tokenEnd = parseFloat(tokenEnd, last, tc.x);
+            parseFloat(tokenEnd, last, tc.y);
+            texCoords.push_back(tc);
+        }
+        else if (tokenLen == 2 && p[0] == 'v' && p[1] == 'n') {
+            glm::vec3 n;
+            tokenEnd = parseFloat(tokenEnd, last, n.x);
+            tokenEnd = parseFloat(tokenEnd, last, n.y);
+            parseFloat(tokenEnd, last, n.z);
+            normals.push_back(n);
+        }
+        else if (tokenLen == 1 && p[0] == 'f') {
+            // Triangulate as a triangle fan
+            ObjVertex firstVert, prevVert;
+            unsigned firstMask = 0, prevMask = 0;
+            int numVerts = 0;
+
+            const char * vertStart = skipBlanks(tokenEnd, last);
+            while (vertStart < last) {
+                const char * vertEnd = skipToken(vertStart, last);
+                unsigned mask = 0;
+                ObjVertex vert(vertStart, vertEnd, this, &mask);
+
+                if (numVerts == 0) {
+                    firstVert = vert;
+                    firstMask = mask;
+                } else if (numVerts >= 2) {
+                    if (firstMask) relativeCorners.emplace_back(faces.size(), firstMask);
+                    faces.push_back(firstVert);
+                    if (prevMask) relativeCorners.emplace_back(faces.size(), prevMask);
+                    faces.push_back(prevVert);
+                    if (mask) relativeCorners.emplace_back(faces.size(), mask);
+                    faces.push_back(vert);
+                }
+
+                prevVert = vert;
+                prevMask = mask;
+                numVerts++;
+                vertStart = skipBlanks(vertEnd, last);
+            }
+        }
+
+        lineStart = lineEnd + 1;
+    }
 }
 
 void ObjMesh::GlMeshData::center( Aabb & bbox ) {
@@ -163,242 +444,581 @@ void ObjMesh::GlMeshData::center( Aabb & bbox ) {
     bbox.min = bbox.min - center;
 }
 
-ObjMesh::ObjMeshData::ObjVertex::ObjVertex(std::string &vertString, ObjMeshData * mesh) : pIdx(-1), nIdx(-1), tcIdx(-1) {
-    size_t slash1, slash2;
-    slash1 = vertString.find("/");
-    pIdx = std::stoi(vertString.substr(0, slash1));
-	if (pIdx < 0) pIdx += mesh->points.size();
-	else pIdx--;
-    if (slash1 != std::string::npos) {
-        slash2 = vertString.find("/", slash1 + 1);
-        if (slash2 > slash1 + 1) {
-            tcIdx = std::stoi(vertString.substr(slash1 + 1, slash2 - slash1 - 1));
-			if (tcIdx < 0) tcIdx += mesh->texCoords.size();
-			else tcIdx--;
+ObjMesh::ObjMeshData::ObjVertex::ObjVertex(const char * begin, const char * end, ObjMeshData * mesh, unsigned * relativeMask) : pIdx(-1), nIdx(-1), tcIdx(-1) {
+    unsigned mask = 0;
+
+    const char * p = parseIndex(begin, end, pIdx);
+    int rawPIdx = pIdx;
+    if (pIdx < 0) mask |= REL_POSITION;
+    pIdx = resolveIndex(pIdx, mesh->points.size());
+
+    if (p < end && *p == '/') {
+        ++p;
+        if (p < end && *p != '/') {
+            p = parseIndex(p, end, tcIdx);
+            if (tcIdx < 0) mask |= REL_TEXCOORD;
+            tcIdx = resolveIndex(tcIdx, mesh->texCoords.size());
         }
-        nIdx = std::stoi(vertString.substr(slash2 + 1));
-		if (nIdx < 0) nIdx += mesh->normals.size();
-		else nIdx--;
+
+        // A "p/t" corner takes the normal with its position index, as the string based parser did
+        if (p < end && *p == '/') parseIndex(p + 1, end, nIdx);
+        else nIdx = rawPIdx;
+        if (nIdx < 0) mask |= REL_NORMAL;
+        nIdx = resolveIndex(nIdx, mesh->normals.size());
     }
+
+    if (relativeMask) *relativeMask = mask;
 }
 
-void ObjMesh::ObjMeshData::generateNormalsIfNeeded() {
-    if( normals.size() != 0 ) return;
+namespace {
+    // Four vectors in structure-of-arrays form, one per SSE lane
+    struct Vec3x4 {
+        __m128 x, y, z;
+    };
 
-    normals.resize(points.size());
+    inline Vec3x4 operator-(const Vec3x4 & a, const Vec3x4 & b) {
+        return { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+    }
 
-    for( GLuint i = 0; i < faces.size(); i += 3) {
-        const glm::vec3 & p1 = points[faces[i].pIdx];
-        const glm::vec3 & p2 = points[faces[i+1].pIdx];
-        const glm::vec3 & p3 = points[faces[i+2].pIdx];
+    inline Vec3x4 operator*(const Vec3x4 & a, __m128 s) {
+        return { _mm_mul_ps(a.x, s), _mm_mul_ps(a.y, s), _mm_mul_ps(a.z, s) };
+    }
 
-        glm::vec3 a = p2 - p1;
-        glm::vec3 b = p3 - p1;
-        glm::vec3 n = glm::normalize(glm::cross(a,b));
+    inline __m128 dot(const Vec3x4 & a, const Vec3x4 & b) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+    }
 
-        normals[faces[i].pIdx] += n;
-        normals[faces[i+1].pIdx] += n;
-        normals[faces[i+2].pIdx] += n;
+    inline Vec3x4 cross(const Vec3x4 & a, const Vec3x4 & b) {
+        return {
+            _mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(b.y, a.z)),
+            _mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(b.z, a.x)),
+            _mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(b.x, a.y))
+        };
+    }
 
-        // Set the normal index to be the same as the point index
-        faces[i].nIdx = faces[i].pIdx;
-        faces[i+1].nIdx = faces[i+1].pIdx;
-        faces[i+2].nIdx = faces[i+2].pIdx;
+    // Same rounding as glm::normalize: v * (1 / sqrt(dot(v, v)))
+    inline Vec3x4 normalize(const Vec3x4 & v) {
+        return v * _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(dot(v, v)));
     }
 
-    for( GLuint i = 0; i < normals.size(); i++ ) {
-        normals[i] = glm::normalize(normals[i]);
+    // Batches of four faces, the last batch repeats its final face
+    const GLuint FaceBatch = 4;
+
+    template<typename Get>
+    inline Vec3x4 gatherCorner(size_t firstFace, size_t nFaces, Get get) {
+        float x[FaceBatch], y[FaceBatch], z[FaceBatch];
+        for( GLuint lane = 0; lane < FaceBatch; lane++ ) {
+            const glm::vec3 v = get(std::min(firstFace + lane, nFaces - 1));
+            x[lane] = v.x; y[lane] = v.y; z[lane] = v.z;
+        }
+        return { _mm_loadu_ps(x), _mm_loadu_ps(y), _mm_loadu_ps(z) };
     }
+
+    inline void storeLanes(const Vec3x4 & v, float * x, float * y, float * z, size_t count) {
+        float lx[FaceBatch], ly[FaceBatch], lz[FaceBatch];
+        _mm_storeu_ps(lx, v.x);
+        _mm_storeu_ps(ly, v.y);
+        _mm_storeu_ps(lz, v.z);
+        for( size_t lane = 0; lane < count; lane++ ) {
+            x[lane] = lx[lane]; y[lane] = ly[lane]; z[lane] = lz[lane];
+        }
+    }
+
+    // Per-face vectors in structure-of-arrays form
+    struct FaceVectors {
+        std::vector<float> x, y, z;
+
+        explicit FaceVectors(size_t n) : x(n), y(n), z(n) { }
+
+        glm::vec3 operator[](size_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+    };
+
+    const size_t MinFacesPerTask = 16 * 1024;
+}
+
+namespace {
+    // Counting sort of corners by vertex: the corners of vertex v end up in
+    // corners[start[v] .. start[v + 1]), in increasing corner order
+    template<typename VertexOf>
+    void buildCornerMap(size_t nVertices, size_t nCorners, VertexOf vertexOf,
+                        std::vector<GLuint> & start, std::vector<GLuint> & corners) {
+        start.assign(nVertices + 1, 0);
+        for( size_t c = 0; c < nCorners; c++ ) start[vertexOf(c) + 1]++;
+        for( size_t i = 1; i < start.size(); i++ ) start[i] += start[i - 1];
+
+        corners.resize(nCorners);
+        std::vector<GLuint> next(start.begin(), start.end() - 1);
+        for( size_t c = 0; c < nCorners; c++ ) corners[next[vertexOf(c)]++] = (GLuint)c;
+    }
+}
+
+void ObjMesh::ObjMeshData::buildVertexCorners() {
+    if( vertexCornerStart.size() == points.size() + 1 ) return;
+
+    // Corners stay in face order within a vertex, which keeps the gathered sums
+    // identical to a sequential accumulation
+    buildCornerMap(points.size(), faces.size(), [this](size_t c) { return faces[c].pIdx; },
+        vertexCornerStart, vertexCorners);
+}
+
+void ObjMesh::ObjMeshData::generateNormalsIfNeeded(bool angleWeighted) {
+    if( normals.size() != 0 ) return;
+
+    normals.resize(points.size());
+    buildVertexCorners();
+
+    size_t nFaces = faces.size() / 3;
+    FaceVectors faceNormals(nFaces);
+    std::vector<float> cornerAngles(angleWeighted ? faces.size() : 0);
+
+    // Face normals, four faces per step
+    Parallel::forRange((nFaces + FaceBatch - 1) / FaceBatch, [&](size_t begin, size_t end) {
+        for( size_t batch = begin; batch < end; batch++ ) {
+            size_t f = batch * FaceBatch;
+            size_t count = std::min<size_t>(FaceBatch, nFaces - f);
+            auto corner = [&](GLuint k) {
+                return [&, k](size_t face) { return points[faces[face * 3 + k].pIdx]; };
+            };
+            Vec3x4 p1 = gatherCorner(f, nFaces, corner(0));
+            Vec3x4 p2 = gatherCorner(f, nFaces, corner(1));
+            Vec3x4 p3 = gatherCorner(f, nFaces, corner(2));
+
+            Vec3x4 a = p2 - p1;
+            Vec3x4 b = p3 - p1;
+            storeLanes(normalize(cross(a, b)), &faceNormals.x[f], &faceNormals.y[f], &faceNormals.z[f], count);
+
+            if( angleWeighted ) {
+                // Interior angle at each corner, between the two edges leaving it
+                Vec3x4 e12 = normalize(a), e13 = normalize(b), e23 = normalize(p3 - p2);
+                float cos1[FaceBatch], cos2[FaceBatch], cos3[FaceBatch];
+                __m128 zero = _mm_setzero_ps();
+                _mm_storeu_ps(cos1, dot(e12, e13));
+                _mm_storeu_ps(cos2, _mm_sub_ps(zero, dot(e12, e23)));
+                _mm_storeu_ps(cos3, dot(e13, e23));
+                for( size_t lane = 0; lane < count; lane++ ) {
+                    float * angle = &cornerAngles[(f + lane) * 3];
+                    angle[0] = std::acos(std::clamp(cos1[lane], -1.0f, 1.0f));
+                    angle[1] = std::acos(std::clamp(cos2[lane], -1.0f, 1.0f));
+                    angle[2] = std::acos(std::clamp(cos3[lane], -1.0f, 1.0f));
+                }
+            }
+
+            // Set the normal index to be the same as the point index
+            for( size_t c = f * 3; c < (f + count) * 3; c++ ) faces[c].nIdx = faces[c].pIdx;
+        }
+    }, MinFacesPerTask / FaceBatch);
+
+    // Each vertex gathers the normals of its faces, so no two threads write the same vertex
+    Parallel::forRange(points.size(), [&](size_t begin, size_t end) {
+        for( size_t v = begin; v < end; v++ ) {
+            glm::vec3 n(0.0f);
+            for( GLuint i = vertexCornerStart[v]; i < vertexCornerStart[v + 1]; i++ ) {
+                GLuint c = vertexCorners[i];
+                if( angleWeighted ) n += faceNormals[c / 3] * cornerAngles[c];
+                else n += faceNormals[c / 3];
+            }
+            normals[v] = glm::normalize(n);
+        }
+    }, MinFacesPerTask);
 }
 
 void ObjMesh::ObjMeshData::generateTangents() {
-    std::vector<glm::vec3> tan1Accum(points.size());
-    std::vector<glm::vec3> tan2Accum(points.size());
+    if( texCoords.empty() ) {
+        LOG_WARN("Can't generate tangents for a mesh without texture coordinates");
+        return;
+    }
+
     tangents.resize(points.size());
+    buildVertexCorners();
 
-    // Compute the tangent std::vector
-    for( GLuint i = 0; i < faces.size(); i += 3 )
-    {
-        const glm::vec3 &p1 = points[faces[i].pIdx];
-        const glm::vec3 &p2 = points[faces[i+1].pIdx];
-        const glm::vec3 &p3 = points[faces[i+2].pIdx];
-
-        const glm::vec2 &tc1 = texCoords[faces[i].tcIdx];
-        const glm::vec2 &tc2 = texCoords[faces[i+1].tcIdx];
-        const glm::vec2 &tc3 = texCoords[faces[i+2].tcIdx];
-
-        glm::vec3 q1 = p2 - p1;
-        glm::vec3 q2 = p3 - p1;
-        float s1 = tc2.x - tc1.x, s2 = tc3.x - tc1.x;
-        float t1 = tc2.y - tc1.y, t2 = tc3.y - tc1.y;
-        float r = 1.0f / (s1 * t2 - s2 * t1);
-        glm::vec3 tan1( (t2*q1.x - t1*q2.x) * r,
-                   (t2*q1.y - t1*q2.y) * r,
-                   (t2*q1.z - t1*q2.z) * r);
-        glm::vec3 tan2( (s1*q2.x - s2*q1.x) * r,
-                   (s1*q2.y - s2*q1.y) * r,
-                   (s1*q2.z - s2*q1.z) * r);
-        tan1Accum[faces[i].pIdx] += tan1;
-        tan1Accum[faces[i+1].pIdx] += tan1;
-        tan1Accum[faces[i+2].pIdx] += tan1;
-        tan2Accum[faces[i].pIdx] += tan2;
-        tan2Accum[faces[i+1].pIdx] += tan2;
-        tan2Accum[faces[i+2].pIdx] += tan2;
-    }
-
-    for( GLuint i = 0; i < points.size(); ++i )
-    {
-        const auto &n = normals[i];
-        glm::vec3 &t1 = tan1Accum[i];
-        glm::vec3 &t2 = tan2Accum[i];
+    size_t nFaces = faces.size() / 3;
+    FaceVectors faceTan1(nFaces), faceTan2(nFaces);
 
-        // Gram-Schmidt orthogonalize
-        tangents[i] = glm::vec4(glm::normalize( t1 - (glm::dot(n,t1) * n) ), 0.0f);
-        // Store handedness in w
-        tangents[i].w = (glm::dot( glm::cross(n,t1), t2 ) < 0.0f) ? -1.0f : 1.0f;
-    }
+    // Compute the face tangent and bitangent directions, four faces per step
+    Parallel::forRange((nFaces + FaceBatch - 1) / FaceBatch, [&](size_t begin, size_t end) {
+        for( size_t batch = begin; batch < end; batch++ ) {
+            size_t f = batch * FaceBatch;
+            size_t count = std::min<size_t>(FaceBatch, nFaces - f);
+            auto corner = [&](GLuint k) {
+                return [&, k](size_t face) { return points[faces[face * 3 + k].pIdx]; };
+            };
+            auto cornerTc = [&](GLuint k) {
+                return [&, k](size_t face) { return glm::vec3(texCoords[faces[face * 3 + k].tcIdx], 0.0f); };
+            };
+            Vec3x4 p1 = gatherCorner(f, nFaces, corner(0));
+            Vec3x4 p2 = gatherCorner(f, nFaces, corner(1));
+            Vec3x4 p3 = gatherCorner(f, nFaces, corner(2));
+            Vec3x4 tc1 = gatherCorner(f, nFaces, cornerTc(0));
+            Vec3x4 tc2 = gatherCorner(f, nFaces, cornerTc(1));
+            Vec3x4 tc3 = gatherCorner(f, nFaces, cornerTc(2));
+
+            Vec3x4 q1 = p2 - p1;
+            Vec3x4 q2 = p3 - p1;
+            __m128 s1 = _mm_sub_ps(tc2.x, tc1.x), s2 = _mm_sub_ps(tc3.x, tc1.x);
+            __m128 t1 = _mm_sub_ps(tc2.y, tc1.y), t2 = _mm_sub_ps(tc3.y, tc1.y);
+            __m128 r = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sub_ps(_mm_mul_ps(s1, t2), _mm_mul_ps(s2, t1)));
+
+            Vec3x4 tan1 = (q1 * t2 - q2 * t1) * r;
+            Vec3x4 tan2 = (q2 * s1 - q1 * s2) * r;
+            storeLanes(tan1, &faceTan1.x[f], &faceTan1.y[f], &faceTan1.z[f], count);
+            storeLanes(tan2, &faceTan2.x[f], &faceTan2.y[f], &faceTan2.z[f], count);
+        }
+    }, MinFacesPerTask / FaceBatch);
+
+    Parallel::forRange(points.size(), [&](size_t begin, size_t end) {
+        for( size_t v = begin; v < end; v++ ) {
+            glm::vec3 t1(0.0f), t2(0.0f);
+            for( GLuint i = vertexCornerStart[v]; i < vertexCornerStart[v + 1]; i++ ) {
+                GLuint f = vertexCorners[i] / 3;
+                t1 += faceTan1[f];
+                t2 += faceTan2[f];
+            }
+
+            const auto &n = normals[v];
+            // Gram-Schmidt orthogonalize
+            tangents[v] = glm::vec4(glm::normalize( t1 - (glm::dot(n,t1) * n) ), 0.0f);
+            // Store handedness in w
+            tangents[v].w = (glm::dot( glm::cross(n,t1), t2 ) < 0.0f) ? -1.0f : 1.0f;
+        }
+    }, MinFacesPerTask);
+}
+
+namespace {
+    // Face corner key, the packed (pIdx, tcIdx, nIdx) triple
+    struct CornerKey {
+        int pIdx, tcIdx, nIdx;
+
+        bool operator==(const CornerKey & other) const {
+            return pIdx == other.pIdx && tcIdx == other.tcIdx && nIdx == other.nIdx;
+        }
+    };
+
+    struct CornerKeyHash {
+        size_t operator()(const CornerKey & key) const {
+            uint64_t h = (uint64_t)(uint32_t)key.pIdx | ((uint64_t)(uint32_t)key.tcIdx << 32);
+            return (size_t)hashMix64(h ^ hashMix64((uint32_t)key.nIdx));
+        }
+    };
 }
 
 void ObjMesh::ObjMeshData::toGlMesh(GlMeshData & data) {
     data.clear();
 
-    std::map<std::string, GLuint> vertexMap;
-    for( auto & vert : faces ) {
-        auto vertStr = vert.str();
-        auto it = vertexMap.find(vertStr);
-        if( it == vertexMap.end() ) {
-            auto vIdx = data.points.size() / 3;
+    // Closed meshes have about half as many unique corners as triangles, the table grows otherwise
+    OpenHashTable<CornerKey, GLuint, CornerKeyHash> vertexMap(faces.size() / 3);
+
+    // First face corner of every unique vertex
+    std::vector<GLuint> uniqueCorners;
+    uniqueCorners.reserve(faces.size() / 3);
+
+    data.faces.resize(faces.size());
+    for( size_t i = 0; i < faces.size(); i++ ) {
+        const auto & vert = faces[i];
+        auto [vIdx, inserted] = vertexMap.insert({ vert.pIdx, vert.tcIdx, vert.nIdx }, (GLuint)uniqueCorners.size());
+        if( inserted ) uniqueCorners.push_back((GLuint)i);
+        data.faces[i] = vIdx;
+    }
+
+    // Fill the attribute arrays in place now that the vertex count is known
+    size_t numVerts = uniqueCorners.size();
+    bool hasTexCoords = ! texCoords.empty();
+    bool hasTangents = ! tangents.empty();
+
+    data.points.resize(numVerts * 3);
+    data.normals.resize(numVerts * 3);
+    if( hasTexCoords ) data.texCoords.resize(numVerts * 2);
+    if( hasTangents ) data.tangents.resize(numVerts * 4);
+
+    Parallel::forRange(numVerts, [&](size_t begin, size_t end) {
+        for( size_t v = begin; v < end; v++ ) {
+            const auto & vert = faces[uniqueCorners[v]];
 
             auto & pt = points[ vert.pIdx ];
-            data.points.push_back( pt.x );
-            data.points.push_back( pt.y );
-            data.points.push_back( pt.z );
+            data.points[v * 3 + 0] = pt.x;
+            data.points[v * 3 + 1] = pt.y;
+            data.points[v * 3 + 2] = pt.z;
 
             auto & n = normals[ vert.nIdx ];
-            data.normals.push_back( n.x );
-            data.normals.push_back( n.y );
-            data.normals.push_back( n.z );
+            data.normals[v * 3 + 0] = n.x;
+            data.normals[v * 3 + 1] = n.y;
+            data.normals[v * 3 + 2] = n.z;
 
-            if( ! texCoords.empty() ) {
+            if( hasTexCoords ) {
                 auto & tc = texCoords[ vert.tcIdx ];
-                data.texCoords.push_back( tc.x );
-                data.texCoords.push_back( tc.y );
+                data.texCoords[v * 2 + 0] = tc.x;
+                data.texCoords[v * 2 + 1] = tc.y;
             }
 
-            if( ! tangents.empty() ) {
+            if( hasTangents ) {
                 // We use the point index for tangents
                 auto & tang = tangents[ vert.pIdx ];
-                data.tangents.push_back( tang.x );
-                data.tangents.push_back( tang.y );
-                data.tangents.push_back( tang.z );
-                data.tangents.push_back( tang.w );
+                data.tangents[v * 4 + 0] = tang.x;
+                data.tangents[v * 4 + 1] = tang.y;
+                data.tangents[v * 4 + 2] = tang.z;
+                data.tangents[v * 4 + 3] = tang.w;
             }
+        }
+    });
+}
+
+namespace {
+    // Full attribute set of a GL vertex, compared bit for bit when welding
+    struct WeldVertex {
+        GLfloat values[12];
+    };
 
-            data.faces.push_back((GLuint)vIdx);
-            vertexMap[vertStr] = (GLuint)vIdx;
-        } else {
-            data.faces.push_back(it->second);
+    // Hash and compare welding candidates by their index into the vertex array
+    struct WeldHash {
+        const WeldVertex * vertices;
+        size_t operator()(GLuint i) const { return (size_t)hashBytes64(vertices[i].values, sizeof(WeldVertex)); }
+    };
+
+    struct WeldEqual {
+        const WeldVertex * vertices;
+        bool operator()(GLuint a, GLuint b) const {
+            return memcmp(vertices[a].values, vertices[b].values, sizeof(WeldVertex)) == 0;
         }
+    };
+
+    // Any unit vector perpendicular to n, for corners without a usable UV gradient
+    glm::vec3 perpendicular(const glm::vec3 & n) {
+        glm::vec3 axis = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        return glm::normalize(glm::cross(n, axis));
     }
 }
 
-void ObjMesh::GlMeshData::convertFacesToAdjancencyFormat()
-{
-    // Elements with adjacency info
-    std::vector<GLuint> elAdj(faces.size() * 2);
-
-    // Copy and make room for adjacency info
-    for( GLuint i = 0; i < faces.size(); i+=3)
-    {
-        elAdj[i*2 + 0] = faces[i];
-        elAdj[i*2 + 1] = std::numeric_limits<GLuint>::max();
-        elAdj[i*2 + 2] = faces[i+1];
-        elAdj[i*2 + 3] = std::numeric_limits<GLuint>::max();
-        elAdj[i*2 + 4] = faces[i+2];
-        elAdj[i*2 + 5] = std::numeric_limits<GLuint>::max();
+void ObjMesh::GlMeshData::generateCornerTangents() {
+    if( texCoords.empty() ) {
+        LOG_WARN("Can't generate tangents for a mesh without texture coordinates");
+        return;
     }
 
-    // Find matching edges
-    for( GLuint i = 0; i < elAdj.size(); i+=6)
-    {
-        // A triangle
-        GLuint a1 = elAdj[i];
-        GLuint b1 = elAdj[i+2];
-        GLuint c1 = elAdj[i+4];
+    auto position = [this](GLuint v) { return glm::vec3(points[v * 3], points[v * 3 + 1], points[v * 3 + 2]); };
+    auto normal = [this](GLuint v) { return glm::vec3(normals[v * 3], normals[v * 3 + 1], normals[v * 3 + 2]); };
+    auto texCoord = [this](GLuint v) { return glm::vec2(texCoords[v * 2], texCoords[v * 2 + 1]); };
 
-        // Scan subsequent triangles
-        for(GLuint j = i+6; j < elAdj.size(); j+=6)
-        {
-            GLuint a2 = elAdj[j];
-            GLuint b2 = elAdj[j+2];
-            GLuint c2 = elAdj[j+4];
-
-            // Edge 1 == Edge 1
-            if( (a1 == a2 && b1 == b2) || (a1 == b2 && b1 == a2) )
-            {
-                elAdj[i+1] = c2;
-                elAdj[j+1] = c1;
-            }
-            // Edge 1 == Edge 2
-            if( (a1 == b2 && b1 == c2) || (a1 == c2 && b1 == b2) )
-            {
-                elAdj[i+1] = a2;
-                elAdj[j+3] = c1;
-            }
-            // Edge 1 == Edge 3
-            if ( (a1 == c2 && b1 == a2) || (a1 == a2 && b1 == c2) )
-            {
-                elAdj[i+1] = b2;
-                elAdj[j+5] = c1;
-            }
-            // Edge 2 == Edge 1
-            if( (b1 == a2 && c1 == b2) || (b1 == b2 && c1 == a2) )
-            {
-                elAdj[i+3] = c2;
-                elAdj[j+1] = a1;
-            }
-            // Edge 2 == Edge 2
-            if( (b1 == b2 && c1 == c2) || (b1 == c2 && c1 == b2) )
-            {
-                elAdj[i+3] = a2;
-                elAdj[j+3] = a1;
-            }
-            // Edge 2 == Edge 3
-            if( (b1 == c2 && c1 == a2) || (b1 == a2 && c1 == c2) )
-            {
-                elAdj[i+3] = b2;
-                elAdj[j+5] = a1;
+    size_t nVerts = points.size() / 3;
+    size_t nCorners = faces.size();
+    size_t nFaces = nCorners / 3;
+
+    // Per corner: the face tangent projected into the vertex's tangent plane and weighted by
+    // the corner angle, plus the handedness of the face's UV mapping
+    std::vector<glm::vec3> cornerTangents(nCorners);
+    std::vector<float> cornerSigns(nCorners);
+
+    Parallel::forRange((nFaces + FaceBatch - 1) / FaceBatch, [&](size_t begin, size_t end) {
+        for( size_t batch = begin; batch < end; batch++ ) {
+            size_t f = batch * FaceBatch;
+            size_t count = std::min<size_t>(FaceBatch, nFaces - f);
+            auto corner = [&](GLuint k) {
+                return [&, k](size_t face) { return position(faces[face * 3 + k]); };
+            };
+            auto cornerTc = [&](GLuint k) {
+                return [&, k](size_t face) { return glm::vec3(texCoord(faces[face * 3 + k]), 0.0f); };
+            };
+            auto cornerNormal = [&](GLuint k) {
+                return [&, k](size_t face) { return normal(faces[face * 3 + k]); };
+            };
+            Vec3x4 p[3] = { gatherCorner(f, nFaces, corner(0)), gatherCorner(f, nFaces, corner(1)), gatherCorner(f, nFaces, corner(2)) };
+            Vec3x4 tc1 = gatherCorner(f, nFaces, cornerTc(0));
+            Vec3x4 tc2 = gatherCorner(f, nFaces, cornerTc(1));
+            Vec3x4 tc3 = gatherCorner(f, nFaces, cornerTc(2));
+
+            // Edge k runs from corner k to corner k + 1
+            Vec3x4 edges[3] = { p[1] - p[0], p[2] - p[1], p[0] - p[2] };
+            __m128 lengths[3] = { _mm_sqrt_ps(dot(edges[0], edges[0])), _mm_sqrt_ps(dot(edges[1], edges[1])), _mm_sqrt_ps(dot(edges[2], edges[2])) };
+
+            // Faces with a degenerate UV mapping contribute nothing
+            __m128 zero = _mm_setzero_ps();
+            __m128 s1 = _mm_sub_ps(tc2.x, tc1.x), s2 = _mm_sub_ps(tc3.x, tc1.x);
+            __m128 t1 = _mm_sub_ps(tc2.y, tc1.y), t2 = _mm_sub_ps(tc3.y, tc1.y);
+            __m128 det = _mm_sub_ps(_mm_mul_ps(s1, t2), _mm_mul_ps(s2, t1));
+            __m128 r = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_div_ps(_mm_set1_ps(1.0f), det));
+            Vec3x4 q1 = edges[0];
+            Vec3x4 q2 = p[2] - p[0];
+            Vec3x4 tan1 = (q1 * t2 - q2 * t1) * r;
+            Vec3x4 tan2 = (q2 * s1 - q1 * s2) * r;
+
+            for( GLuint k = 0; k < 3; k++ ) {
+                Vec3x4 n = gatherCorner(f, nFaces, cornerNormal(k));
+
+                // Corner angle, between the edges leaving corner k
+                GLuint prev = (k + 2) % 3;
+                __m128 lengthProduct = _mm_mul_ps(lengths[k], lengths[prev]);
+                float cosAngle[FaceBatch], hasAngle[FaceBatch];
+                _mm_storeu_ps(cosAngle, _mm_div_ps(_mm_sub_ps(zero, dot(edges[k], edges[prev])), lengthProduct));
+                _mm_storeu_ps(hasAngle, _mm_cmpgt_ps(lengthProduct, zero));
+                float angles[FaceBatch] = {};
+                for( size_t lane = 0; lane < count; lane++ ) {
+                    if( hasAngle[lane] != 0.0f ) angles[lane] = std::acos(std::clamp(cosAngle[lane], -1.0f, 1.0f));
+                }
+
+                // Project into the tangent plane, normalize and weight by the angle
+                Vec3x4 t = tan1 - n * dot(n, tan1);
+                __m128 len = _mm_sqrt_ps(dot(t, t));
+                __m128 scale = _mm_and_ps(_mm_cmpgt_ps(len, zero), _mm_div_ps(_mm_loadu_ps(angles), len));
+                __m128 sign = _mm_or_ps(_mm_set1_ps(1.0f), _mm_and_ps(_mm_cmplt_ps(dot(cross(n, tan1), tan2), zero), _mm_set1_ps(-0.0f)));
+
+                float x[FaceBatch], y[FaceBatch], z[FaceBatch], w[FaceBatch];
+                storeLanes(t * scale, x, y, z, count);
+                _mm_storeu_ps(w, sign);
+                for( size_t lane = 0; lane < count; lane++ ) {
+                    size_t c = (f + lane) * 3 + k;
+                    cornerTangents[c] = glm::vec3(x[lane], y[lane], z[lane]);
+                    cornerSigns[c] = w[lane];
+                }
             }
-            // Edge 3 == Edge 1
-            if( (c1 == a2 && a1 == b2) || (c1 == b2 && a1 == a2) )
-            {
-                elAdj[i+5] = c2;
-                elAdj[j+1] = b1;
+        }
+    }, MinFacesPerTask / FaceBatch);
+
+    std::vector<GLuint> vertStart, vertCorners;
+    buildCornerMap(nVerts, nCorners, [this](size_t c) { return faces[c]; }, vertStart, vertCorners);
+
+    // A vertex shared by faces of both handedness (mirrored UVs) is split in two,
+    // the right handed group first
+    std::vector<GLuint> groupStart(nVerts + 1, 0);
+    Parallel::forRange(nVerts, [&](size_t begin, size_t end) {
+        for( size_t v = begin; v < end; v++ ) {
+            bool right = false, left = false;
+            for( GLuint i = vertStart[v]; i < vertStart[v + 1]; i++ ) {
+                if( cornerSigns[vertCorners[i]] > 0.0f ) right = true;
+                else left = true;
             }
-            // Edge 3 == Edge 2
-            if( (c1 == b2 && a1 == c2) || (c1 == c2 && a1 == b2) )
-            {
-                elAdj[i+5] = a2;
-                elAdj[j+3] = b1;
+            groupStart[v + 1] = (right && left) ? 2 : 1;
+        }
+    }, MinFacesPerTask);
+    for( size_t v = 1; v <= nVerts; v++ ) groupStart[v] += groupStart[v - 1];
+
+    size_t nGroups = groupStart[nVerts];
+    std::vector<WeldVertex> groups(nGroups);
+    std::vector<GLuint> cornerGroup(nCorners);
+
+    Parallel::forRange(nVerts, [&](size_t begin, size_t end) {
+        for( size_t v = begin; v < end; v++ ) {
+            GLuint first = groupStart[v];
+            bool split = groupStart[v + 1] - first == 2;
+            glm::vec3 n = normal((GLuint)v);
+            glm::vec3 sum[2] = { glm::vec3(0.0f), glm::vec3(0.0f) };
+            float sign[2] = { 1.0f, -1.0f };
+
+            for( GLuint i = vertStart[v]; i < vertStart[v + 1]; i++ ) {
+                GLuint c = vertCorners[i];
+                int g = (split && cornerSigns[c] < 0.0f) ? 1 : 0;
+                if( !split ) sign[0] = cornerSigns[c];
+                sum[g] += cornerTangents[c];
+                cornerGroup[c] = first + g;
             }
-            // Edge 3 == Edge 3
-            if( (c1 == c2 && a1 == a2) || (c1 == a2 && a1 == c2) )
-            {
-                elAdj[i+5] = b2;
-                elAdj[j+5] = b1;
+
+            for( GLuint g = 0; g < groupStart[v + 1] - first; g++ ) {
+                float len = glm::length(sum[g]);
+                glm::vec3 t = (len > 0.0f) ? sum[g] / len : perpendicular(n);
+                glm::vec3 p = position((GLuint)v);
+                glm::vec2 tc = texCoord((GLuint)v);
+                groups[first + g] = WeldVertex{ { p.x, p.y, p.z, n.x, n.y, n.z, tc.x, tc.y, t.x, t.y, t.z, sign[g] } };
             }
         }
+    }, MinFacesPerTask);
+
+    // Weld groups with identical attributes, numbering vertices by first appearance
+    OpenHashTable<GLuint, GLuint, WeldHash, WeldEqual> welded(nGroups, WeldHash{ groups.data() }, WeldEqual{ groups.data() });
+    std::vector<GLuint> groupVertex(nGroups);
+    std::vector<GLuint> vertexGroup;
+    vertexGroup.reserve(nGroups);
+    for( GLuint g = 0; g < nGroups; g++ ) {
+        auto result = welded.insert(g, (GLuint)vertexGroup.size());
+        if( result.second ) vertexGroup.push_back(g);
+        groupVertex[g] = result.first;
     }
 
-    // Look for any outside edges
-    for( GLuint i = 0; i < elAdj.size(); i+=6)
+    size_t nWelded = vertexGroup.size();
+    points.resize(nWelded * 3);
+    normals.resize(nWelded * 3);
+    texCoords.resize(nWelded * 2);
+    tangents.resize(nWelded * 4);
+
+    Parallel::forRange(nWelded, [&](size_t begin, size_t end) {
+        for( size_t w = begin; w < end; w++ ) {
+            const GLfloat * values = groups[vertexGroup[w]].values;
+            std::copy(values, values + 3, &points[w * 3]);
+            std::copy(values + 3, values + 6, &normals[w * 3]);
+            std::copy(values + 6, values + 8, &texCoords[w * 2]);
+            std::copy(values + 8, values + 12, &tangents[w * 4]);
+        }
+    }, MinFacesPerTask);
+
+    Parallel::forRange(nCorners, [&](size_t begin, size_t end) {
+        for( size_t c = begin; c < end; c++ ) faces[c] = groupVertex[cornerGroup[c]];
+    }, MinFacesPerTask);
+
+    LOG_INFO("Per-corner tangents: {} vertices -> {} tangent groups -> {} after welding", nVerts, nGroups, nWelded);
+}
+
+namespace {
+    // The two highest half-edges (3 * triangle + edge) seen on an undirected edge,
+    // from two different triangles
+    struct EdgeUsers {
+        GLuint best;
+        GLuint second;
+    };
+
+    struct EdgeKeyHash {
+        size_t operator()(uint64_t key) const { return (size_t)hashMix64(key); }
+    };
+
+    const GLuint NoHalfEdge = std::numeric_limits<GLuint>::max();
+}
+
+void ObjMesh::GlMeshData::convertFacesToAdjancencyFormat()
+{
+    // Each edge slot gets the vertex opposite to the shared edge in a neighbouring triangle.
+    // When several triangles share the edge, the one with the highest (triangle, edge) index
+    // wins, and boundary edges fall back to the triangle's own opposite vertex.
+    GLuint nHalfEdges = (GLuint)faces.size();
+
+    auto edgeKey = [this](GLuint h) {
+        GLuint first = h - h % 3;
+        GLuint v0 = faces[h];
+        GLuint v1 = faces[first + (h + 1) % 3];
+        return v0 < v1 ? ((uint64_t)v0 << 32) | v1 : ((uint64_t)v1 << 32) | v0;
+    };
+
+    // One pass over the half-edges in increasing order, so every new user is the highest so far.
+    // The table only numbers the edges, users live in a dense array indexed by edge.
+    OpenHashTable<uint64_t, GLuint, EdgeKeyHash> edgeIds(faces.size() / 2);
+    std::vector<GLuint> edgeOf(nHalfEdges);
+    std::vector<EdgeUsers> users;
+    users.reserve(faces.size() / 2);
+    for( GLuint h = 0; h < nHalfEdges; h++ )
     {
-        if( elAdj[i+1] == std::numeric_limits<GLuint>::max() ) elAdj[i+1] = elAdj[i+4];
-        if( elAdj[i+3] == std::numeric_limits<GLuint>::max() ) elAdj[i+3] = elAdj[i];
-        if( elAdj[i+5] == std::numeric_limits<GLuint>::max() ) elAdj[i+5] = elAdj[i+2];
+        auto result = edgeIds.insert(edgeKey(h), (GLuint)users.size());
+        edgeOf[h] = result.first;
+        if( result.second ) {
+            users.push_back(EdgeUsers{ h, NoHalfEdge });
+            continue;
+        }
+
+        EdgeUsers & edge = users[result.first];
+        if( edge.best / 3 != h / 3 ) edge.second = edge.best;
+        edge.best = h;
     }
 
+    // Elements with adjacency info
+    std::vector<GLuint> elAdj(faces.size() * 2);
+
+    Parallel::forRange(nHalfEdges / 3, [&](size_t begin, size_t end) {
+        for( GLuint h = (GLuint)begin * 3; h < end * 3; h++ )
+        {
+            const EdgeUsers & edge = users[edgeOf[h]];
+            GLuint other = (edge.best / 3 != h / 3) ? edge.best : edge.second;
+            if( other == NoHalfEdge ) other = h;
+
+            GLuint otherFirst = other - other % 3;
+            elAdj[h * 2] = faces[h];
+            elAdj[h * 2 + 1] = faces[otherFirst + (other + 2) % 3];
+        }
+    });
+
     // Copy all data back into el
-    faces = elAdj;
+    faces = std::move(elAdj);
 }
 
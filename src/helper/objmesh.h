@@ -3,27 +3,96 @@
 #include "trianglemesh.h"
 #include <glad/glad.h>
 #include "aabb.h"
+#include "occlusionrasterizer.h"
 
 #include <vector>
 #include <glm/glm.hpp>
 #include <string>
 #include <memory>
+#include <atomic>
+#include <future>
+#include <functional>
 
 
 class ObjMesh : public TriangleMesh {
 private:
     bool drawAdj;
 
+    struct Staged;
+
 public:
+    struct LoadOptions {
+        bool center = false;
+        bool genTangents = false;
+        bool angleWeightedNormals = false;  // Weight face normals by corner angle when generating normals
+        // With genTangents: tangents per GL vertex instead of per position (see generateCornerTangents).
+        // Off by default, it takes about 3x as long; turn it on for meshes with UV seams or mirrored UVs.
+        bool perCornerTangents = false;
+        bool adjacency = false;   // Index buffer in GL_TRIANGLES_ADJACENCY format
+        bool optimize = false;    // Reorder for vertex cache and fetch locality (see MeshOptimizer), also on with TriangleMesh::optimizeBuffers
+        unsigned numThreads = 0;  // Parser threads, 0 uses every hardware thread
+        bool useCache = true;     // Load from / write to <fileName>.meshbin (see MeshCache)
+        bool keepOccluder = false;  // Keep the positions and triangles on the CPU for OcclusionRasterizer, not with adjacency
+        VertexFormat vertexFormat;  // GPU vertex layout, packed at upload so it isn't part of the cache key
+    };
+
     static std::unique_ptr<ObjMesh> load(const char * fileName, bool center = false, bool genTangents = false);
+    static std::unique_ptr<ObjMesh> load(const char * fileName, const LoadOptions & options);
     static std::unique_ptr<ObjMesh> loadWithAdjacency(const char * fileName, bool center = false);
 
+    // A load running on a worker thread. Parsing, normals, tangents, optimization and the cache
+    // all happen there, only the buffer upload is left for the GL thread.
+    class AsyncLoad {
+    public:
+        AsyncLoad(const char * fileName, const LoadOptions & options);
+        ~AsyncLoad();
+
+        // Bounds of the final mesh, known once the file is parsed or the cache header is read
+        bool hasBounds() const { return boundsReady.load(std::memory_order_acquire); }
+        const Aabb & bounds() const { return bbox; }
+
+        // Only the upload is left
+        bool isReady() const;
+
+        // Call on the GL thread: uploads and returns the mesh once it is ready, null before that and after
+        std::unique_ptr<ObjMesh> poll();
+
+        // The file couldn't be opened, poll() won't return a mesh
+        bool failed() const { return loadFailed; }
+
+    private:
+        std::future<std::unique_ptr<Staged>> staged;
+        std::atomic<bool> boundsReady = false;
+        bool loadFailed = false;
+        Aabb bbox;
+    };
+
+    static std::unique_ptr<AsyncLoad> loadAsync(const char * fileName, const LoadOptions & options);
+
     void render() const override;
+    void renderInstanced(const InstanceBuffer & instances, size_t first = 0, size_t count = ~size_t(0)) const override;
+
+    // Empty unless loaded with LoadOptions::keepOccluder
+    const OccluderMesh & getOccluder() const { return occluder; }
 
 protected:
     ObjMesh();
 
+    GLuint indicesPerPrimitive() const override { return drawAdj ? 6 : 3; }
+
     Aabb bbox;
+    OccluderMesh occluder;
+
+    void keepOccluder(std::span<const GLuint> indices, std::span<const GLfloat> points);
+
+    // Load steps: stage() needs no GL context, upload() runs on the GL thread.
+    // onBounds is called from stage() as soon as the bounding box is known.
+    // stage() returns null when the file can't be opened. It reads nothing the UI can change, so the
+    // caller folds TriangleMesh::optimizeBuffers into the options (see withGlobals).
+    static std::unique_ptr<Staged> stage(const char * fileName, const LoadOptions & options,
+                                         const std::function<void(const Aabb &)> & onBounds = nullptr);
+    static std::unique_ptr<ObjMesh> upload(Staged & staged);
+    static LoadOptions withGlobals(const LoadOptions & options);
 
     // Helper classes used for loading
     class GlMeshData {
@@ -43,12 +112,20 @@ protected:
         }
         void center(Aabb & bbox);
         void convertFacesToAdjancencyFormat();
+
+        // Tangents computed on the deduplicated vertices, so corners on different UV islands or
+        // with mirrored UVs get their own tangent. Vertices whose attributes end up identical are welded.
+        // Slower than ObjMeshData::generateTangents whatever the SIMD: the corner angles (a scalar acos
+        // each), the handedness grouping and the weld are work the per-position tangents never do.
+        void generateCornerTangents();
     };
 
     class ObjMeshData {
     public:
         class ObjVertex {
         public:
+            enum RelativeBits { REL_POSITION = 1, REL_TEXCOORD = 2, REL_NORMAL = 4 };
+
             int pIdx;
             int nIdx;
             int tcIdx;
@@ -59,10 +136,9 @@ protected:
                 tcIdx = -1;
             }
 
-            ObjVertex(std::string &vertString, ObjMeshData * mesh);
-            std::string str() {
-                return std::to_string(pIdx) + "/" + std::to_string(tcIdx) + "/" + std::to_string(nIdx);
-            }
+            // Parses a face corner token ("p", "p/t", "p//n" or "p/t/n")
+            // Bits of relativeMask flag the indices that were negative (relative) in the file
+            ObjVertex(const char * begin, const char * end, ObjMeshData * mesh, unsigned * relativeMask = nullptr);
         };
 
         std::vector <glm::vec3> points;
@@ -71,11 +147,24 @@ protected:
         std::vector <ObjVertex> faces;
         std::vector <glm::vec4> tangents;
 
+        // Face corners that used relative indices, as (corner, mask) pairs.
+        // Chunks parsed in parallel resolve these against their own lists and are rebased on merge.
+        std::vector <std::pair<size_t, unsigned>> relativeCorners;
+
         ObjMeshData() { }
 
-        void generateNormalsIfNeeded();
+        // Vertex to face corner map (CSR): corners of point v are
+        // vertexCorners[vertexCornerStart[v] .. vertexCornerStart[v + 1]), in face order
+        std::vector <GLuint> vertexCornerStart;
+        std::vector <GLuint> vertexCorners;
+
+        void buildVertexCorners();
+        void generateNormalsIfNeeded(bool angleWeighted = false);
         void generateTangents();
-        void load( const char * fileName, Aabb & bbox );
+        // False when the file can't be opened
+        bool load( const char * fileName, Aabb & bbox, unsigned numThreads = 1 );
+        void parse( const char * begin, const char * end, Aabb & bbox );
+        void parseParallel( const char * begin, const char * end, Aabb & bbox, unsigned numThreads );
         void toGlMesh(GlMeshData & data);
     };
 };
@@ -0,0 +1,420 @@
+#include "../pch.h"
+#include "occlusionrasterizer.h"
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define OCCLUSION_SSE 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Vertices closer to the eye plane than this are treated as behind it
+    const float MinW = 1e-5f;
+
+    // Clip space position, the four columns of the matrix scaled by x, y, z and 1
+    glm::vec4 transform(const glm::mat4& m, const glm::vec3& p)
+    {
+#if defined(OCCLUSION_SSE)
+        __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m[0][0]), _mm_set1_ps(p.x)), _mm_mul_ps(_mm_loadu_ps(&m[1][0]), _mm_set1_ps(p.y))),
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m[2][0]), _mm_set1_ps(p.z)), _mm_loadu_ps(&m[3][0])));
+        glm::vec4 result;
+        _mm_storeu_ps(&result[0], r);
+        return result;
+#else
+        return m * glm::vec4(p, 1.0f);
+#endif
+    }
+
+    // A pixel coordinate limited to [0, size], so it always fits an int
+    float clampTo(float value, int size)
+    {
+        return std::clamp(value, 0.0f, (float)size);
+    }
+
+    // Whether any depth in row[begin, end) is at or behind depth, so something there is not hidden
+    bool anyAtOrBehind(const float* row, int begin, int end, float depth)
+    {
+        int x = begin;
+#if defined(OCCLUSION_SSE)
+        for (; x < end && (x & 3) != 0; x++)
+        {
+            if (row[x] >= depth)
+                return true;
+        }
+
+        __m128 d = _mm_set1_ps(depth);
+        for (; x + 4 <= end; x += 4)
+        {
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), d)) != 0)
+                return true;
+        }
+#endif
+        for (; x < end; x++)
+        {
+            if (row[x] >= depth)
+                return true;
+        }
+        return false;
+    }
+}
+
+OccluderMesh OccluderMesh::box(const Aabb& box)
+{
+    OccluderMesh mesh;
+    for (int i = 0; i < 8; i++)
+    {
+        mesh.positions.push_back(glm::vec3((i & 1) ? box.max.x : box.min.x,
+                                           (i & 2) ? box.max.y : box.min.y,
+                                           (i & 4) ? box.max.z : box.min.z));
+    }
+
+    // Two counter-clockwise triangles per face, seen from outside
+    mesh.indices = {
+        0, 4, 6,  0, 6, 2,   // -x
+        1, 3, 7,  1, 7, 5,   // +x
+        0, 1, 5,  0, 5, 4,   // -y
+        2, 6, 7,  2, 7, 3,   // +y
+        0, 2, 3,  0, 3, 1,   // -z
+        4, 5, 7,  4, 7, 6,   // +z
+    };
+    return mesh;
+}
+
+OcclusionRasterizer::OcclusionRasterizer(int width, int height, unsigned threads)
+    : _threads(Parallel::workerCount(threads)), _pool(_threads)
+{
+    resize(width, height);
+}
+
+void OcclusionRasterizer::resize(int width, int height)
+{
+    _width = std::max(TileWidth, (width + TileWidth - 1) / TileWidth * TileWidth);
+    _height = std::max(TileHeight, (height + TileHeight - 1) / TileHeight * TileHeight);
+    _tilesX = _width / TileWidth;
+    _tilesY = _height / TileHeight;
+    _depth.assign(size_t(_width) * _height, 1.0f);
+    _tileMax.assign(size_t(_tilesX) * _tilesY, 1.0f);
+}
+
+void OcclusionRasterizer::begin(const glm::mat4& viewProjection)
+{
+    _viewProjection = viewProjection;
+    _occluders.clear();
+    std::fill(_depth.begin(), _depth.end(), 1.0f);
+    std::fill(_tileMax.begin(), _tileMax.end(), 1.0f);
+    _stats = Stats();
+}
+
+void OcclusionRasterizer::addOccluder(const OccluderMesh& mesh, const glm::mat4& model)
+{
+    if (!mesh.empty())
+        _occluders.push_back({ &mesh, model });
+}
+
+void OcclusionRasterizer::setup()
+{
+    _triangles.clear();
+    float halfWidth = 0.5f * _width;
+    float halfHeight = 0.5f * _height;
+
+    for (const Occluder& occluder : _occluders)
+    {
+        const OccluderMesh& mesh = *occluder.mesh;
+        glm::mat4 mvp = _viewProjection * occluder.model;
+
+        _clip.resize(mesh.positions.size());
+        _pool.forRange(mesh.positions.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                _clip[i] = transform(mvp, mesh.positions[i]);
+        }, 16384);
+
+        _stats.triangles += mesh.triangleCount();
+        for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+        {
+            glm::vec3 v[3];
+            bool behind = false;
+            for (int k = 0; k < 3; k++)
+            {
+                const glm::vec4& c = _clip[mesh.indices[t + k]];
+                behind |= c.w < MinW;
+                float invW = 1.0f / c.w;
+                v[k] = glm::vec3((c.x * invW + 1.0f) * halfWidth, (c.y * invW + 1.0f) * halfHeight, c.z * invW * 0.5f + 0.5f);
+            }
+            if (behind)
+                continue;
+
+            // Twice the signed area, positive for counter-clockwise (front facing) triangles
+            float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+            if (!(area > 0.0f))
+                continue;
+
+            // Clamped before the cast, vertices close to the eye plane land far outside the int range
+            Triangle tri;
+            tri.minX = (int)std::floor(clampTo(std::min({ v[0].x, v[1].x, v[2].x }), _width));
+            tri.maxX = (int)std::ceil(clampTo(std::max({ v[0].x, v[1].x, v[2].x }), _width));
+            tri.minY = (int)std::floor(clampTo(std::min({ v[0].y, v[1].y, v[2].y }), _height));
+            tri.maxY = (int)std::ceil(clampTo(std::max({ v[0].y, v[1].y, v[2].y }), _height));
+            if (tri.minX >= tri.maxX || tri.minY >= tri.maxY)
+                continue;
+
+            // Positive on the left of each edge, the inside of a counter-clockwise triangle
+            for (int k = 0; k < 3; k++)
+            {
+                const glm::vec3& a = v[k];
+                const glm::vec3& b = v[(k + 1) % 3];
+                tri.edgeA[k] = a.y - b.y;
+                tri.edgeB[k] = b.x - a.x;
+                tri.edgeC[k] = -(tri.edgeA[k] * a.x + tri.edgeB[k] * a.y);
+            }
+
+            // Depth is linear in screen space
+            tri.depthA = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+            tri.depthB = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+            tri.depthC = v[0].z - tri.depthA * v[0].x - tri.depthB * v[0].y;
+
+            _triangles.push_back(tri);
+        }
+    }
+
+    _stats.occluders = _occluders.size();
+    _stats.rasterized = _triangles.size();
+}
+
+void OcclusionRasterizer::rasterize(int tileRowBegin, int tileRowEnd)
+{
+    int bandBegin = tileRowBegin * TileHeight;
+    int bandEnd = tileRowEnd * TileHeight;
+
+    for (const Triangle& tri : _triangles)
+    {
+        int rowBegin = std::max(tri.minY, bandBegin);
+        int rowEnd = std::min(tri.maxY, bandEnd);
+        int columnBegin = tri.minX & ~3;   // Whole groups of 4, the edges mask the pixels outside
+
+        for (int y = rowBegin; y < rowEnd; y++)
+        {
+            float* row = &_depth[size_t(y) * _width];
+            float cy = y + 0.5f;
+
+#if defined(OCCLUSION_SSE)
+            __m128 edgeA[3], edgeRow[3];
+            for (int k = 0; k < 3; k++)
+            {
+                edgeA[k] = _mm_set1_ps(tri.edgeA[k]);
+                edgeRow[k] = _mm_set1_ps(tri.edgeB[k] * cy + tri.edgeC[k]);
+            }
+            __m128 depthA = _mm_set1_ps(tri.depthA);
+            __m128 depthRow = _mm_set1_ps(tri.depthB * cy + tri.depthC);
+            __m128 zero = _mm_setzero_ps();
+
+            for (int x = columnBegin; x < tri.maxX; x += 4)
+            {
+                // Pixel centers of the 4 columns
+                __m128 cx = _mm_add_ps(_mm_set1_ps((float)x), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[0], cx), edgeRow[0]), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[1], cx), edgeRow[1]), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[2], cx), edgeRow[2]), zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                __m128 depth = _mm_add_ps(_mm_mul_ps(depthA, cx), depthRow);
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearest = _mm_min_ps(old, depth);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+            }
+#else
+            for (int x = tri.minX; x < tri.maxX; x++)
+            {
+                float cx = x + 0.5f;
+                bool inside = true;
+                for (int k = 0; k < 3; k++)
+                    inside &= tri.edgeA[k] * cx + tri.edgeB[k] * cy + tri.edgeC[k] >= 0.0f;
+                if (inside)
+                    row[x] = std::min(row[x], tri.depthA * cx + tri.depthB * cy + tri.depthC);
+            }
+#endif
+        }
+    }
+
+    // Farthest depth of every tile in the band
+    for (int ty = tileRowBegin; ty < tileRowEnd; ty++)
+    {
+        for (int tx = 0; tx < _tilesX; tx++)
+        {
+            float farthest = 0.0f;
+            for (int y = ty * TileHeight; y < (ty + 1) * TileHeight; y++)
+            {
+                const float* row = &_depth[size_t(y) * _width + tx * TileWidth];
+#if defined(OCCLUSION_SSE)
+                __m128 m = _mm_max_ps(_mm_loadu_ps(row), _mm_loadu_ps(row + 4));
+                m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+                m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+                farthest = std::max(farthest, _mm_cvtss_f32(m));
+#else
+                farthest = std::max(farthest, *std::max_element(row, row + TileWidth));
+#endif
+            }
+            _tileMax[size_t(ty) * _tilesX + tx] = farthest;
+        }
+    }
+}
+
+void OcclusionRasterizer::render()
+{
+    auto start = std::chrono::steady_clock::now();
+    setup();
+
+    // One band of tile rows per thread, no two threads write the same pixel
+    unsigned bands = std::min<unsigned>(_threads, (unsigned)_tilesY);
+    _pool.forEachTask(bands, [&](unsigned band) {
+        rasterize(_tilesY * band / bands, _tilesY * (band + 1) / bands);
+    });
+
+    _stats.renderMs = Benchmark::elapsedMs(start);
+}
+
+bool OcclusionRasterizer::isVisible(const Aabb& worldBox) const
+{
+    float minX = std::numeric_limits<float>::max(), minY = minX;
+    float maxX = -minX, maxY = -minX;
+    float nearest = minX;
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec3 corner((i & 1) ? worldBox.max.x : worldBox.min.x,
+                         (i & 2) ? worldBox.max.y : worldBox.min.y,
+                         (i & 4) ? worldBox.max.z : worldBox.min.z);
+        glm::vec4 c = transform(_viewProjection, corner);
+        if (c.w < MinW)
+            return true;
+
+        float invW = 1.0f / c.w;
+        float x = (c.x * invW + 1.0f) * 0.5f * _width;
+        float y = (c.y * invW + 1.0f) * 0.5f * _height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, c.z * invW * 0.5f + 0.5f);
+    }
+
+    if (maxX <= 0.0f || minX >= _width || maxY <= 0.0f || minY >= _height)
+        return true;
+
+    // Every pixel the rectangle touches, clamped before the cast like the triangle bounds
+    int x0 = (int)std::floor(clampTo(minX, _width));
+    int x1 = std::min(_width, std::max(x0 + 1, (int)std::ceil(clampTo(maxX, _width))));
+    int y0 = (int)std::floor(clampTo(minY, _height));
+    int y1 = std::min(_height, std::max(y0 + 1, (int)std::ceil(clampTo(maxY, _height))));
+
+    for (int ty = y0 / TileHeight; ty <= (y1 - 1) / TileHeight; ty++)
+    {
+        for (int tx = x0 / TileWidth; tx <= (x1 - 1) / TileWidth; tx++)
+        {
+            // The whole tile is in front of the box
+            if (_tileMax[size_t(ty) * _tilesX + tx] < nearest)
+                continue;
+
+            int rowBegin = std::max(y0, ty * TileHeight), rowEnd = std::min(y1, (ty + 1) * TileHeight);
+            int columnBegin = std::max(x0, tx * TileWidth), columnEnd = std::min(x1, (tx + 1) * TileWidth);
+            for (int y = rowBegin; y < rowEnd; y++)
+            {
+                if (anyAtOrBehind(&_depth[size_t(y) * _width], columnBegin, columnEnd, nearest))
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+void OcclusionRasterizer::test(std::span<const Aabb> worldBoxes, std::vector<uint32_t>& visible)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Each range keeps its own list, appended in order afterwards
+    unsigned ranges = (unsigned)std::min<size_t>(_threads, (worldBoxes.size() + 1023) / 1024);
+    std::vector<std::vector<uint32_t>> rangeVisible(std::max(ranges, 1u));
+    _pool.forEachTask(ranges, [&](unsigned range) {
+        size_t begin = worldBoxes.size() * range / ranges;
+        size_t end = worldBoxes.size() * (range + 1) / ranges;
+        for (size_t i = begin; i < end; i++)
+        {
+            if (isVisible(worldBoxes[i]))
+                rangeVisible[range].push_back(uint32_t(i));
+        }
+    });
+
+    size_t before = visible.size();
+    for (const std::vector<uint32_t>& indices : rangeVisible)
+        visible.insert(visible.end(), indices.begin(), indices.end());
+
+    _stats.tested += worldBoxes.size();
+    _stats.occluded += worldBoxes.size() - (visible.size() - before);
+    _stats.testMs += Benchmark::elapsedMs(start);
+}
+
+OcclusionRasterizer::BenchmarkResult OcclusionRasterizer::benchmark(size_t occluders, size_t tests, int runs)
+{
+    // Walls in front of a camera at the origin looking down -z, small boxes scattered behind them
+    std::mt19937 rng = Benchmark::random();
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> wallDistance(5.0f, 30.0f);
+    std::uniform_real_distribution<float> wallSize(1.0f, 6.0f);
+
+    Aabb unit;
+    unit.min = glm::vec3(-0.5f);
+    unit.max = glm::vec3(0.5f);
+    OccluderMesh unitBox = OccluderMesh::box(unit);
+
+    std::vector<glm::mat4> walls(occluders);
+    for (glm::mat4& wall : walls)
+    {
+        float z = -wallDistance(rng);
+        glm::vec3 center(offset(rng) * -z * 0.8f, offset(rng) * -z * 0.5f, z);
+        wall = glm::scale(glm::translate(glm::mat4(1.0f), center), glm::vec3(wallSize(rng), wallSize(rng), 0.2f));
+    }
+
+    std::vector<Aabb> boxes = Benchmark::randomBoxesInView(rng, tests, 5.0f, 80.0f, 0.7f, 0.4f, 0.1f, 1.0f);
+
+    glm::mat4 viewProjection = Benchmark::viewProjection(100.0f);
+
+    OcclusionRasterizer rasterizer;
+    BenchmarkResult result;
+    result.occluders = occluders;
+    result.triangles = occluders * unitBox.triangleCount();
+    result.tests = tests;
+    result.renderMs = result.testMs = std::numeric_limits<double>::max();
+
+    std::vector<uint32_t> visible;
+    visible.reserve(tests);
+    for (int run = 0; run < runs; run++)
+    {
+        rasterizer.begin(viewProjection);
+        for (const glm::mat4& wall : walls)
+            rasterizer.addOccluder(unitBox, wall);
+        rasterizer.render();
+
+        visible.clear();
+        rasterizer.test(boxes, visible);
+
+        result.renderMs = std::min(result.renderMs, rasterizer.stats().renderMs);
+        result.testMs = std::min(result.testMs, rasterizer.stats().testMs);
+        result.occluded = rasterizer.stats().occluded;
+    }
+
+    result.occludersPerMs = occluders / std::max(result.renderMs, 1e-6);
+    result.testsPerMs = tests / std::max(result.testMs, 1e-6);
+
+    LOG_INFO("Software occlusion {}x{} on {} threads: {} occluders ({} triangles) in {:.3f} ms ({:.0f} per ms), "
+        "{} tests in {:.3f} ms ({:.0f} per ms), {} occluded",
+        rasterizer.width(), rasterizer.height(), rasterizer._threads, result.occluders, result.triangles, result.renderMs,
+        result.occludersPerMs, result.tests, result.testMs, result.testsPerMs, result.occluded);
+    return result;
+}
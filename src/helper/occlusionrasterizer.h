@@ -0,0 +1,130 @@
+#pragma once
+
+#include "aabb.h"
+#include "parallel.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Triangles of an occluder in object space, kept on the CPU for OcclusionRasterizer.
+// Counter-clockwise triangles face out, like GL's default front face.
+struct OccluderMesh
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+
+    bool empty() const { return indices.empty(); }
+    size_t triangleCount() const { return indices.size() / 3; }
+
+    // The 12 triangles of a box
+    static OccluderMesh box(const Aabb& box);
+};
+
+// Occlusion culling on the CPU against a small software depth buffer, without any GPU.
+//
+// A frame draws a few occluders into a low resolution float depth buffer, nearest depth per pixel in
+// the [0, 1] range of GL's default depth range, then tests boxes against it. render() transforms
+// the vertices and sets up the front facing triangles once, then every thread rasterizes the triangles
+// over its own band of tile rows, 4 pixels at a time with SSE. Each band then keeps the farthest depth
+// of each TileWidth x TileHeight tile, so a box test skips every tile whose farthest depth is in front
+// of the box's nearest point, and only reads the pixels of the other tiles.
+//
+// The threads are kept in a pool for the rasterizer's lifetime, so a frame doesn't pay for creating them.
+//
+// Triangles reaching behind the eye are dropped, which only ever lets more boxes through.
+class OcclusionRasterizer
+{
+public:
+    static const int TileWidth = 8;
+    static const int TileHeight = 8;
+
+    struct Stats
+    {
+        size_t occluders = 0;
+        size_t triangles = 0;      // Of the occluders
+        size_t rasterized = 0;     // Front facing and in front of the eye
+        double renderMs = 0.0;
+
+        size_t tested = 0;
+        size_t occluded = 0;
+        double testMs = 0.0;
+    };
+
+    struct BenchmarkResult
+    {
+        size_t occluders = 0;
+        size_t triangles = 0;
+        size_t tests = 0;
+        size_t occluded = 0;
+        double renderMs = 0.0;     // Best of the runs
+        double testMs = 0.0;
+        double occludersPerMs = 0.0;
+        double testsPerMs = 0.0;
+    };
+
+    // The width is rounded up to whole tiles. threads 0 uses every hardware thread.
+    explicit OcclusionRasterizer(int width = 320, int height = 192, unsigned threads = 0);
+
+    void resize(int width, int height);
+
+    // Clears the depth and the occluder list
+    void begin(const glm::mat4& viewProjection);
+
+    // The mesh is read by render(), it must live until then
+    void addOccluder(const OccluderMesh& mesh, const glm::mat4& model);
+
+    void render();
+
+    // False when an occluder is in front of the box's nearest point over its whole screen rectangle.
+    // Boxes reaching behind the eye or off the screen are visible, frustum culling is left to the caller.
+    bool isVisible(const Aabb& worldBox) const;
+
+    // Appends the indices of the visible boxes, in order. Runs on the worker threads.
+    void test(std::span<const Aabb> worldBoxes, std::vector<uint32_t>& visible);
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    const Stats& stats() const { return _stats; }
+
+    // Depth of a pixel, row 0 at the bottom like GL
+    float depth(int x, int y) const { return _depth[size_t(y) * _width + x]; }
+
+    // Renders that many box occluders in front of a camera, then tests random boxes behind them, and logs the rates
+    static BenchmarkResult benchmark(size_t occluders = 500, size_t tests = 1000000, int runs = 5);
+
+private:
+    struct Occluder
+    {
+        const OccluderMesh* mesh;
+        glm::mat4 model;
+    };
+
+    // A front facing triangle in pixels, with its edge functions and depth plane
+    struct Triangle
+    {
+        float edgeA[3], edgeB[3], edgeC[3];   // Inside where edgeA * x + edgeB * y + edgeC >= 0 for all three
+        float depthA, depthB, depthC;          // depth = depthA * x + depthB * y + depthC
+        int minX, maxX, minY, maxY;            // Pixel bounds, max exclusive
+    };
+
+    void setup();
+    void rasterize(int tileRowBegin, int tileRowEnd);
+
+    int _width = 0;
+    int _height = 0;
+    int _tilesX = 0;
+    int _tilesY = 0;
+    unsigned _threads;
+    Parallel::WorkerPool _pool;
+
+    glm::mat4 _viewProjection = glm::mat4(1.0f);
+    std::vector<float> _depth;       // Row major, row 0 at the bottom
+    std::vector<float> _tileMax;     // Farthest depth of every tile
+
+    std::vector<Occluder> _occluders;
+    std::vector<glm::vec4> _clip;    // Clip space vertices of the occluder being set up
+    std::vector<Triangle> _triangles;
+    Stats _stats;
+};
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Minimal fork-join helpers on top of std::thread.
+// The calling thread always runs the first task itself, so a single task never spawns a thread.
+// forEachTask and forRange create their threads on every call, which suits one-off work such as loading.
+// Work that repeats every frame goes through a WorkerPool instead.
+namespace Parallel
+{
+    // Number of threads to use for a request, 0 means one per hardware thread
+    inline unsigned workerCount(unsigned requested = 0)
+    {
+        if (requested != 0)
+            return requested;
+
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Runs fn(task) for every task in [0, numTasks) and waits for all of them
+    template<typename F>
+    void forEachTask(unsigned numTasks, F&& fn)
+    {
+        if (numTasks == 0)
+            return;
+
+        std::vector<std::thread> threads;
+        threads.reserve(numTasks - 1);
+
+        for (unsigned task = 1; task < numTasks; task++)
+            threads.emplace_back([&fn, task]() { fn(task); });
+
+        fn(0u);
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    // Splits [0, count) into contiguous ranges of at least minRange items, one per worker,
+    // and runs fn(begin, end) for each of them
+    template<typename F>
+    void forRange(size_t count, F&& fn, size_t minRange = 4096, unsigned maxWorkers = 0)
+    {
+        if (count == 0)
+            return;
+
+        size_t numRanges = std::min<size_t>(workerCount(maxWorkers), (count + minRange - 1) / std::max<size_t>(minRange, 1));
+        numRanges = std::max<size_t>(numRanges, 1);
+
+        forEachTask((unsigned)numRanges, [&](unsigned task)
+        {
+            size_t begin = count * task / numRanges;
+            size_t end = count * (task + 1) / numRanges;
+            fn(begin, end);
+        });
+    }
+
+    // Threads that live as long as the pool and wait for work, so a run only wakes them.
+    // The calling thread takes tasks too. One thread at a time may run work on a pool.
+    class WorkerPool
+    {
+    public:
+        // threads counts the calling thread, 0 means one per hardware thread
+        explicit WorkerPool(unsigned threads = 0)
+        {
+            unsigned workers = workerCount(threads) - 1;
+            _workers.reserve(workers);
+            for (unsigned i = 0; i < workers; i++)
+                _workers.emplace_back([this]() { work(); });
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_all();
+            for (auto& worker : _workers)
+                worker.join();
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        unsigned size() const { return (unsigned)_workers.size() + 1; }
+
+        // Runs fn(task) for every task in [0, numTasks) and waits for all of them
+        template<typename F>
+        void forEachTask(unsigned numTasks, F&& fn)
+        {
+            if (numTasks == 0)
+                return;
+
+            if (numTasks == 1 || _workers.empty())
+            {
+                for (unsigned task = 0; task < numTasks; task++)
+                    fn(task);
+                return;
+            }
+
+            std::function<void(unsigned)> job = [&fn](unsigned task) { fn(task); };
+            {
+                // A worker still leaving the last run must not pick up this one half set
+                std::unique_lock<std::mutex> lock(_mutex);
+                _done.wait(lock, [this]() { return _active == 0; });
+                _job = &job;
+                _numTasks = numTasks;
+                _nextTask = 0;
+                _doneTasks = 0;
+                _generation++;
+            }
+            _wake.notify_all();
+
+            runTasks();
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [this]() { return _doneTasks == _numTasks && _active == 0; });
+            _job = nullptr;
+        }
+
+        // Splits [0, count) into contiguous ranges of at least minRange items, one per thread of the pool,
+        // and runs fn(begin, end) for each of them
+        template<typename F>
+        void forRange(size_t count, F&& fn, size_t minRange = 4096)
+        {
+            if (count == 0)
+                return;
+
+            size_t numRanges = std::min<size_t>(size(), (count + minRange - 1) / std::max<size_t>(minRange, 1));
+            numRanges = std::max<size_t>(numRanges, 1);
+
+            forEachTask((unsigned)numRanges, [&](unsigned task)
+            {
+                size_t begin = count * task / numRanges;
+                size_t end = count * (task + 1) / numRanges;
+                fn(begin, end);
+            });
+        }
+
+    private:
+        void work()
+        {
+            unsigned seen = 0;
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait(lock, [&]() { return _stop || _generation != seen; });
+                    if (_stop)
+                        return;
+                    seen = _generation;
+                    _active++;
+                }
+
+                runTasks();
+
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _active--;
+                }
+                _done.notify_all();
+            }
+        }
+
+        // Takes tasks until none are left
+        void runTasks()
+        {
+            for (;;)
+            {
+                unsigned task = _nextTask.fetch_add(1);
+                if (task >= _numTasks)
+                    return;
+
+                (*_job)(task);
+                _doneTasks.fetch_add(1);
+            }
+        }
+
+        std::vector<std::thread> _workers;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+
+        // Set under the mutex while no worker is active
+        const std::function<void(unsigned)>* _job = nullptr;
+        unsigned _numTasks = 0;
+        unsigned _generation = 0;
+        unsigned _active = 0;
+        bool _stop = false;
+
+        std::atomic<unsigned> _nextTask{ 0 };
+        std::atomic<unsigned> _doneTasks{ 0 };
+    };
+}
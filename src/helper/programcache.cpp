@@ -0,0 +1,172 @@
+#include "../pch.h"
+#include "programcache.h"
+#include "mappedfile.h"
+#include "hashtable.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+    const char CacheMagic[8] = { 'P', 'R', 'O', 'G', 'B', 'I', 'N', '\0' };
+    const uint32_t CacheVersion = 2;
+
+    std::string glString(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? reinterpret_cast<const char*>(value) : "";
+    }
+}
+
+std::string ProgramCache::cacheFileName(const char* sourceFile)
+{
+    return std::string(sourceFile) + ".progbin";
+}
+
+bool ProgramCache::queryDriver()
+{
+    if (_queried)
+        return _supported;
+    _queried = true;
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    std::string renderer = glString(GL_RENDERER);
+    std::string version = glString(GL_VERSION);
+
+    _supported = formats > 0 && !renderer.empty();
+    _driverHash = hashBytes64(renderer.data(), renderer.size(), hashBytes64(version.data(), version.size()));
+
+    if (_supported)
+        LOG_INFO("Program cache: {} binary formats on {} ({})", formats, renderer, version);
+    else
+        LOG_WARN("Program cache: the driver has no program binary formats, every program is compiled");
+    return _supported;
+}
+
+bool ProgramCache::enabled()
+{
+    return _enabled && queryDriver();
+}
+
+uint64_t ProgramCache::key(const std::string& source, GLenum stage, bool separable)
+{
+    queryDriver();
+    uint64_t flags = ((uint64_t)stage << 1) | (separable ? 1 : 0);
+    return hashMix64(hashBytes64(source.data(), source.size(), _driverHash) ^ hashMix64(flags));
+}
+
+bool ProgramCache::load(const char* sourceFile, uint64_t key, GLuint program)
+{
+    if (!enabled())
+        return false;
+
+    auto start = std::chrono::steady_clock::now();
+    std::string cacheFile = cacheFileName(sourceFile);
+
+    MappedFile file;
+    if (!file.open(cacheFile.c_str()))
+        return false;
+
+    // A different key is an edited shader or another driver, the next write replaces the file
+    const Header* header = reinterpret_cast<const Header*>(file.data());
+    if (file.size() < sizeof(Header) ||
+        memcmp(header->magic, CacheMagic, sizeof(CacheMagic)) != 0 ||
+        header->version != CacheVersion ||
+        header->key != key ||
+        header->size != file.size() - sizeof(Header))
+    {
+        return false;
+    }
+
+    glProgramBinary(program, header->format, file.data() + sizeof(Header), (GLsizei)header->size);
+    double compileMs = header->compileMs;
+    file.close();
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE)
+    {
+        // Clear the error an unknown format raises, the caller compiles from source instead
+        while (glGetError() != GL_NO_ERROR) {}
+
+        LOG_WARN("Program cache: the driver rejected {}, compiling it again", cacheFile);
+        std::error_code ec;
+        std::filesystem::remove(cacheFile, ec);
+        _stats.rejected++;
+        return false;
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    _stats.loaded++;
+    _stats.loadMs += ms;
+    _stats.savedMs += std::max(0.0, compileMs - ms);
+    return true;
+}
+
+bool ProgramCache::write(const char* sourceFile, uint64_t key, GLuint program, double compileMs)
+{
+    _stats.compiled++;
+    _stats.compileMs += compileMs;
+    if (!enabled())
+        return false;
+
+    std::string cacheFile = cacheFileName(sourceFile);
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+    {
+        LOG_WARN("Unable to write program cache {}: the driver returned no binary", cacheFile);
+        return false;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    Header header{};
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version = CacheVersion;
+    header.format = format;
+    header.key = key;
+    header.size = (uint64_t)length;
+    header.compileMs = compileMs;
+
+    // Write to a temporary file and rename it, so a crash never leaves a truncated cache behind
+    std::string tempFile = cacheFile + ".tmp";
+    {
+        std::ofstream out(tempFile, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            LOG_WARN("Unable to write program cache: {}", cacheFile);
+            return false;
+        }
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), length);
+
+        if (!out)
+        {
+            LOG_WARN("Unable to write program cache: {}", cacheFile);
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(tempFile, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempFile, cacheFile, ec);
+    if (ec)
+    {
+        LOG_WARN("Unable to write program cache {}: {}", cacheFile, ec.message());
+        std::filesystem::remove(tempFile, ec);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+
+// Linked program binaries stored next to their shader source as <source>.progbin.
+// A valid cache is handed to glProgramBinary, so a warm start compiles and links nothing.
+//
+// The key hashes the source as passed to the compiler, the stage, the separable flag and the
+// driver's GL_RENDERER and GL_VERSION, so editing a shader or updating the driver misses and the
+// next write replaces the file. Binaries the driver rejects are deleted and compiled again.
+class ProgramCache
+{
+public:
+    struct Stats
+    {
+        size_t loaded = 0;
+        size_t compiled = 0;
+        size_t rejected = 0;
+        double loadMs = 0.0;
+        double compileMs = 0.0;    // Compile and link of the programs that missed
+        double savedMs = 0.0;      // What the loaded programs took to compile when they were cached, an estimate
+                                   // for programs built in a batch (see ShaderManager::CreatePrograms)
+    };
+
+    static std::string cacheFileName(const char* sourceFile);
+
+    // False when disabled, or without a context, or the driver has no binary formats
+    bool enabled();
+    void setEnabled(bool enabled) { _enabled = enabled; }
+
+    uint64_t key(const std::string& source, GLenum stage, bool separable);
+
+    // Loads the cached binary of sourceFile into program, false if it is missing, stale or rejected.
+    // A rejected program is left unlinked, it has to be created again before compiling.
+    bool load(const char* sourceFile, uint64_t key, GLuint program);
+
+    // Writes the binary of a linked program, which needs GL_PROGRAM_BINARY_RETRIEVABLE_HINT set before
+    // linking. compileMs is stored for the saved time of later loads. Failures only log a warning.
+    bool write(const char* sourceFile, uint64_t key, GLuint program, double compileMs);
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t format;       // Binary format from glGetProgramBinary
+        uint64_t key;
+        uint64_t size;         // Bytes of binary after the header
+        double compileMs;
+    };
+
+    // GL_RENDERER and GL_VERSION, read once there is a context
+    bool queryDriver();
+
+    bool _enabled = true;
+    bool _queried = false;
+    bool _supported = false;
+    uint64_t _driverHash = 0;
+    Stats _stats;
+};
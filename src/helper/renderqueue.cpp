@@ -0,0 +1,151 @@
+#include "../pch.h"
+#include "renderqueue.h"
+#include "glstate.h"
+
+namespace
+{
+    const int PipelineBits = 4;
+    const int ProgramBits = 6;
+    const int TextureSetBits = 12;
+    const int DrawableBits = 18;
+    const int DepthBits = 24;
+
+    static_assert(PipelineBits + ProgramBits + TextureSetBits + DrawableBits + DepthBits == 64);
+
+    // Id for a value, new values get the next one. Ids past the field width wrap,
+    // which only costs sorting quality: execute() compares the real state.
+    template<typename Map, typename Value>
+    uint64_t fieldId(Map& ids, const Value& value, int bits)
+    {
+        auto it = ids.find(value);
+        if (it == ids.end())
+            it = ids.emplace(value, uint64_t(ids.size())).first;
+        return it->second & ((uint64_t(1) << bits) - 1);
+    }
+}
+
+void RenderQueue::begin(const glm::mat4& view, float farPlane)
+{
+    _view = view;
+    _far = farPlane;
+    _packets.clear();
+    _keys.clear();
+}
+
+void RenderQueue::submit(const Packet& packet)
+{
+    _keys.push_back(makeKey(packet));
+    _packets.push_back(packet);
+}
+
+uint64_t RenderQueue::makeKey(const Packet& packet)
+{
+    // Eye space looks down -z, nearer packets get smaller depths
+    float depth = -(_view * packet.model[3]).z;
+    float depthMax = float((1u << DepthBits) - 1);
+    uint64_t depthKey = uint64_t(glm::clamp(depth / _far, 0.0f, 1.0f) * depthMax);
+
+    uint64_t key = fieldId(_pipelineIds, packet.pipeline, PipelineBits);
+    uint64_t programs = (uint64_t(packet.vertexProgram) << 32) | packet.fragmentProgram;
+    key = (key << ProgramBits) | fieldId(_programIds, programs, ProgramBits);
+    key = (key << TextureSetBits) | fieldId(_textureSetIds, packet.textures, TextureSetBits);
+    key = (key << DrawableBits) | fieldId(_drawableIds, packet.drawable, DrawableBits);
+    key = (key << DepthBits) | depthKey;
+    return key;
+}
+
+void RenderQueue::radixSort()
+{
+    size_t count = _keys.size();
+    _order.resize(count);
+    for (size_t i = 0; i < count; i++)
+        _order[i] = uint32_t(i);
+
+    _keysTemp.resize(count);
+    _orderTemp.resize(count);
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        std::array<size_t, 256> histogram = {};
+        for (uint64_t key : _keys)
+            histogram[(key >> shift) & 0xff]++;
+
+        // All keys share this digit, the pass would not move anything
+        if (histogram[(_keys[0] >> shift) & 0xff] == count)
+            continue;
+
+        size_t offset = 0;
+        for (size_t& bucket : histogram)
+        {
+            size_t n = bucket;
+            bucket = offset;
+            offset += n;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t dst = histogram[(_keys[i] >> shift) & 0xff]++;
+            _keysTemp[dst] = _keys[i];
+            _orderTemp[dst] = _order[i];
+        }
+        _keys.swap(_keysTemp);
+        _order.swap(_orderTemp);
+    }
+}
+
+void RenderQueue::execute(const std::function<void(const glm::mat4&)>& setMatrices)
+{
+    _stats = Stats();
+    if (_packets.empty())
+        return;
+
+    radixSort();
+
+    // Nothing is known to be bound yet
+    GLuint pipeline = ~0u;
+    GLuint vertexProgram = ~0u;
+    GLuint fragmentProgram = ~0u;
+    TextureSet textures;
+    textures.fill(~0u);
+
+    for (uint32_t index : _order)
+    {
+        const Packet& packet = _packets[index];
+
+        if (packet.pipeline != pipeline)
+        {
+            GLState::bindProgramPipeline(packet.pipeline);
+            pipeline = packet.pipeline;
+            vertexProgram = fragmentProgram = ~0u;  // The stages belong to the pipeline object
+            _stats.pipelineBinds++;
+        }
+
+        if (packet.vertexProgram != vertexProgram)
+        {
+            GLState::useProgramStages(pipeline, GL_VERTEX_SHADER_BIT, packet.vertexProgram);
+            vertexProgram = packet.vertexProgram;
+            _stats.programStageChanges++;
+        }
+
+        if (packet.fragmentProgram != fragmentProgram)
+        {
+            GLState::useProgramStages(pipeline, GL_FRAGMENT_SHADER_BIT, packet.fragmentProgram);
+            fragmentProgram = packet.fragmentProgram;
+            _stats.programStageChanges++;
+        }
+
+        for (int unit = 0; unit < TextureUnits; unit++)
+        {
+            if (packet.textures[unit] != textures[unit])
+            {
+                GLState::bindTexture(unit, GL_TEXTURE_2D, packet.textures[unit]);
+                textures[unit] = packet.textures[unit];
+                _stats.textureBinds++;
+            }
+        }
+
+        setMatrices(packet.model);
+        packet.drawable->render();
+        _stats.draws++;
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "drawable.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+// Collects the frame's draws as packets and executes them sorted by state.
+//
+// Each packet gets a 64-bit key, most significant first:
+//   pipeline (4 bits) | vertex + fragment programs (6) | texture set (12) | mesh (18) | view depth (24)
+// so packets sharing state end up next to each other, and opaque draws of one state run front to back.
+// Pipelines, programs, texture sets and meshes get small ids the first time they are seen.
+// The keys are radix sorted, then execute() only issues the binds whose value actually changes.
+class RenderQueue
+{
+public:
+    static const int TextureUnits = 3;
+    using TextureSet = std::array<GLuint, TextureUnits>;   // Texture per unit, 0 leaves the unit empty
+
+    struct Packet
+    {
+        GLuint pipeline = 0;
+        GLuint vertexProgram = 0;
+        GLuint fragmentProgram = 0;
+        TextureSet textures = {};
+        const Drawable* drawable = nullptr;
+        glm::mat4 model = glm::mat4(1.0f);
+    };
+
+    struct Stats
+    {
+        size_t draws = 0;
+        size_t pipelineBinds = 0;
+        size_t programStageChanges = 0;
+        size_t textureBinds = 0;
+
+        size_t stateChanges() const { return pipelineBinds + programStageChanges + textureBinds; }
+    };
+
+    // Starts a new frame. view maps models to eye space for the depth part of the key, farPlane bounds it.
+    void begin(const glm::mat4& view, float farPlane);
+
+    void submit(const Packet& packet);
+
+    // Sorts and draws the packets. setMatrices is called with each packet's model before its draw.
+    // Bound state is not assumed to survive from earlier code, so the first packet binds everything.
+    void execute(const std::function<void(const glm::mat4&)>& setMatrices);
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    uint64_t makeKey(const Packet& packet);
+
+    // Sorts _keys with _order along, 8 bits per pass, skipping passes where all keys share the digit
+    void radixSort();
+
+    glm::mat4 _view = glm::mat4(1.0f);
+    float _far = 100.0f;
+
+    std::vector<Packet> _packets;
+    std::vector<uint64_t> _keys, _keysTemp;
+    std::vector<uint32_t> _order, _orderTemp;
+
+    std::unordered_map<GLuint, uint64_t> _pipelineIds;
+    std::unordered_map<uint64_t, uint64_t> _programIds;   // Vertex program in the high half, fragment in the low
+    std::map<TextureSet, uint64_t> _textureSetIds;
+    std::unordered_map<const Drawable*, uint64_t> _drawableIds;
+
+    Stats _stats;
+};
@@ -1,5 +1,11 @@
 #include "../pch.h"
 #include "shader_manager.h"
+#include "glstate.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 // Available shader extensions
 static std::map<std::string, ShaderManager::ShaderType> _fileExtensions =
@@ -35,7 +41,7 @@ GLuint ShaderManager::Create()
 	return handle;
 }
 
-GLuint ShaderManager::Compile(const char* fileName)
+ShaderManager::ShaderType ShaderManager::TypeOf(const char* fileName)
 {
 	// Check the filename extension to determine shader type
 	auto ext = std::filesystem::path(fileName).extension().string();
@@ -44,12 +50,10 @@ GLuint ShaderManager::Compile(const char* fileName)
 	if (it == _fileExtensions.end())
 		throw ShaderManagerException(fmt::format("Unrecognized extension: {}", ext));
 
-	// Type recognized, move on to next stage
-	auto shaderType = it->second;
-	return Compile(fileName, shaderType);
+	return it->second;
 }
 
-GLuint ShaderManager::Compile(const char* fileName, ShaderType type)
+std::string ShaderManager::ReadSource(const char* fileName, int depth)
 {
 	if (!std::filesystem::exists(fileName))
 		throw ShaderManagerException(fmt::format("Shader: {} not found in the filesystem.", fileName));
@@ -59,12 +63,49 @@ GLuint ShaderManager::Compile(const char* fileName, ShaderType type)
 	if (!inFile)
 		throw ShaderManagerException(fmt::format("Unable to open: {}", fileName));
 
-	// Get file contents
-	std::stringstream code;
-	code << inFile.rdbuf();
+	// Get file contents, with every #include "file" line replaced by that file, relative to this one.
+	// GLSL has no includes of its own, the compiler and the program cache key only see the result.
+	std::string source;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(inFile, line))
+	{
+		lineNumber++;
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+		{
+			source += line;
+			source += '\n';
+			continue;
+		}
+
+		size_t open = line.find('"', start);
+		size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+		if (close == std::string::npos)
+			throw ShaderManagerException(fmt::format("Shader: {}({}) expected #include \"file\"", fileName, lineNumber));
+		if (depth >= 8)
+			throw ShaderManagerException(fmt::format("Shader: {}({}) includes nested too deeply", fileName, lineNumber));
+
+		// #line keeps the includer's compile errors on its own line numbers
+		std::filesystem::path include = std::filesystem::path(fileName).parent_path() / line.substr(open + 1, close - open - 1);
+		source += "#line 1\n";
+		source += ReadSource(include.string().c_str(), depth + 1);
+		source += fmt::format("#line {}\n", lineNumber + 1);
+	}
 	inFile.close();
 
-	return Compile(code.str(), type, fileName);
+	return source;
+}
+
+GLuint ShaderManager::Compile(const char* fileName)
+{
+	// Type recognized, move on to next stage
+	return Compile(fileName, TypeOf(fileName));
+}
+
+GLuint ShaderManager::Compile(const char* fileName, ShaderType type)
+{
+	return Compile(ReadSource(fileName), type, fileName);
 }
 
 GLuint ShaderManager::Compile(const std::string& source, ShaderType type, const char* fileName)
@@ -92,6 +133,219 @@ GLuint ShaderManager::Compile(const std::string& source, ShaderType type, const
 	return 0;
 }
 
+GLuint ShaderManager::CreateProgram(const char* fileName)
+{
+	return CreateProgram(fileName, TypeOf(fileName));
+}
+
+GLuint ShaderManager::CreateProgram(const char* fileName, ShaderType type)
+{
+	PendingProgram pending{ fileName, type };
+	if (BeginProgram(pending))
+		return pending.program;
+
+	auto start = std::chrono::steady_clock::now();
+	pending.shader = Compile(pending.source, type, fileName);
+	glAttachShader(pending.program, pending.shader);
+	Link(pending.program);
+	FinishProgram(pending, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	return pending.program;
+}
+
+std::vector<GLuint> ShaderManager::CreatePrograms(std::span<const char* const> fileNames)
+{
+	std::vector<GLuint> programs(fileNames.size());
+	std::vector<PendingProgram> pending;
+	for (size_t i = 0; i < fileNames.size(); i++)
+	{
+		PendingProgram program{ fileNames[i], TypeOf(fileNames[i]) };
+		if (BeginProgram(program))
+		{
+			programs[i] = program.program;
+			continue;
+		}
+		program.index = i;
+		pending.push_back(std::move(program));
+	}
+
+	if (pending.empty())
+		return programs;
+
+	// Every compile and link is started before any status is read
+	auto start = std::chrono::steady_clock::now();
+	const char* mode = "driver threads";
+	if (GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile)
+		BuildWithDriverThreads(pending);
+	else if (!BuildWithSharedContexts(pending))
+	{
+		mode = "one thread";
+		BuildWithDriverThreads(pending);
+	}
+	else
+		mode = "shared contexts";
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	LOG_INFO("Shader Manager: {} programs compiled and linked in {:.1f} ms ({})", pending.size(), ms, mode);
+
+	// The batch's time is shared evenly, there is no per-program time when they overlap
+	for (PendingProgram& program : pending)
+	{
+		FinishProgram(program, ms / pending.size());
+		programs[program.index] = program.program;
+	}
+	return programs;
+}
+
+bool ShaderManager::BeginProgram(PendingProgram& pending)
+{
+	pending.source = ReadSource(pending.fileName);
+	pending.key = _programCache.key(pending.source, (GLenum)pending.type, true);
+
+	// Warm start: the linked binary, nothing is compiled
+	size_t rejected = _programCache.stats().rejected;
+	pending.program = Create();
+	if (_programCache.load(pending.fileName, pending.key, pending.program))
+	{
+		LOG_INFO("Shader Manager: program from: \"{}\" loaded from cache with handle: {}", pending.fileName, pending.program);
+		return true;
+	}
+
+	// A rejected binary leaves the program unusable for a normal link on some drivers, start over
+	if (_programCache.stats().rejected != rejected)
+	{
+		GLState::deleteProgram(pending.program);
+		_uniformLocations.erase(pending.program);
+		pending.program = Create();
+	}
+
+	glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	return false;
+}
+
+void ShaderManager::BuildWithDriverThreads(std::vector<PendingProgram>& pending)
+{
+	// Without either extension this is the plain serial compile, just checked later
+	if (GLAD_GL_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLAD_GL_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+	for (PendingProgram& program : pending)
+	{
+		const char* source = program.source.c_str();
+		program.shader = glCreateShader((GLenum)program.type);
+		glShaderSource(program.shader, 1, &source, 0);
+		glCompileShader(program.shader);
+	}
+
+	for (PendingProgram& program : pending)
+	{
+		glAttachShader(program.program, program.shader);
+		glLinkProgram(program.program);
+	}
+
+	if (!GLAD_GL_KHR_parallel_shader_compile && !GLAD_GL_ARB_parallel_shader_compile)
+		return;
+
+	// Only now are the results needed, wait without blocking in the driver
+	size_t remaining = pending.size();
+	std::vector<bool> done(pending.size(), false);
+	while (remaining > 0)
+	{
+		for (size_t i = 0; i < pending.size(); i++)
+		{
+			GLint complete = GL_FALSE;
+			if (!done[i])
+				glGetProgramiv(pending[i].program, GL_COMPLETION_STATUS_KHR, &complete);
+			if (complete)
+			{
+				done[i] = true;
+				remaining--;
+			}
+		}
+		if (remaining > 0)
+			std::this_thread::yield();
+	}
+}
+
+bool ShaderManager::BuildWithSharedContexts(std::vector<PendingProgram>& pending)
+{
+	// This thread builds with its own context, every other worker gets a hidden window sharing its objects
+	GLFWwindow* context = glfwGetCurrentContext();
+	unsigned workers = std::min<unsigned>(Parallel::workerCount(), (unsigned)pending.size());
+	if (!context || workers < 2)
+		return false;
+
+	std::vector<GLFWwindow*> shared;
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	for (unsigned i = 1; i < workers; i++)
+	{
+		GLFWwindow* window = glfwCreateWindow(1, 1, "", nullptr, context);
+		if (!window)
+			break;
+		shared.push_back(window);
+	}
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+	if (shared.empty())
+	{
+		LOG_WARN("Shader Manager: unable to create shared contexts, compiling on one thread");
+		return false;
+	}
+
+	// The programs were created and flagged here, make that visible to the other contexts
+	glFinish();
+
+	std::atomic<size_t> next = 0;
+	Parallel::forEachTask((unsigned)shared.size() + 1, [&](unsigned task)
+	{
+		if (task > 0)
+			glfwMakeContextCurrent(shared[task - 1]);
+
+		for (size_t i = next++; i < pending.size(); i = next++)
+		{
+			PendingProgram& program = pending[i];
+			const char* source = program.source.c_str();
+			program.shader = glCreateShader((GLenum)program.type);
+			glShaderSource(program.shader, 1, &source, 0);
+			glCompileShader(program.shader);
+			glAttachShader(program.program, program.shader);
+			glLinkProgram(program.program);
+		}
+
+		// Done before the statuses are read from this thread's context
+		glFinish();
+		if (task > 0)
+			glfwMakeContextCurrent(nullptr);
+	});
+
+	for (GLFWwindow* window : shared)
+		glfwDestroyWindow(window);
+	return true;
+}
+
+void ShaderManager::FinishProgram(PendingProgram& pending, double compileMs)
+{
+	GLint status;
+	glGetProgramiv(pending.program, GL_LINK_STATUS, &status);
+	if (GL_FALSE == status)
+	{
+		char log[5000];
+		glGetShaderiv(pending.shader, GL_COMPILE_STATUS, &status);
+		if (GL_FALSE == status)
+		{
+			glGetShaderInfoLog(pending.shader, 5000, 0, log);
+			throw ShaderManagerException(fmt::format("Shader \"{}\" failed to compile:\n{}", pending.fileName, log));
+		}
+
+		glGetProgramInfoLog(pending.program, 5000, 0, log);
+		throw ShaderManagerException(fmt::format("Program \"{}\" failed to link:\n{}", pending.fileName, log));
+	}
+
+	LOG_INFO("Shader Manager: program from: \"{}\" linked with handle: {}", pending.fileName, pending.program);
+	CleanupProgram(pending.program);
+	_programCache.write(pending.fileName, pending.key, pending.program, compileMs);
+}
+
 void ShaderManager::Link(GLuint program)
 {
 	GLint status;
@@ -150,6 +404,21 @@ void ShaderManager::ValidatePipeline(GLuint pipeline)
 	}
 }
 
+void ShaderManager::UseProgram(GLuint program)
+{
+	GLState::useProgram(program);
+}
+
+void ShaderManager::BindPipeline(GLuint pipeline)
+{
+	GLState::bindProgramPipeline(pipeline);
+}
+
+void ShaderManager::UseProgramStages(GLuint pipeline, GLbitfield stages, GLuint program)
+{
+	GLState::useProgramStages(pipeline, stages, program);
+}
+
 void ShaderManager::BindAttribLocation(GLuint program, GLuint location, const char* name,
 	const std::source_location srcloc/*= std::source_location::current()*/)
 {
@@ -2,6 +2,10 @@
 // author: Alihan Pehlivan
 // brief: Shader Manager which supports multiple shader objects and programs.
 
+#include "programcache.h"
+
+#include <span>
+
 // Print any errors after performing OpenGL operations
 #define GLERR GLUtils::checkForOpenGLError(__FILE__, __LINE__)
 
@@ -38,11 +42,28 @@ public:
 	GLuint Compile(const char* fileName, ShaderType type);
 	GLuint Compile(const std::string& source, ShaderType type, const char* fileName);
 
+	// Separable program of a single shader file: created, compiled, linked and cleaned up, or loaded
+	// from the program cache when the same source was linked on the same driver before
+	GLuint CreateProgram(const char* fileName);
+	GLuint CreateProgram(const char* fileName, ShaderType type);
+
+	// The programs of every file like CreateProgram, in order. The ones the cache misses are built as one
+	// batch: every compile and link is started before any status is read. With KHR_parallel_shader_compile
+	// the driver's threads build them, otherwise worker threads with hidden shared contexts do.
+	std::vector<GLuint> CreatePrograms(std::span<const char* const> fileNames);
+
+	ProgramCache& GetProgramCache() { return _programCache; }
+
 	void Link(GLuint program);
 	void CleanupProgram(GLuint program);
 	void ValidateProgram(GLuint program);
 	void ValidatePipeline(GLuint pipeline);
 
+	// Activation goes through the GL state cache, binding what is already bound is skipped
+	void UseProgram(GLuint program);
+	void BindPipeline(GLuint pipeline);
+	void UseProgramStages(GLuint pipeline, GLbitfield stages, GLuint program);
+
 	void BindAttribLocation(GLuint program, GLuint location, const char* name,
 		const std::source_location srcloc = std::source_location::current());
 	void BindFragDataLocation(GLuint program, GLuint location, const char* name,
@@ -70,9 +91,35 @@ public:
 		const std::source_location srcloc = std::source_location::current());
 
 private:
+	// A program being created from a file, missing the program cache
+	struct PendingProgram
+	{
+		const char* fileName;
+		ShaderType type;
+		std::string source;
+		uint64_t key = 0;
+		GLuint program = 0;
+		GLuint shader = 0;
+		size_t index = 0;      // In the batch
+	};
+
+	// Creates the program and loads it from the cache, false when it still has to be built
+	bool BeginProgram(PendingProgram& pending);
+	void BuildWithDriverThreads(std::vector<PendingProgram>& pending);
+	bool BuildWithSharedContexts(std::vector<PendingProgram>& pending);
+
+	// Throws with the compile or link log on failure, otherwise cleans up and writes the cache
+	void FinishProgram(PendingProgram& pending, double compileMs);
+
+	static ShaderType TypeOf(const char* fileName);
+	// Expands #include "file" lines, nested up to 8 deep
+	static std::string ReadSource(const char* fileName, int depth = 0);
+
 	GLint GetUniformLocation(GLuint program, const char* name,
 		const std::source_location srcloc = std::source_location::current());
 
 	// <program <uniform name, uniform location>>
 	std::map<GLuint, std::map<std::string, GLint>> _uniformLocations;
+
+	ProgramCache _programCache;
 };
@@ -1,5 +1,6 @@
 #include "../pch.h"
 #include "texture.h"
+#include "glstate.h"
 #include "stb/stb_image.h"
 
 /*static*/
@@ -9,7 +10,7 @@ GLuint Texture::loadTexture( const std::string & fName ) {
 	GLuint tex = 0;
     if( data != nullptr ) {
         glGenTextures(1, &tex);
-        glBindTexture(GL_TEXTURE_2D, tex);
+        GLState::bindTexture(0, GL_TEXTURE_2D, tex);
         glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
 
@@ -36,7 +37,7 @@ unsigned char *Texture::loadPixels(const std::string &fName, int & width, int &
 GLuint Texture::loadCubeMap(const std::string &baseName, const std::string &extension) {
     GLuint texID;
     glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+    GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, texID);
 
     const char * suffixes[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
     GLint w, h;
@@ -70,7 +71,7 @@ GLuint Texture::loadCubeMap(const std::string &baseName, const std::string &exte
 GLuint Texture::loadHdrCubeMap(const std::string &baseName) {
     GLuint texID;
     glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+    GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, texID);
 
     const char * suffixes[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
     GLint w, h;
@@ -0,0 +1,189 @@
+#include "../pch.h"
+#include "texturearray.h"
+#include "texture.h"
+#include "glstate.h"
+
+namespace
+{
+    // Bilinear resample of an RGBA8 image
+    std::vector<uint8_t> resizeImage(const uint8_t* src, int srcWidth, int srcHeight, int width, int height)
+    {
+        std::vector<uint8_t> dst(size_t(width) * height * 4);
+
+        float scaleX = float(srcWidth) / float(width);
+        float scaleY = float(srcHeight) / float(height);
+
+        for (int y = 0; y < height; y++)
+        {
+            float sy = std::clamp((y + 0.5f) * scaleY - 0.5f, 0.0f, float(srcHeight - 1));
+            int y0 = int(sy);
+            int y1 = std::min(y0 + 1, srcHeight - 1);
+            float fy = sy - float(y0);
+
+            for (int x = 0; x < width; x++)
+            {
+                float sx = std::clamp((x + 0.5f) * scaleX - 0.5f, 0.0f, float(srcWidth - 1));
+                int x0 = int(sx);
+                int x1 = std::min(x0 + 1, srcWidth - 1);
+                float fx = sx - float(x0);
+
+                const uint8_t* p00 = src + (size_t(y0) * srcWidth + x0) * 4;
+                const uint8_t* p10 = src + (size_t(y0) * srcWidth + x1) * 4;
+                const uint8_t* p01 = src + (size_t(y1) * srcWidth + x0) * 4;
+                const uint8_t* p11 = src + (size_t(y1) * srcWidth + x1) * 4;
+                uint8_t* out = &dst[(size_t(y) * width + x) * 4];
+
+                for (int c = 0; c < 4; c++)
+                {
+                    float top = p00[c] + (p10[c] - p00[c]) * fx;
+                    float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+                    out[c] = uint8_t(top + (bottom - top) * fy + 0.5f);
+                }
+            }
+        }
+
+        return dst;
+    }
+
+    GLsizei mipLevels(int width, int height)
+    {
+        GLsizei levels = 1;
+        for (int size = std::max(width, height); size > 1; size /= 2)
+            levels++;
+        return levels;
+    }
+}
+
+TextureArrayBuilder::TextureArrayBuilder(int resizeWidth, int resizeHeight)
+    : _resizeWidth(resizeWidth), _resizeHeight(resizeHeight)
+{ }
+
+TextureArrayBuilder::~TextureArrayBuilder()
+{
+    for (Group& group : _groups)
+    {
+        if (group.texture)
+            GLState::deleteTextures(1, &group.texture);
+    }
+}
+
+TextureArrayBuilder::Layer TextureArrayBuilder::add(const std::string& fileName)
+{
+    int width = 0, height = 0;
+    unsigned char* data = Texture::loadPixels(fileName, width, height);
+    if (data == nullptr)
+    {
+        LOG_ERROR("TextureArrayBuilder: could not load {}", fileName);
+        return Layer();
+    }
+
+    Layer layer = add(data, width, height);
+    Texture::deletePixels(data);
+    return layer;
+}
+
+TextureArrayBuilder::Layer TextureArrayBuilder::add(const uint8_t* rgba, int width, int height)
+{
+    std::vector<uint8_t> resized;
+    if (_resizeWidth > 0 && _resizeHeight > 0 && (width != _resizeWidth || height != _resizeHeight))
+    {
+        resized = resizeImage(rgba, width, height, _resizeWidth, _resizeHeight);
+        rgba = resized.data();
+        width = _resizeWidth;
+        height = _resizeHeight;
+    }
+
+    unsigned array = 0;
+    while (array < _groups.size() && !(_groups[array].width == width && _groups[array].height == height))
+        array++;
+
+    if (array == _groups.size())
+    {
+        _groups.emplace_back();
+        _groups.back().width = width;
+        _groups.back().height = height;
+    }
+
+    Group& group = _groups[array];
+    if (group.texture)
+    {
+        LOG_ERROR("TextureArrayBuilder: layers cannot be added after build()");
+        return Layer();
+    }
+
+    group.pixels.insert(group.pixels.end(), rgba, rgba + size_t(width) * height * 4);
+    return { array, group.layers++ };
+}
+
+void TextureArrayBuilder::build()
+{
+    for (Group& group : _groups)
+    {
+        if (group.texture || group.layers == 0)
+            continue;
+
+        glGenTextures(1, &group.texture);
+        GLState::bindTexture(0, GL_TEXTURE_2D_ARRAY, group.texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, mipLevels(group.width, group.height), GL_RGBA8, group.width, group.height, group.layers);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, group.width, group.height, group.layers, GL_RGBA, GL_UNSIGNED_BYTE, group.pixels.data());
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+        LOG_INFO("Texture array {}x{} with {} layers ({} KB)", group.width, group.height, group.layers, group.pixels.size() / 1024);
+
+        group.pixels.clear();
+        group.pixels.shrink_to_fit();
+    }
+}
+
+////////////////////////////////
+
+MaterialArray::MaterialArray(int width, int height)
+    : _builder(width, height)
+{ }
+
+MaterialArray::~MaterialArray()
+{
+    if (_table)
+        GLState::deleteBuffers(1, &_table);
+}
+
+GLuint MaterialArray::layer(const std::string& fileName)
+{
+    auto it = _fileLayers.find(fileName);
+    if (it != _fileLayers.end())
+        return it->second;
+
+    // Resizing keeps every valid layer in array 0
+    TextureArrayBuilder::Layer layer = _builder.add(fileName);
+    GLuint index = layer.valid() ? layer.layer : 0;
+    _fileLayers[fileName] = index;
+    return index;
+}
+
+GLuint MaterialArray::add(const std::string& diffuse, const std::string& normal, const std::string& mix)
+{
+    _layers.push_back({ layer(diffuse), layer(normal), layer(mix) });
+    return GLuint(_layers.size() - 1);
+}
+
+void MaterialArray::build()
+{
+    _builder.build();
+
+    if (!_table)
+        glGenBuffers(1, &_table);
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, _table);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _layers.size() * sizeof(MaterialLayers), _layers.data(), GL_STATIC_DRAW);
+}
+
+void MaterialArray::bind() const
+{
+    GLState::bindTexture(TextureUnit, GL_TEXTURE_2D_ARRAY, _builder.texture(0));
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, Binding, _table);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Packs 2D images into GL_TEXTURE_2D_ARRAY layers, one array per image size.
+//
+// Images are loaded as RGBA8 (see Texture::loadPixels), so the size is all that tells groups apart.
+// With a resize size set, every image is resampled to it on import and they all share one array.
+class TextureArrayBuilder
+{
+public:
+    struct Layer
+    {
+        unsigned array = ~0u;
+        GLuint layer = 0;
+
+        bool valid() const { return array != ~0u; }
+    };
+
+    explicit TextureArrayBuilder(int resizeWidth = 0, int resizeHeight = 0);
+    ~TextureArrayBuilder();
+
+    TextureArrayBuilder(const TextureArrayBuilder&) = delete;
+    TextureArrayBuilder& operator=(const TextureArrayBuilder&) = delete;
+
+    // Returns an invalid layer when the file cannot be read
+    Layer add(const std::string& fileName);
+    Layer add(const uint8_t* rgba, int width, int height);
+
+    // Uploads every group into its array, with mipmaps, and drops the pixels
+    void build();
+
+    size_t arrayCount() const { return _groups.size(); }
+    GLuint texture(unsigned array) const { return array < _groups.size() ? _groups[array].texture : 0; }
+
+private:
+    struct Group
+    {
+        int width = 0;
+        int height = 0;
+        GLuint layers = 0;
+        std::vector<uint8_t> pixels;   // Layer after layer, until build()
+        GLuint texture = 0;
+    };
+
+    int _resizeWidth;
+    int _resizeHeight;
+    std::vector<Group> _groups;
+};
+
+// Materials whose textures live in the layers of one texture array, looked up by material id in the shaders.
+//
+// The array is bound to TextureUnit and the layer table, one std430 MaterialLayers entry per material,
+// to the shader storage binding Binding (see shader/TextureMixedArray.frag).
+class MaterialArray
+{
+public:
+    static const GLuint TextureUnit = 3;
+    static const GLuint Binding = 3;
+
+    // Images of another size are resized to this one, so they fit in the same array
+    MaterialArray(int width, int height);
+    ~MaterialArray();
+
+    MaterialArray(const MaterialArray&) = delete;
+    MaterialArray& operator=(const MaterialArray&) = delete;
+
+    // Returns the id of the new material. Files already added by another material share its layer.
+    GLuint add(const std::string& diffuse, const std::string& normal, const std::string& mix);
+
+    // Uploads the array and the layer table
+    void build();
+
+    // Binds the array and the layer table, through GLState
+    void bind() const;
+
+    size_t size() const { return _layers.size(); }
+
+private:
+    struct MaterialLayers
+    {
+        GLuint diffuse;
+        GLuint normal;
+        GLuint mix;
+        GLuint padding = 0;
+    };
+
+    GLuint layer(const std::string& fileName);
+
+    TextureArrayBuilder _builder;
+    std::map<std::string, GLuint> _fileLayers;
+    std::vector<MaterialLayers> _layers;
+    GLuint _table = 0;
+};
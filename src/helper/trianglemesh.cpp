@@ -1,5 +1,72 @@
 #include "../pch.h"
 #include "trianglemesh.h"
+#include "meshoptimizer.h"
+#include "glstate.h"
+
+bool TriangleMesh::optimizeBuffers = false;
+bool TriangleMesh::splitIndexRanges = false;
+bool TriangleMesh::useGeometryArena = true;
+
+namespace
+{
+    const GLuint MaxShortIndex = 0xffff;
+
+    // Cuts the primitives, in order, into runs that use at most 65536 distinct vertices. Each run gets
+    // its own block of vertices (the ones shared with other runs are duplicated) and 16-bit indices into it.
+    // vertexSource receives the original vertex of every new one.
+    template<typename Range>
+    void splitShortRanges(std::span<const GLuint> indices, GLuint primitiveSize, size_t vertexCount,
+        std::vector<GLushort> & shortIndices, std::vector<GLuint> & vertexSource, std::vector<Range> & ranges)
+    {
+        shortIndices.resize(indices.size());
+        vertexSource.clear();
+        ranges.clear();
+
+        // Local index of every vertex in the current run, valid while runOf matches
+        std::vector<GLuint> localIndex(vertexCount);
+        std::vector<GLuint> runOf(vertexCount, ~0u);
+
+        size_t first = 0;
+        GLuint run = 0;
+        GLuint base = 0;
+        for( size_t p = 0; p < indices.size(); p += primitiveSize ) {
+            size_t end = std::min(p + primitiveSize, indices.size());
+
+            GLuint newVertices = 0;
+            for( size_t i = p; i < end; i++ ) {
+                if( runOf[indices[i]] != run ) newVertices++;
+            }
+
+            // Duplicate indices within the primitive may overcount, which only ends a run early
+            if( vertexSource.size() - base + newVertices > MaxShortIndex + 1 ) {
+                ranges.push_back({ GLuint(first), GLsizei(p - first), GLint(base) });
+                first = p;
+                run++;
+                base = GLuint(vertexSource.size());
+            }
+
+            for( size_t i = p; i < end; i++ ) {
+                GLuint v = indices[i];
+                if( runOf[v] != run ) {
+                    runOf[v] = run;
+                    localIndex[v] = GLuint(vertexSource.size()) - base;
+                    vertexSource.push_back(v);
+                }
+                shortIndices[i] = GLushort(localIndex[v]);
+            }
+        }
+        if( first < indices.size() ) ranges.push_back({ GLuint(first), GLsizei(indices.size() - first), GLint(base) });
+    }
+
+    std::vector<GLfloat> gatherStream(std::span<const GLfloat> stream, size_t components, const std::vector<GLuint> & vertexSource)
+    {
+        std::vector<GLfloat> result(vertexSource.size() * components);
+        for( size_t v = 0; v < vertexSource.size(); v++ ) {
+            std::copy_n(&stream[vertexSource[v] * components], components, &result[v * components]);
+        }
+        return result;
+    }
+}
 
 void TriangleMesh::initBuffers(
         std::vector<GLuint> * indices,
@@ -9,81 +76,297 @@ void TriangleMesh::initBuffers(
         std::vector<GLfloat> * tangents
 ) {
 
-    if( ! buffers.empty() ) deleteBuffers();
-
     // Must have data for indices, points, and normals
-    if( indices == nullptr || points == nullptr || normals == nullptr )
+    if( indices == nullptr || points == nullptr || normals == nullptr ) {
+        deleteBuffers();
         return;
+    }
 
-    nVerts = (GLuint)indices->size();
+    if( optimizeBuffers ) MeshOptimizer::optimize(*indices, *points, *normals, texCoords, tangents);
 
-    GLuint indexBuf = 0, posBuf = 0, normBuf = 0, tcBuf = 0, tangentBuf = 0;
-    glGenBuffers(1, &indexBuf);
-    buffers.push_back(indexBuf);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->size() * sizeof(GLuint), indices->data(), GL_STATIC_DRAW);
+    initBuffers(
+        std::span<const GLuint>(*indices),
+        std::span<const GLfloat>(*points),
+        std::span<const GLfloat>(*normals),
+        texCoords ? std::span<const GLfloat>(*texCoords) : std::span<const GLfloat>(),
+        tangents ? std::span<const GLfloat>(*tangents) : std::span<const GLfloat>()
+    );
+}
+
+void TriangleMesh::initBuffers(
+        std::span<const GLuint> indices,
+        std::span<const GLfloat> points,
+        std::span<const GLfloat> normals,
+        std::span<const GLfloat> texCoords,
+        std::span<const GLfloat> tangents,
+        const VertexFormat & format
+) {
+
+    deleteBuffers();
+
+    bounds.reset();
+    for( size_t i = 0; i + 2 < points.size(); i += 3 ) {
+        glm::vec3 pt(points[i], points[i + 1], points[i + 2]);
+        bounds.add(pt);
+    }
+
+    vertexFormat = format;
+    positionScale = glm::vec3(1.0f);
+    positionOffset = glm::vec3(0.0f);
+
+    // Quantized positions are only decoded by the packed shader, which also expects octahedral normals
+    if( vertexFormat.position == VertexFormat::Position::Unorm16 && ! vertexFormat.isPacked() ) {
+        LOG_WARN("Unorm16 positions need octahedral normals, storing half float positions instead");
+        vertexFormat.position = VertexFormat::Position::Half;
+    }
+
+    // 16-bit indices where they fit. Larger meshes may be split into ranges, each with its own
+    // block of vertices, and then upload the gathered attributes instead.
+    std::vector<GLushort> shortIndices;
+    std::vector<GLuint> vertexSource;
+    std::vector<GLfloat> splitPoints, splitNormals, splitTexCoords, splitTangents;
+    indexType = GL_UNSIGNED_INT;
+    indexRanges.clear();
+
+    GLuint maxIndex = 0;
+    for( GLuint index : indices ) maxIndex = std::max(maxIndex, index);
+
+    if( ! indices.empty() && maxIndex <= MaxShortIndex ) {
+        shortIndices.resize(indices.size());
+        std::transform(indices.begin(), indices.end(), shortIndices.begin(), [](GLuint index) { return GLushort(index); });
+        indexType = GL_UNSIGNED_SHORT;
+    } else if( ! indices.empty() && splitIndexRanges ) {
+        splitShortRanges(indices, indicesPerPrimitive(), points.size() / 3, shortIndices, vertexSource, indexRanges);
+
+        // Only worth it while the duplicated vertices cost less than the halved indices save
+        size_t addedBytes = (vertexSource.size() - points.size() / 3) * vertexFormat.stride(! texCoords.empty(), ! tangents.empty());
+        size_t savedBytes = indices.size() * (sizeof(GLuint) - sizeof(GLushort));
+        if( addedBytes >= savedBytes ) {
+            LOG_INFO("Keeping 32-bit indices: 16-bit ranges would add {} KB of vertices to save {} KB of indices",
+                addedBytes / 1024, savedBytes / 1024);
+            shortIndices.clear();
+            indexRanges.clear();
+            vertexSource.clear();
+        }
+    }
+
+    if( ! indexRanges.empty() ) {
+        indexType = GL_UNSIGNED_SHORT;
+
+        splitPoints = gatherStream(points, 3, vertexSource);
+        splitNormals = gatherStream(normals, 3, vertexSource);
+        if( ! texCoords.empty() ) splitTexCoords = gatherStream(texCoords, 2, vertexSource);
+        if( ! tangents.empty() ) splitTangents = gatherStream(tangents, 4, vertexSource);
+        points = splitPoints;
+        normals = splitNormals;
+        texCoords = splitTexCoords;
+        tangents = splitTangents;
+
+        LOG_INFO("Split {} indices into {} 16-bit index ranges, {} -> {} vertices",
+            indices.size(), indexRanges.size(), maxIndex + 1, vertexSource.size());
+    }
+
+    if( useGeometryArena ) {
+        initArenaBuffers(indices, shortIndices, points, normals, texCoords, tangents);
+        return;
+    }
+
+    initIndexBuffer(indices, shortIndices);
+
+    if( vertexFormat.interleaved ) {
+        initInterleavedBuffers(points, normals, texCoords, tangents);
+        return;
+    }
+
+    GLuint indexBuf = buffers[0];
+
+    GLuint posBuf = 0, normBuf = 0, tcBuf = 0, tangentBuf = 0;
 
     glGenBuffers(1, &posBuf);
     buffers.push_back(posBuf);
-    glBindBuffer(GL_ARRAY_BUFFER, posBuf);
-    glBufferData(GL_ARRAY_BUFFER, points->size() * sizeof(GLfloat), points->data(), GL_STATIC_DRAW);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, posBuf);
+    glBufferData(GL_ARRAY_BUFFER, points.size_bytes(), points.data(), GL_STATIC_DRAW);
 
     glGenBuffers(1, &normBuf);
     buffers.push_back(normBuf);
-    glBindBuffer(GL_ARRAY_BUFFER, normBuf);
-    glBufferData(GL_ARRAY_BUFFER, normals->size() * sizeof(GLfloat), normals->data(), GL_STATIC_DRAW);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, normBuf);
+    glBufferData(GL_ARRAY_BUFFER, normals.size_bytes(), normals.data(), GL_STATIC_DRAW);
 
-    if( texCoords != nullptr ) {
+    if( ! texCoords.empty() ) {
         glGenBuffers(1, &tcBuf);
         buffers.push_back(tcBuf);
-        glBindBuffer(GL_ARRAY_BUFFER, tcBuf);
-        glBufferData(GL_ARRAY_BUFFER, texCoords->size() * sizeof(GLfloat), texCoords->data(), GL_STATIC_DRAW);
+        GLState::bindBuffer(GL_ARRAY_BUFFER, tcBuf);
+        glBufferData(GL_ARRAY_BUFFER, texCoords.size_bytes(), texCoords.data(), GL_STATIC_DRAW);
     }
 
-    if( tangents != nullptr ) {
+    if( ! tangents.empty() ) {
         glGenBuffers(1, &tangentBuf);
         buffers.push_back(tangentBuf);
-        glBindBuffer(GL_ARRAY_BUFFER, tangentBuf);
-        glBufferData(GL_ARRAY_BUFFER, tangents->size() * sizeof(GLfloat), tangents->data(), GL_STATIC_DRAW);
+        GLState::bindBuffer(GL_ARRAY_BUFFER, tangentBuf);
+        glBufferData(GL_ARRAY_BUFFER, tangents.size_bytes(), tangents.data(), GL_STATIC_DRAW);
     }
 
     glGenVertexArrays( 1, &vao );
-    glBindVertexArray(vao);
+    GLState::bindVertexArray(vao);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
 
     // Position
-    glBindBuffer(GL_ARRAY_BUFFER, posBuf);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, posBuf);
     glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 0, 0 );
     glEnableVertexAttribArray(0);  // Vertex position
 
     // Normal
-    glBindBuffer(GL_ARRAY_BUFFER, normBuf);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, normBuf);
     glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, 0, 0 );
     glEnableVertexAttribArray(1);  // Normal
 
     // Tex coords
-    if( texCoords != nullptr ) {
-        glBindBuffer(GL_ARRAY_BUFFER, tcBuf);
+    if( ! texCoords.empty() ) {
+        GLState::bindBuffer(GL_ARRAY_BUFFER, tcBuf);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
         glEnableVertexAttribArray(2);  // Tex coord
     }
 
-    if( tangents != nullptr ) {
-        glBindBuffer(GL_ARRAY_BUFFER, tangentBuf);
+    if( ! tangents.empty() ) {
+        GLState::bindBuffer(GL_ARRAY_BUFFER, tangentBuf);
         glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 0, 0);
         glEnableVertexAttribArray(3);  // Tangents
     }
 
-    glBindVertexArray(0);
+    GLState::bindVertexArray(0);
+}
+
+void TriangleMesh::initInterleavedBuffers(
+        std::span<const GLfloat> points,
+        std::span<const GLfloat> normals,
+        std::span<const GLfloat> texCoords,
+        std::span<const GLfloat> tangents
+) {
+    std::vector<uint8_t> vertices = vertexFormat.pack(points, normals, texCoords, tangents, positionScale, positionOffset);
+
+    GLuint indexBuf = buffers[0];
+    GLuint vertexBuf = 0;
+
+    glGenBuffers(1, &vertexBuf);
+    buffers.push_back(vertexBuf);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vertexBuf);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+    glGenVertexArrays( 1, &vao );
+    GLState::bindVertexArray(vao);
+
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vertexBuf);
+    vertexFormat.setAttribPointers(! texCoords.empty(), ! tangents.empty());
+
+    GLState::bindVertexArray(0);
+}
+
+void TriangleMesh::initArenaBuffers(
+        std::span<const GLuint> indices,
+        std::span<const GLushort> shortIndices,
+        std::span<const GLfloat> points,
+        std::span<const GLfloat> normals,
+        std::span<const GLfloat> texCoords,
+        std::span<const GLfloat> tangents
+) {
+    nVerts = (GLuint)indices.size();
+
+    // Pools are interleaved, so the separate layout keeps its floats but shares one buffer
+    if( ! vertexFormat.interleaved ) vertexFormat = VertexFormat::interleavedFloat();
+
+    std::vector<uint8_t> vertices = vertexFormat.pack(points, normals, texCoords, tangents, positionScale, positionOffset);
+    std::span<const uint8_t> indexData = (indexType == GL_UNSIGNED_SHORT)
+        ? std::span<const uint8_t>((const uint8_t *)shortIndices.data(), shortIndices.size_bytes())
+        : std::span<const uint8_t>((const uint8_t *)indices.data(), indices.size_bytes());
+
+    GeometryArena::Layout layout{ vertexFormat, ! texCoords.empty(), ! tangents.empty() };
+    GeometryArena & arena = GeometryArena::instance();
+    arenaRange = arena.allocate(layout, points.size() / 3, indexData.size());
+    arena.upload(arenaRange, vertices, indexData);
+}
+
+void TriangleMesh::initIndexBuffer(std::span<const GLuint> indices, std::span<const GLushort> shortIndices) {
+    nVerts = (GLuint)indices.size();
+
+    // The element buffer binding is VAO state, keep it out of whichever VAO the last draw left bound
+    GLState::bindVertexArray(0);
+
+    GLuint indexBuf = 0;
+    glGenBuffers(1, &indexBuf);
+    buffers.push_back(indexBuf);
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
+    if( indexType == GL_UNSIGNED_SHORT )
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size_bytes(), shortIndices.data(), GL_STATIC_DRAW);
+    else
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size_bytes(), indices.data(), GL_STATIC_DRAW);
+}
+
+void TriangleMesh::drawElements(GLenum mode, GLsizei instanceCount, GLuint baseInstance) const {
+    size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+
+    // Offsets of the whole index buffer, the arena range for meshes that live there
+    size_t indexOffset = 0;
+    GLint baseVertex = 0;
+
+    if( arenaRange.valid() ) {
+        GeometryArena::instance().bind(arenaRange);
+        indexOffset = arenaRange.indexOffset;
+        baseVertex = GLint(arenaRange.firstVertex);
+    } else {
+        if(vao == 0) return;
+        GLState::bindVertexArray(vao);
+    }
+
+    auto draw = [&](GLsizei count, size_t offset, GLint base) {
+        if( instanceCount == 1 && baseInstance == 0 )
+            glDrawElementsBaseVertex(mode, count, indexType, (const void*)offset, base);
+        else
+            glDrawElementsInstancedBaseVertexBaseInstance(mode, count, indexType, (const void*)offset, instanceCount, base, baseInstance);
+    };
+
+    if( indexRanges.empty() ) {
+        draw(nVerts, indexOffset, baseVertex);
+    } else {
+        for( const IndexRange & range : indexRanges ) {
+            draw(range.count, indexOffset + range.firstIndex * indexSize, baseVertex + range.baseVertex);
+        }
+    }
+}
+
+bool TriangleMesh::appendDrawCommands(std::vector<DrawElementsIndirectCommand> & commands, GLuint baseInstance) const {
+    if( ! arenaRange.valid() ) return false;
+
+    GLuint indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    GLuint firstIndex = GLuint(arenaRange.indexOffset / indexSize);
+    GLint baseVertex = GLint(arenaRange.firstVertex);
+
+    if( indexRanges.empty() ) {
+        commands.push_back({ nVerts, 1, firstIndex, baseVertex, baseInstance });
+    } else {
+        for( const IndexRange & range : indexRanges ) {
+            commands.push_back({ GLuint(range.count), 1, firstIndex + range.firstIndex, baseVertex + range.baseVertex, baseInstance });
+        }
+    }
+    return true;
 }
 
 void TriangleMesh::render() const {
-    if(vao == 0) return;
+    drawElements(GL_TRIANGLES);
+}
 
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, nVerts, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+void TriangleMesh::renderInstanced(const InstanceBuffer & instances, size_t first, size_t count) const {
+    drawInstances(GL_TRIANGLES, instances, first, count);
+}
+
+void TriangleMesh::drawInstances(GLenum mode, const InstanceBuffer & instances, size_t first, size_t count) const {
+    first = std::min(first, instances.size());
+    count = std::min(count, instances.size() - first);
+    if( count == 0 ) return;
+
+    instances.bind();
+    drawElements(mode, GLsizei(count), GLuint(first));
 }
 
 TriangleMesh::~TriangleMesh() {
@@ -92,12 +375,15 @@ TriangleMesh::~TriangleMesh() {
 
 void TriangleMesh::deleteBuffers() {
     if( buffers.size() > 0 ) {
-        glDeleteBuffers( (GLsizei)buffers.size(), buffers.data() );
+        GLState::deleteBuffers( (GLsizei)buffers.size(), buffers.data() );
         buffers.clear();
     }
 
+    if( arenaRange.valid() ) GeometryArena::instance().free(arenaRange);
+
     if( vao != 0 ) {
-        glDeleteVertexArrays(1, &vao);
+        // A deleted name can come back for another VAO, so it must not stay cached as bound
+        GLState::deleteVertexArrays(1, &vao);
         vao = 0;
     }
 }
\ No newline at end of file
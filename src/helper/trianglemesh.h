@@ -1,20 +1,49 @@
 #pragma once
 
 #include <vector>
+#include <span>
 
 #include <glad/glad.h>
 #include "drawable.h"
+#include "aabb.h"
+#include "vertexformat.h"
+#include "geometryarena.h"
+#include "instancebuffer.h"
 
 class TriangleMesh : public Drawable {
 
 protected:
 
     GLuint nVerts;     // Number of vertices
-    GLuint vao;        // The Vertex Array Object
+    GLuint vao = 0;    // The Vertex Array Object, 0 for meshes in the geometry arena
 
     // Vertex buffers
     std::vector<GLuint> buffers;
 
+    // Vertex and index range in the shared buffers, when useGeometryArena was set at upload
+    GeometryArena::Allocation arenaRange;
+
+    // A run of primitives drawn with glDrawElementsBaseVertex
+    struct IndexRange {
+        GLuint firstIndex;
+        GLsizei count;
+        GLint baseVertex;
+    };
+
+    // GL_UNSIGNED_SHORT whenever the indices fit. Meshes with more vertices may be split into
+    // ranges of 16-bit indices relative to a base vertex (see splitIndexRanges), otherwise
+    // indexRanges is empty and the whole buffer is drawn at once.
+    GLenum indexType = GL_UNSIGNED_INT;
+    std::vector<IndexRange> indexRanges;
+
+    // Object space bounds of the positions, set by initBuffers
+    Aabb bounds;
+
+    // GPU vertex layout, and the mapping of decoded positions back to object space
+    VertexFormat vertexFormat;
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+
     virtual void initBuffers(
             std::vector<GLuint> * indices,
             std::vector<GLfloat> * points,
@@ -23,15 +52,85 @@ protected:
             std::vector<GLfloat> * tangents = nullptr
             );
 
+    // Uploads straight from memory the mesh doesn't own (e.g. a mapped cache file).
+    // Empty texCoords/tangents are left out of the VAO.
+    void initBuffers(
+            std::span<const GLuint> indices,
+            std::span<const GLfloat> points,
+            std::span<const GLfloat> normals,
+            std::span<const GLfloat> texCoords = {},
+            std::span<const GLfloat> tangents = {},
+            const VertexFormat & format = VertexFormat()
+            );
+
+    // Packs the attributes into one buffer in vertexFormat, after the index buffer exists
+    void initInterleavedBuffers(
+            std::span<const GLfloat> points,
+            std::span<const GLfloat> normals,
+            std::span<const GLfloat> texCoords,
+            std::span<const GLfloat> tangents
+            );
+
+    // Packs the vertices in the interleaved form of vertexFormat into the geometry arena
+    void initArenaBuffers(
+            std::span<const GLuint> indices,
+            std::span<const GLushort> shortIndices,
+            std::span<const GLfloat> points,
+            std::span<const GLfloat> normals,
+            std::span<const GLfloat> texCoords,
+            std::span<const GLfloat> tangents
+            );
+
+    // Creates the element buffer from shortIndices when indexType is GL_UNSIGNED_SHORT
+    void initIndexBuffer(std::span<const GLuint> indices, std::span<const GLushort> shortIndices);
+
+    // Indices per primitive, so index ranges never split one
+    virtual GLuint indicesPerPrimitive() const { return 3; }
+
+    // Draws the whole index buffer, range by range if it was split.
+    // Instanced draws pass the first instance as base instance, for the shaders' instance buffer lookup.
+    void drawElements(GLenum mode, GLsizei instanceCount = 1, GLuint baseInstance = 0) const;
+
+    // Binds the instance buffer and draws its instances [first, first + count), clamped to its size
+    void drawInstances(GLenum mode, const InstanceBuffer & instances, size_t first, size_t count) const;
+
     virtual void deleteBuffers();
 
 public:
+    // When set, meshes built from vectors go through MeshOptimizer before upload
+    // (vertex cache order and vertex fetch order). Off by default.
+    static bool optimizeBuffers;
+
+    // When set, meshes with more than 65536 vertices are drawn in 16-bit index ranges with a base vertex.
+    // Vertices shared by two ranges are stored twice, few on meshes in vertex cache order. Off by default.
+    static bool splitIndexRanges;
+
+    // When set, meshes are sub-allocated from the shared GeometryArena buffers of their vertex layout
+    // instead of owning a VAO and buffers. The separate float layout is stored interleaved there. On by default.
+    static bool useGeometryArena;
+
     virtual ~TriangleMesh();
     virtual void render() const;
-    GLuint getVao() const { return vao; }
-    GLuint getElementBuffer() { return buffers[0]; }
-    GLuint getPositionBuffer() { return buffers[1]; }
-    GLuint getNormalBuffer() { return buffers[2]; }
+
+    // Draws count instances starting at first, each with its entry of the instance buffer.
+    // Needs one of the instanced vertex shaders (see InstanceBuffer).
+    virtual void renderInstanced(const InstanceBuffer & instances, size_t first = 0, size_t count = ~size_t(0)) const;
+
+    GLuint getVao() const { return arenaRange.valid() ? GeometryArena::instance().vertexArray(arenaRange) : vao; }
+    GLuint getElementBuffer() { return arenaRange.valid() ? GeometryArena::instance().indexBuffer(arenaRange) : buffers[0]; }
+    // The attribute buffers below only exist separately for VertexFormat::separate() outside the arena
+    GLuint getPositionBuffer() { if( buffers.size() > 1) return buffers[1]; else return 0; }
+    GLuint getNormalBuffer() { if( buffers.size() > 2) return buffers[2]; else return 0; }
     GLuint getTcBuffer() { if( buffers.size() > 3) return buffers[3]; else return 0; }
+    const GeometryArena::Allocation & getArenaRange() const { return arenaRange; }
     GLuint getNumVerts() { return nVerts; }
+    GLenum getIndexType() const { return indexType; }
+    const VertexFormat & getVertexFormat() const { return vertexFormat; }
+    const Aabb & getBounds() const { return bounds; }
+    const glm::vec3 & getPositionScale() const { return positionScale; }
+    const glm::vec3 & getPositionOffset() const { return positionOffset; }
+
+    // Appends the indirect commands that draw the mesh from its arena range, one per index range,
+    // all with the given base instance. Meshes outside the arena append nothing and return false.
+    bool appendDrawCommands(std::vector<DrawElementsIndirectCommand> & commands, GLuint baseInstance) const;
 };
@@ -0,0 +1,118 @@
+#include "../pch.h"
+#include "uniformring.h"
+#include "glstate.h"
+
+#include <chrono>
+
+namespace
+{
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+UniformRing::UniformRing(size_t frameSize)
+{
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment > 0)
+        _alignment = (size_t)alignment;
+
+    _frameSize = alignUp(frameSize, _alignment);
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &_buffer);
+    GLState::bindBuffer(GL_UNIFORM_BUFFER, _buffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, _frameSize * Frames, nullptr, flags);
+    _mapped = (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, _frameSize * Frames, flags);
+
+    if (!_mapped)
+        LOG_CRITICAL("UniformRing: could not map {} KB persistently", _frameSize * Frames / 1024);
+}
+
+UniformRing::~UniformRing()
+{
+    for (GLsync& fence : _fences)
+    {
+        if (fence)
+            glDeleteSync(fence);
+    }
+
+    if (_mapped)
+    {
+        GLState::bindBuffer(GL_UNIFORM_BUFFER, _buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    }
+    GLState::deleteBuffers(1, &_buffer);
+}
+
+void UniformRing::wait(GLsync fence)
+{
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+        return;
+
+    auto startTime = std::chrono::steady_clock::now();
+    do
+    {
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    } while (result == GL_TIMEOUT_EXPIRED);
+
+    _current.stalls++;
+    _current.stallMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void UniformRing::beginFrame()
+{
+    _frame = (_frame + 1) % Frames;
+    _offset = 0;
+    _current = Stats();
+
+    // The GPU may still read the blocks this section held three frames ago
+    if (_fences[_frame])
+    {
+        wait(_fences[_frame]);
+        glDeleteSync(_fences[_frame]);
+        _fences[_frame] = nullptr;
+    }
+}
+
+void UniformRing::endFrame()
+{
+    _fences[_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    _totalStalls += _current.stalls;
+    _lastFrame = _current;
+}
+
+size_t UniformRing::write(const void* data, size_t size)
+{
+    size_t alignedSize = alignUp(size, _alignment);
+    assert(alignedSize <= _frameSize);
+
+    // Out of space: wait until the GPU is done with this frame's earlier blocks and start over
+    if (_offset + alignedSize > _frameSize)
+    {
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        wait(fence);
+        glDeleteSync(fence);
+        _offset = 0;
+    }
+
+    size_t offset = (size_t)_frame * _frameSize + _offset;
+    if (_mapped)
+        memcpy(_mapped + offset, data, size);
+
+    _offset += alignedSize;
+    _current.bytes += alignedSize;
+    _current.blocks++;
+    return offset;
+}
+
+void UniformRing::bind(GLuint index, const void* data, size_t size)
+{
+    size_t offset = write(data, size);
+    GLState::bindBufferRange(GL_UNIFORM_BUFFER, index, _buffer, (GLintptr)offset, (GLsizeiptr)size);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <array>
+#include <cstdint>
+
+// Streams per-draw uniform blocks through one persistently and coherently mapped buffer.
+//
+// The buffer is split into Frames sections. Each frame writes its blocks linearly into the next section,
+// at offsets aligned to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, and ends with a fence. Before a section is
+// written again, beginFrame() waits for the fence of the frame that last used it. A frame that runs out
+// of space waits for the GPU and starts over at the beginning of its section.
+class UniformRing
+{
+public:
+    static const int Frames = 3;
+
+    struct Stats
+    {
+        size_t bytes = 0;        // Streamed this frame, with alignment padding
+        size_t blocks = 0;
+        size_t stalls = 0;       // Waits on a fence (or on the GPU after an overflow) that did not return at once
+        double stallMs = 0.0;
+    };
+
+    explicit UniformRing(size_t frameSize);
+    ~UniformRing();
+
+    UniformRing(const UniformRing&) = delete;
+    UniformRing& operator=(const UniformRing&) = delete;
+
+    void beginFrame();
+    void endFrame();
+
+    // Copies a block into the current section and returns its offset in buffer()
+    size_t write(const void* data, size_t size);
+
+    // Writes a block and binds it to a uniform binding point
+    void bind(GLuint index, const void* data, size_t size);
+
+    GLuint buffer() const { return _buffer; }
+
+    // Stats of the last finished frame, and the stall count since creation
+    const Stats& stats() const { return _lastFrame; }
+    size_t totalStalls() const { return _totalStalls; }
+
+private:
+    void wait(GLsync fence);
+
+    GLuint _buffer = 0;
+    uint8_t* _mapped = nullptr;
+    size_t _frameSize;
+    size_t _alignment = 256;
+
+    int _frame = 0;             // Current section
+    size_t _offset = 0;         // Within the current section
+    std::array<GLsync, Frames> _fences = {};
+
+    Stats _current;
+    Stats _lastFrame;
+    size_t _totalStalls = 0;
+};
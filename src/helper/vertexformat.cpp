@@ -0,0 +1,307 @@
+#include "../pch.h"
+#include "vertexformat.h"
+
+#include <cstring>
+
+namespace
+{
+    struct Layout
+    {
+        size_t normal = 0;
+        size_t texCoord = 0;
+        size_t tangent = 0;
+        size_t stride = 0;
+    };
+
+    // Positions take 8 bytes in the 16-bit encodings so every attribute stays 4 byte aligned
+    size_t positionSize(VertexFormat::Position p) { return p == VertexFormat::Position::Float32 ? 12 : 8; }
+    size_t normalSize(VertexFormat::Normal n) { return n == VertexFormat::Normal::Float32 ? 12 : 4; }
+    size_t texCoordSize(VertexFormat::TexCoord t) { return t == VertexFormat::TexCoord::Float32 ? 8 : 4; }
+    size_t tangentSize(VertexFormat::Tangent t) { return t == VertexFormat::Tangent::Float32 ? 16 : 4; }
+
+    Layout layout(const VertexFormat & format, bool hasTexCoords, bool hasTangents)
+    {
+        Layout l;
+        l.normal = positionSize(format.position);
+        l.texCoord = l.normal + normalSize(format.normal);
+        l.tangent = l.texCoord + (hasTexCoords ? texCoordSize(format.texCoord) : 0);
+        l.stride = l.tangent + (hasTangents ? tangentSize(format.tangent) : 0);
+        return l;
+    }
+
+    // IEEE half float, rounded to nearest even
+    uint16_t floatToHalf(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t exponent = (bits >> 23) & 0xff;
+        uint32_t mantissa = bits & 0x7fffff;
+
+        if (exponent == 0xff)
+            return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+        int halfExponent = int(exponent) - 127 + 15;
+        if (halfExponent >= 31)
+            return uint16_t(sign | 0x7c00);
+
+        if (halfExponent <= 0)
+        {
+            // Subnormal half, or zero
+            if (halfExponent < -10)
+                return uint16_t(sign);
+
+            mantissa |= 0x800000;
+            uint32_t shift = uint32_t(14 - halfExponent);
+            uint32_t half = mantissa >> shift;
+            uint32_t rest = mantissa & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (half & 1)))
+                half++;
+            return uint16_t(sign | half);
+        }
+
+        // A carry out of the mantissa correctly bumps the exponent (up to infinity)
+        uint32_t half = (uint32_t(halfExponent) << 10) | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1fff;
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+            half++;
+        return uint16_t(sign | half);
+    }
+
+    int16_t toSnorm16(float v)
+    {
+        return int16_t(std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+    }
+
+    uint16_t toUnorm16(float v)
+    {
+        return uint16_t(std::lround(std::clamp(v, 0.0f, 1.0f) * 65535.0f));
+    }
+
+    uint32_t toSnorm10(float v)
+    {
+        return uint32_t(std::lround(std::clamp(v, -1.0f, 1.0f) * 511.0f)) & 0x3ff;
+    }
+
+    // Octahedral encoding: project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half over
+    glm::vec2 octEncode(glm::vec3 n)
+    {
+        float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+        if (!(l1 > 0.0f))
+            return glm::vec2(0.0f);
+
+        n /= l1;
+        if (n.z >= 0.0f)
+            return glm::vec2(n.x, n.y);
+
+        return glm::vec2(
+            (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+
+    template<typename T>
+    void store(uint8_t * dst, const T & value)
+    {
+        memcpy(dst, &value, sizeof(T));
+    }
+}
+
+VertexFormat VertexFormat::separate()
+{
+    return VertexFormat();
+}
+
+VertexFormat VertexFormat::interleavedFloat()
+{
+    VertexFormat format;
+    format.interleaved = true;
+    return format;
+}
+
+VertexFormat VertexFormat::half()
+{
+    VertexFormat format;
+    format.interleaved = true;
+    format.position = Position::Half;
+    format.normal = Normal::Oct16;
+    format.texCoord = TexCoord::Half;
+    format.tangent = Tangent::Snorm10;
+    return format;
+}
+
+VertexFormat VertexFormat::compact()
+{
+    VertexFormat format = half();
+    format.position = Position::Unorm16;
+    return format;
+}
+
+const char* VertexFormat::name() const
+{
+    if (!interleaved)
+        return "separate float";
+    if (position == Position::Float32 && normal == Normal::Float32 && texCoord == TexCoord::Float32 && tangent == Tangent::Float32)
+        return "interleaved float";
+    if (position == Position::Half && normal == Normal::Oct16 && texCoord == TexCoord::Half && tangent == Tangent::Snorm10)
+        return "half";
+    if (position == Position::Unorm16 && normal == Normal::Oct16 && texCoord == TexCoord::Half && tangent == Tangent::Snorm10)
+        return "compact";
+    return "custom";
+}
+
+size_t VertexFormat::stride(bool hasTexCoords, bool hasTangents) const
+{
+    return layout(*this, hasTexCoords, hasTangents).stride;
+}
+
+std::vector<uint8_t> VertexFormat::pack(std::span<const GLfloat> points, std::span<const GLfloat> normals,
+    std::span<const GLfloat> texCoords, std::span<const GLfloat> tangents,
+    glm::vec3 & positionScale, glm::vec3 & positionOffset) const
+{
+    size_t vertexCount = points.size() / 3;
+    Layout l = layout(*this, !texCoords.empty(), !tangents.empty());
+    std::vector<uint8_t> data(vertexCount * l.stride, 0);
+
+    positionScale = glm::vec3(1.0f);
+    positionOffset = glm::vec3(0.0f);
+
+    glm::vec3 extent(0.0f);
+    if (position == Position::Unorm16 && vertexCount > 0)
+    {
+        glm::vec3 lo(points[0], points[1], points[2]), hi = lo;
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            glm::vec3 p(points[v * 3], points[v * 3 + 1], points[v * 3 + 2]);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        extent = hi - lo;
+        positionScale = extent / 65535.0f;
+        positionOffset = lo;
+    }
+
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        uint8_t * vertex = &data[v * l.stride];
+        const GLfloat * p = &points[v * 3];
+        const GLfloat * n = &normals[v * 3];
+
+        switch (position)
+        {
+        case Position::Float32:
+            store(vertex, glm::vec3(p[0], p[1], p[2]));
+            break;
+        case Position::Half:
+            for (int i = 0; i < 3; i++)
+                store(vertex + i * 2, floatToHalf(p[i]));
+            break;
+        case Position::Unorm16:
+            for (int i = 0; i < 3; i++)
+            {
+                float t = extent[i] > 0.0f ? (p[i] - positionOffset[i]) / extent[i] : 0.0f;
+                store(vertex + i * 2, toUnorm16(t));
+            }
+            break;
+        }
+
+        if (normal == Normal::Float32)
+        {
+            store(vertex + l.normal, glm::vec3(n[0], n[1], n[2]));
+        }
+        else
+        {
+            glm::vec2 e = octEncode(glm::vec3(n[0], n[1], n[2]));
+            store(vertex + l.normal, toSnorm16(e.x));
+            store(vertex + l.normal + 2, toSnorm16(e.y));
+        }
+
+        if (!texCoords.empty())
+        {
+            const GLfloat * tc = &texCoords[v * 2];
+            if (texCoord == TexCoord::Float32)
+            {
+                store(vertex + l.texCoord, glm::vec2(tc[0], tc[1]));
+            }
+            else
+            {
+                store(vertex + l.texCoord, floatToHalf(tc[0]));
+                store(vertex + l.texCoord + 2, floatToHalf(tc[1]));
+            }
+        }
+
+        if (!tangents.empty())
+        {
+            const GLfloat * t = &tangents[v * 4];
+            if (tangent == Tangent::Float32)
+            {
+                store(vertex + l.tangent, glm::vec4(t[0], t[1], t[2], t[3]));
+            }
+            else
+            {
+                // GL_INT_2_10_10_10_REV: x in the low bits, the sign in the top two (01 = +1, 11 = -1)
+                uint32_t packed = toSnorm10(t[0]) | (toSnorm10(t[1]) << 10) | (toSnorm10(t[2]) << 20) |
+                    ((t[3] < 0.0f ? 3u : 1u) << 30);
+                store(vertex + l.tangent, packed);
+            }
+        }
+    }
+
+    return data;
+}
+
+void VertexFormat::setAttribPointers(bool hasTexCoords, bool hasTangents) const
+{
+    Layout l = layout(*this, hasTexCoords, hasTangents);
+    GLsizei stride = (GLsizei)l.stride;
+
+    // Position
+    if (position == Position::Float32)
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (const void*)0);
+    else if (position == Position::Half)
+        glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride, (const void*)0);
+    else
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (const void*)0);
+    glEnableVertexAttribArray(0);
+
+    // Normal
+    if (normal == Normal::Float32)
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (const void*)l.normal);
+    else
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (const void*)l.normal);
+    glEnableVertexAttribArray(1);
+
+    // Tex coords
+    if (hasTexCoords)
+    {
+        GLenum type = (texCoord == TexCoord::Float32) ? GL_FLOAT : GL_HALF_FLOAT;
+        glVertexAttribPointer(2, 2, type, GL_FALSE, stride, (const void*)l.texCoord);
+        glEnableVertexAttribArray(2);
+    }
+
+    // Tangents
+    if (hasTangents)
+    {
+        if (tangent == Tangent::Float32)
+            glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride, (const void*)l.tangent);
+        else
+            glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (const void*)l.tangent);
+        glEnableVertexAttribArray(3);
+    }
+}
+
+void VertexFormat::logMemoryReport(size_t vertexCount, size_t indexCount, bool hasTexCoords, bool hasTangents)
+{
+    const VertexFormat formats[] = { separate(), interleavedFloat(), half(), compact() };
+    size_t baseline = separate().stride(hasTexCoords, hasTangents);
+    size_t indexBytes = indexCount * sizeof(GLuint);
+
+    LOG_INFO("Vertex memory for {} vertices ({} KB of indices):", vertexCount, indexBytes / 1024);
+    for (const auto & format : formats)
+    {
+        size_t stride = format.stride(hasTexCoords, hasTangents);
+        LOG_INFO("  {:<17} {:>2} B/vertex {:>9.1f} KB  {:.2f}x smaller",
+            format.name(), stride, double(stride * vertexCount) / 1024.0, double(baseline) / double(stride));
+    }
+}
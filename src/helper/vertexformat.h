@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Describes how TriangleMesh stores its vertices on the GPU.
+//
+// The default keeps the original layout: one full float buffer per attribute.
+// Interleaved formats put all attributes of a vertex in one buffer and can use compact encodings:
+//  - positions as half floats, or unsigned normalized 16-bit values inside the mesh bounding box
+//  - normals octahedral encoded into two snorm16 values
+//  - texture coordinates as half floats
+//  - tangents as snorm 10:10:10 with the handedness sign in the 2-bit w
+//
+// Formats with octahedral normals are drawn with shader/TextureMixedPacked.vert, which decodes
+// the normal and maps positions back with the mesh's PositionScale / PositionOffset.
+struct VertexFormat
+{
+    enum class Position : uint8_t { Float32, Half, Unorm16 };
+    enum class Normal : uint8_t { Float32, Oct16 };
+    enum class TexCoord : uint8_t { Float32, Half };
+    enum class Tangent : uint8_t { Float32, Snorm10 };
+
+    bool interleaved = false;
+    Position position = Position::Float32;
+    Normal normal = Normal::Float32;
+    TexCoord texCoord = TexCoord::Float32;
+    Tangent tangent = Tangent::Float32;
+
+    static VertexFormat separate();          // One float buffer per attribute (default)
+    static VertexFormat interleavedFloat();  // Same data, one interleaved buffer
+    static VertexFormat half();              // Half positions and UVs, octahedral normals, packed tangents
+    static VertexFormat compact();           // As half(), with positions quantized in the bounding box
+
+    bool operator==(const VertexFormat&) const = default;
+
+    const char* name() const;
+
+    // Needs the packed vertex shader (see above)
+    bool isPacked() const { return interleaved && normal == Normal::Oct16; }
+
+    // Bytes per vertex, including alignment padding
+    size_t stride(bool hasTexCoords, bool hasTangents) const;
+
+    // Encodes the float streams into one interleaved buffer.
+    // For Unorm16 positions, positionScale / positionOffset receive the dequantization
+    // (position = value * scale + offset), otherwise they are identity.
+    std::vector<uint8_t> pack(std::span<const GLfloat> points, std::span<const GLfloat> normals,
+        std::span<const GLfloat> texCoords, std::span<const GLfloat> tangents,
+        glm::vec3 & positionScale, glm::vec3 & positionOffset) const;
+
+    // Sets attribute pointers 0-3 for the interleaved buffer bound to GL_ARRAY_BUFFER
+    void setAttribPointers(bool hasTexCoords, bool hasTangents) const;
+
+    // Logs the vertex memory each preset would need for a mesh
+    static void logMemoryReport(size_t vertexCount, size_t indexCount, bool hasTexCoords, bool hasTangents);
+};
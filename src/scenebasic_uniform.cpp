@@ -4,6 +4,9 @@
 #include "helper/camera.h"
 #include "helper/objmesh.h"
 #include "helper/noisetex.h"
+#include "helper/glstate.h"
+
+#include <chrono>
 
 #include "../imgui/imgui_impl_opengl3.h"
 #include "../imgui/imgui_impl_glfw.h"
@@ -47,12 +50,99 @@ namespace Configs
     static int perlinHeight = 128;
     static bool perlinPeriodic = false;
 
+    // Draw stress test: a grid of small cubes and tori above the plane
+    static int stressObjects = 0;
+    static bool useMultiDrawIndirect = true;
+    static float stressSubmitMs = 0.0f;
+    static int stressDrawCalls = 0;
+
+    // 10k objects drawn one draw each, then with multi-draw indirect, averaged over whole frames
+    struct StressBenchmark
+    {
+        static const int WarmupFrames = 30;
+        static const int Frames = 300;   // Measured per path, after the warm-up
+
+        int frame = -1;                  // Of the whole run, -1 when idle
+        int savedObjects = 0;
+        bool savedMultiDraw = true;
+        bool savedGpuDriven = false;
+        double submitSum[2] = {};        // Per-draw, then multi-draw
+        double renderSum[2] = {};
+        float submitMs[2] = {};          // Results of the last run
+        float renderMs[2] = {};
+        bool done = false;
+    };
+    static StressBenchmark stressBenchmark;
+
+    // GL state cache counters of the last frame, before ImGui
+    static GLState::Stats glStats;
+
+    // Frustum culling of the scene and stress test objects, counters of the last frame
+    static bool useFrustumCulling = true;
+    static int cullTested = 0;
+    static int cullCulled = 0;
+    static float cullMs = 0.0f;
+    static FrustumCuller::BenchmarkResult cullBenchmark;
+
+    // The stress test objects live in a BVH, for culling and for picking them with the mouse
+    static bool cullWithBvh = true;
+    static int bvhNodesVisited = 0;
+    static std::array<Bvh::BenchmarkResult, 2> bvhBenchmark;
+    static int pickedObject = -1;
+    static float pickedDistance = 0.0f;
+
+    // Culling and multi-draw commands in a compute pass, the CPU does the same work for any object count
+    static bool useGpuDriven = false;
+    static int gpuDrawn = 0;
+    static int gpuFrustumVisible = 0;
+    static int gpuBatches = 0;
+
+    // Hi-Z occlusion culling of the multi-draw objects, counters a frame or two old
+    static bool useOcclusionCulling = true;
+    static int occlusionTested = 0;
+    static int occlusionCulled = 0;
+    static int occlusionLateVisible = 0;
+    static float hizPyramidMs = 0.0f;
+    static int hizLevels = 0;
+
+    // The ogre head rasterized on the CPU, objects behind it are dropped before any path draws them
+    static bool useSoftwareOcclusion = false;
+    static int softwareTested = 0;
+    static int softwareOccluded = 0;
+    static float softwareRenderMs = 0.0f;
+    static float softwareTestMs = 0.0f;
+    static OcclusionRasterizer::BenchmarkResult softwareBenchmark;
+
+    // Startup program creation, with the program cache's share of it
+    static float programsMs = 0.0f;
+    static ProgramCache::Stats programStats;
+
+    // Every program created again without and with the cache, requested from the UI
+    static bool runProgramBenchmark = false;
+    static float programColdMs = 0.0f;
+    static float programWarmMs = 0.0f;
+
+    // Render queue counters of the last frame
+    static int queueDraws = 0;
+    static int queueStateChanges = 0;
+
+    // Instanced ogre heads on a grid, the first movingInstances of them bob up and down
+    static int instanceCount = 0;
+    static int movingInstances = 1000;
+    static bool animateInstances = true;
+
 };
 
 SceneBasic_Uniform::SceneBasic_Uniform() :
-    plane(30.0f, 30.0f, 100, 100, 5, 5)
+    plane(30.0f, 30.0f, 100, 100, 5, 5),
+    torus(0.7f, 0.3f, 16, 16),
+    materials(1024, 1024)
 {
-    mesh = ObjMesh::load("media/bs_ears.obj", false, true);
+    ObjMesh::LoadOptions options;
+    options.genTangents = true;
+    options.vertexFormat = VertexFormat::compact();
+    options.keepOccluder = true;
+    meshLoad = ObjMesh::loadAsync("media/bs_ears.obj", options);
 }
 
 // TODO: Make a texture holder singleton class instance for easy access.
@@ -69,6 +159,14 @@ enum ETextures
 
 static std::array<GLuint, TEX_MAX_NUM> textureArray;
 
+// Material ids in SceneBasic_Uniform::materials, in the order they are added
+enum EMaterials
+{
+    MAT_BRICK,
+    MAT_OGRE,
+    MAT_MAX_NUM,
+};
+
 bool SceneBasic_Uniform::initScene(Camera* camera)
 {
     if (!compile())
@@ -95,6 +193,11 @@ bool SceneBasic_Uniform::initScene(Camera* camera)
         Configs::perlinHeight,
         Configs::perlinPeriodic);
 
+    // Moss is mixed in on every material, its layer is shared
+    materials.add("media/texture/Brick_Wall_017_basecolor.jpg", "media/texture/Brick_Wall_017_normal.jpg", "media/texture/moss.png");
+    materials.add("media/texture/ogre_diffuse.png", "media/texture/ogre_normalmap.png", "media/texture/moss.png");
+    materials.build();
+
     return true;
 }
 
@@ -116,7 +219,15 @@ namespace program
     {
         TEXTURE_MIXED_VERT_DEFAULT,
         TEXTURE_MIXED_VERT_WAVE,
+        TEXTURE_MIXED_VERT_PACKED,
+        TEXTURE_MIXED_VERT_INDIRECT,
+        TEXTURE_MIXED_VERT_INSTANCED,
+        TEXTURE_MIXED_VERT_PACKED_INSTANCED,
         TEXTURE_MIXED_FRAG_DEFAULT,
+        TEXTURE_MIXED_FRAG_ARRAY,
+        HIZ_DOWNSAMPLE,
+        HIZ_CULL,
+        GPU_CULL,
         
         MAX,
     };
@@ -135,6 +246,24 @@ namespace ubo
     GLuint MATRICES_INDEX = 0;
 }
 
+// Shader file of every program
+static std::array<const char*, program::MAX> programFiles()
+{
+    std::array<const char*, program::MAX> files;
+    files[program::TEXTURE_MIXED_VERT_DEFAULT] = "shader/TextureMixed.vert";
+    files[program::TEXTURE_MIXED_VERT_WAVE] = "shader/TextureMixedWave.vert";
+    files[program::TEXTURE_MIXED_VERT_PACKED] = "shader/TextureMixedPacked.vert";
+    files[program::TEXTURE_MIXED_VERT_INDIRECT] = "shader/TextureMixedIndirect.vert";
+    files[program::TEXTURE_MIXED_VERT_INSTANCED] = "shader/TextureMixedInstanced.vert";
+    files[program::TEXTURE_MIXED_VERT_PACKED_INSTANCED] = "shader/TextureMixedPackedInstanced.vert";
+    files[program::TEXTURE_MIXED_FRAG_DEFAULT] = "shader/TextureMixed.frag";
+    files[program::TEXTURE_MIXED_FRAG_ARRAY] = "shader/TextureMixedArray.frag";
+    files[program::HIZ_DOWNSAMPLE] = "shader/HiZDownsample.cs";
+    files[program::HIZ_CULL] = "shader/HiZCull.cs";
+    files[program::GPU_CULL] = "shader/GpuCull.cs";
+    return files;
+}
+
 std::array<GLuint, pipeline::MAX> PipelineName;
 std::array<GLuint, program::MAX> ProgramName;
 std::array<GLuint, ubo::MAX> UBOName;
@@ -147,16 +276,10 @@ void SceneBasic_Uniform::setupUBO()
     // mat4:MVP, mat4:ModelViewMatrix, mat3:NormalMatrix
     // (READ std140 specifications) https://www.khronos.org/opengl/wiki/Talk:Uniform_Buffer_Object
     // If the member is a three-component vector with components consuming N basic machine units, the base alignment is 4N.
-    GLsizeiptr uboSize = 3 * sizeof(glm::mat4);
-
-    glGenBuffers(1, &UBOName[ubo::MATRICES]);
-
-    glBindBuffer(GL_UNIFORM_BUFFER, UBOName[ubo::MATRICES]);
-    glBufferData(GL_UNIFORM_BUFFER, uboSize, 0, GL_STATIC_DRAW);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-    // Define the range of the buffer that links to a uniform binding point
-    glBindBufferRange(GL_UNIFORM_BUFFER, ubo::MATRICES_INDEX, UBOName[ubo::MATRICES], 0, uboSize);
+    // Every draw streams its own matrices block, setMatrices() binds its range at MATRICES_INDEX.
+    // 4 MB per frame holds the blocks of the whole draw stress test.
+    matrixRing = std::make_unique<UniformRing>(4 * 1024 * 1024);
+    UBOName[ubo::MATRICES] = matrixRing->buffer();
 }
 
 bool SceneBasic_Uniform::compile()
@@ -165,25 +288,24 @@ bool SceneBasic_Uniform::compile()
 
 	try
     {
-        ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT] = sm.Create();
-        ProgramName[program::TEXTURE_MIXED_VERT_WAVE] = sm.Create();
-        ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT] = sm.Create();
+        // Each program is one separable stage, warm starts load the linked binaries from the program cache.
+        // The rest are compiled as one batch, in parallel where the driver or shared contexts allow.
+        auto compileStart = std::chrono::steady_clock::now();
+        std::vector<GLuint> programs = sm.CreatePrograms(programFiles());
+        std::copy(programs.begin(), programs.end(), ProgramName.begin());
 
-        glAttachShader(ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT], sm.Compile("shader/TextureMixed.vert")); GLERR;
-        glAttachShader(ProgramName[program::TEXTURE_MIXED_VERT_WAVE], sm.Compile("shader/TextureMixedWave.vert")); GLERR;
-        glAttachShader(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], sm.Compile("shader/TextureMixed.frag")); GLERR;
+        Configs::programStats = sm.GetProgramCache().stats();
+        Configs::programsMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - compileStart).count();
+        LOG_INFO("Programs ready in {:.1f} ms: {} from cache ({:.1f} ms saved), {} compiled, {} rejected",
+            Configs::programsMs, Configs::programStats.loaded, Configs::programStats.savedMs,
+            Configs::programStats.compiled, Configs::programStats.rejected);
 
-        sm.Link(ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT]);
-        sm.Link(ProgramName[program::TEXTURE_MIXED_VERT_WAVE]);
-        sm.Link(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT]);
-
-        sm.CleanupProgram(ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT]);
-        sm.CleanupProgram(ProgramName[program::TEXTURE_MIXED_VERT_WAVE]);
-        sm.CleanupProgram(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT]);
+        hiz.setPrograms(ProgramName[program::HIZ_DOWNSAMPLE], ProgramName[program::HIZ_CULL]);
+        gpuDriven.setProgram(ProgramName[program::GPU_CULL]);
 
         // Test pipeline program stages
-        glUseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_VERTEX_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT]); GLERR;
-        glUseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_FRAGMENT_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT]); GLERR;
+        sm.UseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_VERTEX_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT]); GLERR;
+        sm.UseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_FRAGMENT_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT]); GLERR;
         sm.ValidatePipeline(PipelineName[pipeline::TEXTURE_MIXED]);
 	}
     catch (ShaderManagerException&e)
@@ -198,7 +320,62 @@ bool SceneBasic_Uniform::compile()
     return true;
 }
 
-static void ImGui_Render()
+static void startStressBenchmark()
+{
+    Configs::StressBenchmark& bench = Configs::stressBenchmark;
+    bench.savedObjects = Configs::stressObjects;
+    bench.savedMultiDraw = Configs::useMultiDrawIndirect;
+    bench.savedGpuDriven = Configs::useGpuDriven;
+    bench.submitSum[0] = bench.submitSum[1] = 0.0;
+    bench.renderSum[0] = bench.renderSum[1] = 0.0;
+    bench.frame = 0;
+    bench.done = false;
+
+    // The CPU-driven paths only, the GPU-driven one submits the same way for any count
+    Configs::stressObjects = 10000;
+    Configs::useGpuDriven = false;
+    Configs::useMultiDrawIndirect = false;
+}
+
+// Called after every frame of a run with that frame's stress submit and whole render CPU times
+static void stepStressBenchmark(float submitMs, float renderMs)
+{
+    Configs::StressBenchmark& bench = Configs::stressBenchmark;
+    const int framesPerPath = Configs::StressBenchmark::WarmupFrames + Configs::StressBenchmark::Frames;
+
+    int path = bench.frame / framesPerPath;
+    if (bench.frame % framesPerPath >= Configs::StressBenchmark::WarmupFrames)
+    {
+        bench.submitSum[path] += submitMs;
+        bench.renderSum[path] += renderMs;
+    }
+
+    bench.frame++;
+    if (bench.frame == framesPerPath)
+    {
+        Configs::useMultiDrawIndirect = true;
+        return;
+    }
+    if (bench.frame < 2 * framesPerPath)
+        return;
+
+    for (int i = 0; i < 2; i++)
+    {
+        bench.submitMs[i] = (float)(bench.submitSum[i] / Configs::StressBenchmark::Frames);
+        bench.renderMs[i] = (float)(bench.renderSum[i] / Configs::StressBenchmark::Frames);
+    }
+    LOG_INFO("Stress benchmark, 10000 objects over {} frames: per-draw {:.3f} ms submit, {:.3f} ms frame; "
+        "multi-draw indirect {:.3f} ms submit, {:.3f} ms frame",
+        Configs::StressBenchmark::Frames, bench.submitMs[0], bench.renderMs[0], bench.submitMs[1], bench.renderMs[1]);
+
+    Configs::stressObjects = bench.savedObjects;
+    Configs::useMultiDrawIndirect = bench.savedMultiDraw;
+    Configs::useGpuDriven = bench.savedGpuDriven;
+    bench.frame = -1;
+    bench.done = true;
+}
+
+static void ImGui_Render(const UniformRing::Stats& ringStats)
 {
     // Create the frame
     ImGui_ImplOpenGL3_NewFrame();
@@ -371,6 +548,169 @@ static void ImGui_Render()
         ImGui::Separator();
         ImGui::Text("Camera Pos: %.3f, %.3f, %.3f", Configs::cameraPos.x, Configs::cameraPos.y, Configs::cameraPos.z);
 
+        // ----
+        ImGui::Separator();
+        ImGui::Text("Draw Stress Test:");
+        ImGui::SliderInt("Objects", &Configs::stressObjects, 0, 10000);
+        ImGui::Checkbox("Multi-Draw Indirect", &Configs::useMultiDrawIndirect);
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Submit all objects with glMultiDrawElementsIndirect instead of one draw each");
+            ImGui::EndTooltip();
+        }
+        ImGui::Text("Submit: %.3f ms CPU, %d draw calls", Configs::stressSubmitMs, Configs::stressDrawCalls);
+        ImGui::BeginDisabled(Configs::stressBenchmark.frame >= 0);
+        if (ImGui::Button("Benchmark 10k Per-Draw vs MDI"))
+            startStressBenchmark();
+        ImGui::EndDisabled();
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Draw 10000 objects for %d frames with each path and average the CPU times", Configs::StressBenchmark::Frames);
+            ImGui::EndTooltip();
+        }
+        if (Configs::stressBenchmark.done)
+        {
+            ImGui::Text("Per-draw: %.3f ms submit, %.3f ms frame", Configs::stressBenchmark.submitMs[0], Configs::stressBenchmark.renderMs[0]);
+            ImGui::Text("MDI: %.3f ms submit, %.3f ms frame", Configs::stressBenchmark.submitMs[1], Configs::stressBenchmark.renderMs[1]);
+        }
+
+        ImGui::Checkbox("Frustum Culling", &Configs::useFrustumCulling);
+        ImGui::Text("Culled: %d of %d objects (%.3f ms, batches of %d)", Configs::cullCulled, Configs::cullTested, Configs::cullMs, FrustumCuller::batchWidth());
+        if (ImGui::Button("Benchmark 1M Boxes"))
+            Configs::cullBenchmark = FrustumCuller::benchmark(1000000);
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Cull a million random boxes with SIMD batches and one by one");
+            ImGui::EndTooltip();
+        }
+        if (Configs::cullBenchmark.boxes > 0)
+        {
+            ImGui::SameLine();
+            ImGui::Text("%.3f ms, scalar %.3f ms", Configs::cullBenchmark.simdMs, Configs::cullBenchmark.scalarMs);
+        }
+
+        ImGui::Checkbox("Cull With BVH", &Configs::cullWithBvh);
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Walk the objects' bounding volume hierarchy instead of testing every object, %d nodes visited", Configs::bvhNodesVisited);
+            ImGui::EndTooltip();
+        }
+        if (Configs::pickedObject >= 0)
+            ImGui::Text("Picked: object %d, %.2f away", Configs::pickedObject, Configs::pickedDistance);
+        else
+            ImGui::Text("Picked: none (click an object)");
+
+        ImGui::BeginDisabled(!Configs::useMultiDrawIndirect);
+        ImGui::Checkbox("GPU-Driven", &Configs::useGpuDriven);
+        ImGui::EndDisabled();
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Cull every object and write the multi-draw commands in a compute pass,");
+            ImGui::Text("drawn with glMultiDrawElementsIndirectCount");
+            ImGui::EndTooltip();
+        }
+        if (Configs::useMultiDrawIndirect && Configs::useGpuDriven)
+            ImGui::Text("GPU: %d of %d objects drawn, %d in the frustum, %d batches", Configs::gpuDrawn, Configs::stressObjects, Configs::gpuFrustumVisible, Configs::gpuBatches);
+
+        ImGui::BeginDisabled(!Configs::useMultiDrawIndirect);
+        ImGui::Checkbox("Occlusion Culling (Hi-Z)", &Configs::useOcclusionCulling);
+        ImGui::EndDisabled();
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Test the multi-draw objects against a max-depth pyramid of the previous frame,");
+            ImGui::Text("then the ones it hid against this frame's, so none of them pop in late");
+            ImGui::EndTooltip();
+        }
+        if (Configs::useMultiDrawIndirect && Configs::useOcclusionCulling)
+        {
+            ImGui::Text("Occluded: %d of %d objects, %d found by the re-test", Configs::occlusionCulled, Configs::occlusionTested, Configs::occlusionLateVisible);
+            ImGui::Text("Depth pyramid: %d levels, %.3f ms GPU", Configs::hizLevels, Configs::hizPyramidMs);
+        }
+
+        ImGui::Checkbox("Software Occlusion", &Configs::useSoftwareOcclusion);
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Rasterize the ogre head into a 320 pixel wide depth buffer on the CPU,");
+            ImGui::Text("and drop the objects it hides before they are submitted.");
+            ImGui::Text("Not used in GPU-driven mode, which culls in compute");
+            ImGui::EndTooltip();
+        }
+        if (Configs::useSoftwareOcclusion)
+            ImGui::Text("Occluded: %d of %d objects (render %.3f ms, test %.3f ms)", Configs::softwareOccluded, Configs::softwareTested, Configs::softwareRenderMs, Configs::softwareTestMs);
+        if (ImGui::Button("Benchmark Rasterizer"))
+            Configs::softwareBenchmark = OcclusionRasterizer::benchmark();
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Render 500 box occluders and test a million boxes against them");
+            ImGui::EndTooltip();
+        }
+        if (Configs::softwareBenchmark.tests > 0)
+        {
+            ImGui::SameLine();
+            ImGui::Text("%.0f occluders/ms, %.0f tests/ms", Configs::softwareBenchmark.occludersPerMs, Configs::softwareBenchmark.testsPerMs);
+        }
+
+        if (ImGui::Button("Benchmark BVH (100k, 1M)"))
+        {
+            Configs::bvhBenchmark[0] = Bvh::benchmark(100000);
+            Configs::bvhBenchmark[1] = Bvh::benchmark(1000000);
+        }
+        for (const Bvh::BenchmarkResult& result : Configs::bvhBenchmark)
+        {
+            if (result.objects == 0)
+                continue;
+            ImGui::Text("%zu: build %.1f ms, refit %.1f ms, frustum %.3f ms (flat %.3f ms)",
+                result.objects, result.buildMs, result.refitMs, result.frustumMs, result.linearMs);
+        }
+
+        ImGui::Text("Programs: %.1f ms at startup, %zu cached (%.1f ms saved), %zu compiled",
+            Configs::programsMs, Configs::programStats.loaded, Configs::programStats.savedMs, Configs::programStats.compiled);
+        if (ImGui::Button("Benchmark Program Cache"))
+            Configs::runProgramBenchmark = true;
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Create every program again, compiled from source and then from the cached binaries");
+            ImGui::EndTooltip();
+        }
+        if (Configs::programColdMs > 0.0f)
+        {
+            ImGui::SameLine();
+            ImGui::Text("cold %.1f ms, warm %.1f ms", Configs::programColdMs, Configs::programWarmMs);
+        }
+        ImGui::Text("Render queue: %d draws, %d state changes", Configs::queueDraws, Configs::queueStateChanges);
+        ImGui::Text("GL binds: %zu issued, %zu skipped", Configs::glStats.issued, Configs::glStats.skipped);
+        ImGui::Checkbox("Validate GL State Cache", &GLState::validate);
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Check every skipped bind against glGet*, %zu stale bindings found", Configs::glStats.mismatches);
+            ImGui::EndTooltip();
+        }
+        ImGui::Text("Matrices ring: %.1f KB/frame, %zu blocks", ringStats.bytes / 1024.0f, ringStats.blocks);
+        ImGui::Text("Ring stalls: %zu (%.3f ms)", ringStats.stalls, ringStats.stallMs);
+
+        // ----
+        ImGui::Separator();
+        ImGui::Text("Instancing:");
+        ImGui::SliderInt("Heads", &Configs::instanceCount, 0, 100000);
+        ImGui::Checkbox("Animate Heads", &Configs::animateInstances);
+        ImGui::SliderInt("Moving Heads", &Configs::movingInstances, 0, 100000);
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("Only the moving heads are uploaded again each frame");
+            ImGui::EndTooltip();
+        }
+
         // ----
         ImGui::Separator();
         ImGui::Text("Average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
@@ -407,24 +747,49 @@ void SceneBasic_Uniform::update(float t)
 
     Configs::cameraPos = camera->Position;
 
+    // Swap the placeholder for the mesh once its background load is done
+    if (meshLoad)
+    {
+        mesh = meshLoad->poll();
+        if (mesh)
+        {
+            meshLoad.reset();
+            GeometryArena::instance().logStats();
+        }
+        else if (meshLoad->failed())
+        {
+            // Already logged by the loader, the placeholder cube stays
+            meshLoad.reset();
+        }
+    }
+
     sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT], "LightPosition", view * glm::vec4(Configs::lightDist * cos(Configs::lightAngle), 1.0f, Configs::lightDist * sin(Configs::lightAngle), 1.0f));
+    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_PACKED], "LightPosition", view * glm::vec4(Configs::lightDist * cos(Configs::lightAngle), 1.0f, Configs::lightDist * sin(Configs::lightAngle), 1.0f));
+    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_INDIRECT], "LightPosition", view * glm::vec4(Configs::lightDist * cos(Configs::lightAngle), 1.0f, Configs::lightDist * sin(Configs::lightAngle), 1.0f));
+    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_INSTANCED], "LightPosition", view * glm::vec4(Configs::lightDist * cos(Configs::lightAngle), 1.0f, Configs::lightDist * sin(Configs::lightAngle), 1.0f));
+    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_PACKED_INSTANCED], "LightPosition", view * glm::vec4(Configs::lightDist * cos(Configs::lightAngle), 1.0f, Configs::lightDist * sin(Configs::lightAngle), 1.0f));
+
+    // Mixed texture uniforms, the same for the texture array variant
+    for (GLuint fragProgram : { ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], ProgramName[program::TEXTURE_MIXED_FRAG_ARRAY] })
+    {
+        sm.SetUniform(fragProgram, "UseBlinnPhong", Configs::useBlinnPhong);
+        sm.SetUniform(fragProgram, "UseTextures", Configs::useTextures);
+        sm.SetUniform(fragProgram, "UseTextureMix", Configs::useTextureMix);
 
-    // Default mixed texture uniforms
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "UseBlinnPhong", Configs::useBlinnPhong);
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "UseTextures", Configs::useTextures);
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "UseTextureMix", Configs::useTextureMix);
-    
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "UseToon", Configs::useToon);
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "UseAdditiveToon", Configs::useAdditiveToon);
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "ToonFraction", Configs::toonFraction);
-    
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "Light.Ld", Configs::lightLd);
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "Light.Ls", Configs::lightLs);
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "Light.La", Configs::lightLa);
-    
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "Material.Ka", Configs::matKa);
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "Material.Ks", Configs::matKs);
-    sm.SetUniform(ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT], "Material.Shininess", Configs::matShininess);
+        sm.SetUniform(fragProgram, "UseToon", Configs::useToon);
+        sm.SetUniform(fragProgram, "UseAdditiveToon", Configs::useAdditiveToon);
+        sm.SetUniform(fragProgram, "ToonFraction", Configs::toonFraction);
+
+        sm.SetUniform(fragProgram, "Light.Ld", Configs::lightLd);
+        sm.SetUniform(fragProgram, "Light.Ls", Configs::lightLs);
+        sm.SetUniform(fragProgram, "Light.La", Configs::lightLa);
+
+        sm.SetUniform(fragProgram, "Material.Ka", Configs::matKa);
+        sm.SetUniform(fragProgram, "Material.Ks", Configs::matKs);
+        sm.SetUniform(fragProgram, "Material.Shininess", Configs::matShininess);
+    }
+
+    updateInstances();
 
     // Animation uniforms
     if (Configs::useWaveAnim)
@@ -438,81 +803,461 @@ void SceneBasic_Uniform::update(float t)
 
 void SceneBasic_Uniform::render()
 {
-    glUseProgram(0);
-    glBindProgramPipeline(PipelineName[pipeline::TEXTURE_MIXED]); GLERR;
+    auto renderStart = std::chrono::steady_clock::now();
+    matrixRing->beginFrame();
+
+    GLState::resetStats();
+    sm.UseProgram(0);
+    sm.BindPipeline(PipelineName[pipeline::TEXTURE_MIXED]); GLERR;
 
     glClearColor(Configs::bgColor.x, Configs::bgColor.y, Configs::bgColor.z, Configs::bgColor.w);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    std::function<void()> funcRender =
-        [&]()
+    Configs::cullTested = Configs::cullCulled = 0;
+    Configs::cullMs = 0.0f;
+    Frustum frustum = Frustum::fromMatrix(projection * view);
+
+    renderQueue.begin(view, 100.0f);
+    if (Configs::useSoftwareOcclusion)
+        occlusion.begin(projection * view);
+    submitScene(frustum);
+
+    // The stress timing covers the queue as well, so both paths pay for the two scene draws
+    auto stressStart = std::chrono::steady_clock::now();
+    submitStressObjects(frustum);
+
+    // The cube and torus have no tangents, give the shader a constant one instead of (0, 0, 0, 1)
+    glVertexAttrib4f(3, 1.0f, 0.0f, 0.0f, 1.0f);
+    renderQueue.execute([&](const glm::mat4& packetModel)
     {
-        // Render Plane
-        if (Configs::usePerlinTexture)
+        model = packetModel;
+        setMatrices();
+    });
+    drawStressObjects();
+
+    Configs::stressSubmitMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - stressStart).count();
+    Configs::queueStateChanges = (int)renderQueue.stats().stateChanges();
+    Configs::queueDraws = (int)renderQueue.stats().draws;
+
+    renderInstances();
+
+    Configs::glStats = GLState::stats();
+
+    // Frame time up to the UI, which doesn't depend on the path
+    if (Configs::stressBenchmark.frame >= 0)
+        stepStressBenchmark(Configs::stressSubmitMs, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - renderStart).count());
+
+    // ImGui renders on top of everything. It binds behind the state cache's back.
+    ImGui_Render(matrixRing->stats());
+    GLState::invalidate();
+
+    if (Configs::runProgramBenchmark)
+    {
+        Configs::runProgramBenchmark = false;
+        benchmarkPrograms();
+    }
+
+    // Clicks outside the ImGui windows pick the stress test object under the cursor
+    ImGuiIO& io = ImGui::GetIO();
+    if (io.MouseClicked[0] && !io.WantCaptureMouse)
+        pickObject(io.MousePos.x, io.MousePos.y);
+
+    matrixRing->endFrame();
+}
+
+void SceneBasic_Uniform::submitScene(const Frustum& frustum)
+{
+    auto isVisible = [&](const Aabb& bounds, const glm::mat4& packetModel) {
+        if (!Configs::useFrustumCulling)
+            return true;
+
+        Configs::cullTested++;
+        bool visible = frustum.intersects(FrustumCuller::worldBox(bounds, packetModel));
+        if (!visible)
+            Configs::cullCulled++;
+        return visible;
+    };
+
+    // Moss is mixed in on every object
+    RenderQueue::Packet packet;
+    packet.pipeline = PipelineName[pipeline::TEXTURE_MIXED];
+    packet.fragmentProgram = ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT];
+
+    // Plane
+    if (Configs::usePerlinTexture)
+        packet.textures = { textureArray[TEX_PERLIN_NOISE], 0, textureArray[TEX_MOSS] };
+    else
+        packet.textures = { textureArray[TEX_DIFFUSE_MAP], textureArray[TEX_NORMAL_MAP], textureArray[TEX_MOSS] };
+
+    packet.vertexProgram = ProgramName[Configs::useWaveAnim ? program::TEXTURE_MIXED_VERT_WAVE : program::TEXTURE_MIXED_VERT_DEFAULT];
+    packet.drawable = &plane;
+    packet.model = glm::mat4(1.0f);
+    if (isVisible(plane.getBounds(), packet.model))
+        renderQueue.submit(packet);
+
+    // Mesh, wave animation cant be used on the ogre head, packed vertex formats need their decoding stage
+    packet.textures = { textureArray[TEX_OGRE_DIFFUSE_MAP], textureArray[TEX_OGRE_NORMAL_MAP], textureArray[TEX_MOSS] };
+    packet.vertexProgram = ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT];
+    packet.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 2.0f, 0.0f));
+
+    if (mesh)
+    {
+        if (mesh->getVertexFormat().isPacked())
         {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textureArray[TEX_PERLIN_NOISE]);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_PACKED], "PositionScale", mesh->getPositionScale());
+            sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_PACKED], "PositionOffset", mesh->getPositionOffset());
+            packet.vertexProgram = ProgramName[program::TEXTURE_MIXED_VERT_PACKED];
         }
-        else
+        packet.drawable = mesh.get();
+    }
+    else
+    {
+        // Placeholder: the mesh bounds once they are known, a unit cube before that
+        if (meshLoad && meshLoad->hasBounds())
         {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textureArray[TEX_DIFFUSE_MAP]);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, textureArray[TEX_NORMAL_MAP]);
+            const Aabb& bounds = meshLoad->bounds();
+            packet.model = glm::translate(packet.model, (bounds.min + bounds.max) * 0.5f);
+            packet.model = glm::scale(packet.model, glm::max(bounds.max - bounds.min, glm::vec3(0.01f)));
         }
+        packet.drawable = &cube;
+    }
 
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, textureArray[TEX_MOSS]);
+    const TriangleMesh& packetMesh = mesh ? (const TriangleMesh&)*mesh : (const TriangleMesh&)cube;
+    if (isVisible(packetMesh.getBounds(), packet.model))
+    {
+        renderQueue.submit(packet);
+        if (mesh && Configs::useSoftwareOcclusion)
+            occlusion.addOccluder(mesh->getOccluder(), packet.model);
+    }
+}
 
-        model = glm::mat4(1.0f);
-        setMatrices();
+void SceneBasic_Uniform::submitStressObjects(const Frustum& frustum)
+{
+    int columns = (int)std::ceil(std::sqrt((float)Configs::stressObjects));
+    float spacing = 0.15f;
+    glm::vec3 origin(-0.5f * spacing * (columns - 1), 0.5f, -0.5f * spacing * (columns - 1));
+
+    auto objectModel = [&](int i) {
+        glm::mat4 m = glm::translate(glm::mat4(1.0f), origin + glm::vec3((i % columns) * spacing, 0.0f, (i / columns) * spacing));
+        return glm::scale(m, glm::vec3(0.08f));
+    };
+    auto objectMesh = [&](int i) -> const TriangleMesh& {
+        return (i % 2) ? (const TriangleMesh&)torus : (const TriangleMesh&)cube;
+    };
 
-        // Simply, swap pipeline vertex program stages
-        if (Configs::useWaveAnim)
+    // The grid only changes with the object count, the tree and the GPU-driven objects are built again then
+    if (objectBvhCount != Configs::stressObjects)
+    {
+        objectBvh.clear();
+        for (int i = 0; i < Configs::stressObjects; i++)
+            objectBvh.insert(FrustumCuller::worldBox(objectMesh(i).getBounds(), objectModel(i)), (uint32_t)i);
+        objectBvh.rebuild();
+        objectBvhCount = Configs::stressObjects;
+
+        gpuDriven.clear();
+        GLuint gpuMeshes[2] = { gpuDriven.addMesh(cube), gpuDriven.addMesh(torus) };
+        for (int i = 0; i < Configs::stressObjects; i++)
         {
-            glUseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_VERTEX_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_VERT_WAVE]);
+            // Meshes outside the arena were refused, their objects are left out
+            if (gpuMeshes[i % 2] != ~0u)
+                gpuDriven.addObject(gpuMeshes[i % 2], objectModel(i), (GLuint)((i / columns) % MAT_MAX_NUM));
         }
-        else
+    }
+
+    // Culled on the GPU, see drawGpuDriven(). Neither the CPU frustum culling nor the software occlusion apply there.
+    if (Configs::stressObjects <= 0 || (Configs::useMultiDrawIndirect && Configs::useGpuDriven))
+        return;
+
+    // Only the objects whose box is in view are drawn. The tree only visits the nodes around the
+    // frustum, the flat culler tests every object in grid order.
+    if (Configs::useFrustumCulling && Configs::cullWithBvh)
+    {
+        auto cullStart = std::chrono::steady_clock::now();
+        visibleObjects.clear();
+        Configs::bvhNodesVisited = (int)objectBvh.query(frustum, visibleObjects);
+
+        Configs::cullTested += Configs::stressObjects;
+        Configs::cullCulled += Configs::stressObjects - (int)visibleObjects.size();
+        Configs::cullMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+    }
+    else if (Configs::useFrustumCulling)
+    {
+        culler.clear();
+        culler.reserve(Configs::stressObjects);
+        for (int i = 0; i < Configs::stressObjects; i++)
+            culler.add(objectMesh(i).getBounds(), objectModel(i));
+        culler.cull(frustum);
+
+        Configs::cullTested += (int)culler.stats().tested;
+        Configs::cullCulled += (int)culler.stats().culled();
+        Configs::cullMs += (float)culler.stats().ms;
+    }
+
+    auto forEachInFrustum = [&](auto&& fn) {
+        if (!Configs::useFrustumCulling)
         {
-            glUseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_VERTEX_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT]);
+            for (int i = 0; i < Configs::stressObjects; i++)
+                fn(i);
+            return;
         }
+        for (uint32_t i : Configs::cullWithBvh ? visibleObjects : culler.visible())
+            fn((int)i);
+    };
 
-        plane.render();
+    // Of those, the ones the occluders don't hide in the software depth buffer
+    if (Configs::useSoftwareOcclusion)
+    {
+        occlusion.render();
+
+        occlusionCandidates.clear();
+        occlusionBoxes.clear();
+        forEachInFrustum([&](int i) {
+            occlusionCandidates.push_back((uint32_t)i);
+            occlusionBoxes.push_back(FrustumCuller::worldBox(objectMesh(i).getBounds(), objectModel(i)));
+        });
+
+        occlusionVisible.clear();
+        occlusion.test(occlusionBoxes, occlusionVisible);
+        for (uint32_t& i : occlusionVisible)
+            i = occlusionCandidates[i];
+
+        const OcclusionRasterizer::Stats& stats = occlusion.stats();
+        Configs::softwareTested = (int)stats.tested;
+        Configs::softwareOccluded = (int)stats.occluded;
+        Configs::softwareRenderMs = (float)stats.renderMs;
+        Configs::softwareTestMs = (float)stats.testMs;
+    }
 
-        // Wave animation cant be used on the ogre head
-        if (Configs::useWaveAnim)
-            glUseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_VERTEX_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT]);
+    auto forEachVisible = [&](auto&& fn) {
+        if (!Configs::useSoftwareOcclusion)
+        {
+            forEachInFrustum(fn);
+            return;
+        }
+        for (uint32_t i : occlusionVisible)
+            fn((int)i);
+    };
 
-        // Render the Mesh
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureArray[TEX_OGRE_DIFFUSE_MAP]);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, textureArray[TEX_OGRE_NORMAL_MAP]);
+    if (Configs::useMultiDrawIndirect)
+    {
+        // Every draw picks its material from the array, rows alternate between them.
+        // The occlusion test finds each draw's box by its index, so a skipped draw adds no box.
+        indirect.clear();
+        hiz.clear();
+        forEachVisible([&](int i) {
+            glm::mat4 m = objectModel(i);
+            glm::mat4 mv = view * m;
+            if (indirect.add(objectMesh(i), 0, { projection * mv, mv, mv, (GLuint)((i / columns) % MAT_MAX_NUM) }))
+                hiz.add(FrustumCuller::worldBox(objectMesh(i).getBounds(), m));
+        });
+    }
+    else
+    {
+        RenderQueue::Packet packet;
+        packet.pipeline = PipelineName[pipeline::TEXTURE_MIXED];
+        packet.vertexProgram = ProgramName[program::TEXTURE_MIXED_VERT_DEFAULT];
+        packet.fragmentProgram = ProgramName[program::TEXTURE_MIXED_FRAG_DEFAULT];
+        packet.textures = { textureArray[TEX_DIFFUSE_MAP], textureArray[TEX_NORMAL_MAP], textureArray[TEX_MOSS] };
+
+        int draws = 0;
+        forEachVisible([&](int i) {
+            packet.drawable = &objectMesh(i);
+            packet.model = objectModel(i);
+            renderQueue.submit(packet);
+            draws++;
+        });
+        Configs::stressDrawCalls = draws;
+    }
+}
 
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 2.0f, 0.0f));
-        setMatrices();
-        mesh->render();
+void SceneBasic_Uniform::drawStressObjects()
+{
+    if (!Configs::useMultiDrawIndirect || Configs::stressObjects <= 0)
+        return;
+
+    materials.bind();
+
+    // Neither mesh has tangents
+    glVertexAttrib4f(3, 1.0f, 0.0f, 0.0f, 1.0f);
+
+    sm.UseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_VERTEX_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_VERT_INDIRECT]);
+    sm.UseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_FRAGMENT_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_FRAG_ARRAY]);
+
+    if (Configs::useGpuDriven)
+    {
+        drawGpuDriven();
+        return;
+    }
+
+    if (!Configs::useOcclusionCulling)
+    {
+        indirect.submit(GL_TRIANGLES);
+        Configs::stressDrawCalls = (int)indirect.stats().multiDraws;
+        return;
+    }
+
+    // Whatever the previous frame's depth does not hide, then whatever it hid that this frame's does not
+    hiz.beginFrame();
+    indirect.upload();
+    hiz.cullEarly(indirect);
+    indirect.draw(GL_TRIANGLES, nullptr, hiz.earlyCommands());
+
+    hiz.build(projection * view);
+    hiz.cullLate(indirect);
+    indirect.draw(GL_TRIANGLES, nullptr, hiz.lateCommands());
+    hiz.endFrame();
+    Configs::stressDrawCalls = (int)indirect.stats().multiDraws;
+
+    const HiZCuller::Stats& stats = hiz.stats();
+    Configs::occlusionTested = (int)stats.tested;
+    Configs::occlusionCulled = (int)stats.culled();
+    Configs::occlusionLateVisible = (int)stats.lateVisible;
+    Configs::hizPyramidMs = (float)stats.pyramidMs;
+    Configs::hizLevels = hiz.levels();
+}
+
+void SceneBasic_Uniform::drawGpuDriven()
+{
+    // Nothing here depends on the object count, the compute passes cull and write the commands
+    const HiZCuller* occlusion = Configs::useOcclusionCulling ? &hiz : nullptr;
+    gpuDriven.beginFrame();
+    gpuDriven.cull(GpuDrivenRenderer::EARLY, view, projection, occlusion);
+    gpuDriven.draw(GL_TRIANGLES, GpuDrivenRenderer::EARLY);
+
+    if (occlusion)
+    {
+        hiz.beginFrame();
+        hiz.build(projection * view);
+        gpuDriven.cull(GpuDrivenRenderer::LATE, view, projection, occlusion);
+        gpuDriven.draw(GL_TRIANGLES, GpuDrivenRenderer::LATE);
+        hiz.endFrame();
+    }
+    gpuDriven.endFrame();
+
+    const GpuDrivenRenderer::Stats& stats = gpuDriven.stats();
+    Configs::stressDrawCalls = (int)stats.batches * (occlusion ? 2 : 1);
+    Configs::gpuDrawn = (int)stats.drawn();
+    Configs::gpuFrustumVisible = (int)stats.frustumVisible;
+    Configs::gpuBatches = (int)stats.batches;
+
+    Configs::occlusionTested = (int)stats.frustumVisible;
+    Configs::occlusionCulled = (int)(stats.frustumVisible - stats.drawn());
+    Configs::occlusionLateVisible = (int)stats.lateVisible;
+    Configs::hizPyramidMs = (float)hiz.stats().pyramidMs;
+    Configs::hizLevels = hiz.levels();
+}
+
+void SceneBasic_Uniform::pickObject(float x, float y)
+{
+    // Cursor to a world space ray through the near and far planes
+    glm::vec2 ndc(2.0f * x / (float)width - 1.0f, 1.0f - 2.0f * y / (float)height);
+    glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+    glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    Bvh::RayHit hit = objectBvh.raycast(origin, glm::normalize(direction), glm::length(direction));
+    Configs::pickedObject = hit.valid() ? (int)hit.object : -1;
+    Configs::pickedDistance = hit.distance;
+}
+
+void SceneBasic_Uniform::updateInstances()
+{
+    const float spacing = 0.8f;
+    size_t count = (size_t)Configs::instanceCount;
+    int columns = std::max(1, (int)std::ceil(std::sqrt((float)count)));
+
+    auto instanceModel = [&](size_t i, float height) {
+        glm::vec3 position(((int)(i % columns) - 0.5f * (columns - 1)) * spacing, height, ((int)(i / columns) - 0.5f * (columns - 1)) * spacing);
+        glm::mat4 m = glm::translate(glm::mat4(1.0f), position);
+        m = glm::rotate(m, (float)i * 0.7f, glm::vec3(0.0f, 1.0f, 0.0f));
+        return glm::scale(m, glm::vec3(0.3f));
     };
 
-    //glBindProgramPipeline(PipelineName[pipeline::DIFFUSE]); GLERR;
-    funcRender();
+    // Lay out the whole grid again when the count changes
+    if (count != instanceData.size())
+    {
+        instanceData.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            instanceData[i].model = instanceModel(i, 0.5f);
+            instanceData[i].material = (GLuint)(i % MAT_MAX_NUM);
+        }
+        instances.assign(instanceData);
+    }
+
+    if (!Configs::animateInstances || count == 0)
+        return;
+
+    // Only the moving range is uploaded
+    size_t moving = std::min(count, (size_t)Configs::movingInstances);
+    for (size_t i = 0; i < moving; i++)
+        instanceData[i].model = instanceModel(i, 0.5f + 0.25f * sin(timePrev * 2.0f + (float)i * 0.3f));
+    instances.update(0, std::span(instanceData.data(), moving));
+}
+
+void SceneBasic_Uniform::renderInstances()
+{
+    if (!mesh || instances.size() == 0)
+        return;
+
+    // Heads alternate between the materials, all in one draw
+    materials.bind();
+    sm.UseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_FRAGMENT_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_FRAG_ARRAY]);
+
+    if (mesh->getVertexFormat().isPacked())
+    {
+        sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_PACKED_INSTANCED], "PositionScale", mesh->getPositionScale());
+        sm.SetUniform(ProgramName[program::TEXTURE_MIXED_VERT_PACKED_INSTANCED], "PositionOffset", mesh->getPositionOffset());
+        sm.UseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_VERTEX_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_VERT_PACKED_INSTANCED]);
+    }
+    else
+    {
+        sm.UseProgramStages(PipelineName[pipeline::TEXTURE_MIXED], GL_VERTEX_SHADER_BIT, ProgramName[program::TEXTURE_MIXED_VERT_INSTANCED]);
+    }
+
+    // The instances carry their own model matrix, the shared one is identity
+    model = glm::mat4(1.0f);
+    setMatrices();
+    mesh->renderInstanced(instances);
+}
+
+void SceneBasic_Uniform::benchmarkPrograms()
+{
+    // Throwaway programs, the scene's own are untouched
+    auto createAll = [&](bool useCache) {
+        sm.GetProgramCache().setEnabled(useCache);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<GLuint> programs = sm.CreatePrograms(programFiles());
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        for (GLuint program : programs)
+            GLState::deleteProgram(program);
+        return ms;
+    };
+
+    try
+    {
+        Configs::programColdMs = createAll(false);
+        Configs::programWarmMs = createAll(true);
+    }
+    catch (ShaderManagerException& e)
+    {
+        LOG_CRITICAL(e.what());
+    }
+    sm.GetProgramCache().setEnabled(true);
 
-    // ImGui renders on top of everything
-    ImGui_Render();
+    LOG_INFO("Program cache benchmark, {} programs: cold {:.1f} ms, warm {:.1f} ms, {:.1f} ms saved",
+        (int)program::MAX, Configs::programColdMs, Configs::programWarmMs, Configs::programColdMs - Configs::programWarmMs);
 }
 
 void SceneBasic_Uniform::setMatrices()
 {
     glm::mat4 mv = view * model; //we create a model view matrix
 
-    glBindBuffer(GL_UNIFORM_BUFFER, UBOName[ubo::MATRICES]);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(projection * mv));
-    glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(mv));
-    glBufferSubData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(mv));
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    // MVP, ModelViewMatrix, NormalMatrix (as mat4), written to the ring and bound at their offset
+    std::array<glm::mat4, 3> matrices = { projection * mv, mv, mv };
+    matrixRing->bind(ubo::MATRICES_INDEX, matrices.data(), sizeof(matrices));
 }
 
 void SceneBasic_Uniform::resize(int w, int h)
@@ -520,5 +1265,7 @@ void SceneBasic_Uniform::resize(int w, int h)
     glViewport(0, 0, w, h);
     width = w;
     height = h;
+    hiz.resize(w, h);
+    occlusion.resize(320, std::max(1, 320 * h / std::max(1, w)));
     projection = glm::perspective(glm::radians(70.0f), (float)w / h, 0.3f, 100.0f);
 }
@@ -3,6 +3,18 @@
 #include "helper/scene.h"
 #include "helper/plane.h"
 #include "helper/cube.h"
+#include "helper/objmesh.h"
+#include "helper/torus.h"
+#include "helper/indirectrenderer.h"
+#include "helper/instancebuffer.h"
+#include "helper/uniformring.h"
+#include "helper/renderqueue.h"
+#include "helper/texturearray.h"
+#include "helper/frustumculler.h"
+#include "helper/bvh.h"
+#include "helper/hizculler.h"
+#include "helper/gpudrivenrenderer.h"
+#include "helper/occlusionrasterizer.h"
 
 class GLSLProgram;
 
@@ -20,13 +32,63 @@ private:
 
     Plane plane;
     Cube cube;
+    Torus torus;
     std::unique_ptr<ObjMesh> mesh;
+    std::unique_ptr<ObjMesh::AsyncLoad> meshLoad;  // Until the mesh is ready, its bounds are drawn with cube
 
     float timePrev = 0.0f, rotSpeed = 0.5f;
 
+    // Per-draw Matrices blocks, created with the programs
+    std::unique_ptr<UniformRing> matrixRing;
+
+    // Plane, mesh and the per-object stress test draws, sorted by state each frame
+    RenderQueue renderQueue;
+    void submitScene(const Frustum& frustum);
+
+    // Collects the visible stress test objects into one multi-draw, or submits one packet per object
+    IndirectRenderer indirect;
+    FrustumCuller culler;
+    void submitStressObjects(const Frustum& frustum);
+
+    // Draws the multi-draw after the queue, so the scene is in the depth buffer. With occlusion
+    // culling the draws are tested against a depth pyramid twice, around building this frame's.
+    HiZCuller hiz;
+    void drawStressObjects();
+
+    // The same objects kept on the GPU, which culls them and writes their commands itself
+    GpuDrivenRenderer gpuDriven;
+    void drawGpuDriven();
+
+    // Software depth buffer the ogre head is drawn into each frame, the stress test objects in the frustum
+    // are tested against it. Candidates maps the boxes tested back to objects.
+    OcclusionRasterizer occlusion;
+    std::vector<uint32_t> occlusionCandidates;
+    std::vector<Aabb> occlusionBoxes;
+    std::vector<uint32_t> occlusionVisible;
+
+    // The stress test objects' world boxes, for culling and picking. Built for objectBvhCount objects.
+    Bvh objectBvh;
+    int objectBvhCount = -1;
+    std::vector<uint32_t> visibleObjects;
+
+    // Picks the stress test object under the cursor, in window coordinates
+    void pickObject(float x, float y);
+
+    // Brick and ogre materials in one texture array, used by the multi-draw and instanced paths
+    MaterialArray materials;
+
+    // Ogre heads drawn with one instanced draw, instanceData mirrors the GPU buffer
+    InstanceBuffer instances;
+    std::vector<InstanceBuffer::Instance> instanceData;
+    void updateInstances();
+    void renderInstances();
+
     void setMatrices();
     bool compile();
 
+    // Logs the time to create every program without and with the program cache
+    void benchmarkPrograms();
+
 public:
     SceneBasic_Uniform();
 
@@ -2,6 +2,7 @@
 #include "scenerunner.h"
 #include "helper/camera.h"
 #include "helper/scene.h"
+#include "helper/geometryarena.h"
 
 #include "../imgui/imgui.h"
 #include "../imgui/imgui_impl_glfw.h"
@@ -144,10 +145,10 @@ bool SceneRunner::init(const std::string& title, int width, int height, int samp
 	return true;
 }
 
-int SceneRunner::run(Camera* camera, Scene* scene)
+int SceneRunner::run(Camera* camera, std::unique_ptr<Scene> scene)
 {
     _camera = camera;
-    _scene = scene;
+    _scene = scene.get();
 
 	assert(_window != nullptr);
 	assert(_scene != nullptr);
@@ -169,6 +170,11 @@ int SceneRunner::run(Camera* camera, Scene* scene)
             GL_DEBUG_SEVERITY_NOTIFICATION, -1, "End debug");
 #endif
 
+    // The scene's GL objects, then the shared ones its meshes lived in, go while the context is still alive
+    _scene = nullptr;
+    scene.reset();
+    GeometryArena::instance().shutdown();
+
     // Close window and terminate GLFW
     glfwTerminate();
 
@@ -1,3 +1,5 @@
+#include <memory>
+
 // Forward declarations
 class Scene;
 class Camera;
@@ -13,7 +15,8 @@ public:
     ~SceneRunner() = default;
 
     bool init(const std::string& title, int width = WINDOW_WIDTH, int height = WINDOW_HEIGHT, int samples = 0);
-    int run(Camera* camera, Scene* scene);
+    // Takes the scene so it is destroyed, with its GL objects, before the context
+    int run(Camera* camera, std::unique_ptr<Scene> scene);
     void loop();
 
     void OnPressKey(int key, int scancode, int action, int mods);